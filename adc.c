@@ -0,0 +1,348 @@
+/*
+ * ADC sampling for PIC32 analog pins.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// ADC control registers, offsets from ADC_ADDR.
+// Registers with step 0x10 have CLR/SET/INV companions at +4/+8/+C.
+//
+#define ADC_ADDR        0x1f84b000
+#define ADCCON1         0x000
+#define ADCCON2         0x010
+#define ADCCON3         0x020
+#define ADCCSS1         0x090       // Scan select, AN0...AN31
+#define ADCCSS2         0x0a0       // Scan select, AN32...AN63
+#define ADCDSTAT1       0x0b0       // Data ready, AN0...AN31
+#define ADCDSTAT2       0x0c0       // Data ready, AN32...AN63
+#define ADCTRG1         0x1a0       // Trigger source, AN0...AN3
+#define ADC0TIME        0x2d0       // ADC0...ADC4 timing, step 0x10
+#define ADCANCON        0x360
+#define ADCDATA0        0x600       // Result for ANx, step 0x10
+#define ADC0CFG         0xd00       // Calibration of ADC0...ADC7, step 4
+
+#define DEVADC0_ADDR    0x1fc45000  // Factory calibration, DEVADC7 at +0x1c
+
+#define CON1_ON         (1 << 15)
+#define CON1_SELRES_12  (3 << 21)   // 12-bit resolution
+#define CON1_STRG_GSW   (1 << 16)   // Scan trigger: global software trigger
+
+#define CON2_BGVRRDY    (1 << 31)   // Band gap reference ready
+#define CON2_EOSRDY     (1 << 29)   // End of scan
+
+#define CON3_SYSCLK     (1 << 30)   // Clock source: SYSCLK
+#define CON3_DIGEN      (0x9f << 16) // Enable ADC0...ADC4 and ADC7
+#define CON3_RQCNVRT    (1 << 8)    // Convert input selected by ADINSEL
+#define CON3_GSWTRG     (1 << 6)    // Global software trigger
+
+#define ANCON_ANEN      0x9f        // Power ADC0...ADC4 and ADC7
+#define ANCON_WKRDY     (0x9f << 8) // Ready after power up
+#define ANCON_WKUP      (5 << 24)   // Warm up time: 32 clocks
+
+#define TRG_STRIG       3           // Trigger source: scan trigger
+
+//
+// Conversion clock: Tq = SYSCLK/2, TAD = Tq/4, about 25 MHz.
+// Sampling time is 50 TAD for all ADCs.
+//
+#define CONCLKDIV       1
+#define ADCDIV          2
+#define SAMC            50
+
+//
+// Timeout for ADC status, in usec.
+//
+#define ADC_TIMEOUT     10000
+
+static volatile unsigned *adc;
+static int adc_ready;                   // Converters are powered up
+static pthread_mutex_t adc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define ADC(reg)        adc[(reg) / 4]
+#define ADC_CLR(reg)    adc[(reg) / 4 + 1]
+#define ADC_SET(reg)    adc[(reg) / 4 + 2]
+
+//
+// Analog inputs of port pins.
+//
+static const struct {
+    char port;
+    int  bit;
+    int  channel;
+} adc_pins[] = {
+    { 'B', 0, 0 },   { 'B', 1, 1 },   { 'B', 2, 2 },   { 'B', 3, 3 },
+    { 'B', 4, 4 },   { 'B', 10, 5 },  { 'B', 11, 6 },  { 'B', 12, 7 },
+    { 'B', 13, 8 },  { 'B', 14, 9 },  { 'B', 15, 10 }, { 'G', 9, 11 },
+    { 'G', 8, 12 },  { 'G', 7, 13 },  { 'G', 6, 14 },  { 'E', 7, 15 },
+    { 'E', 6, 16 },  { 'E', 5, 17 },  { 'E', 4, 18 },  { 'B', 5, 45 },
+    { 'B', 6, 46 },  { 'B', 7, 47 },  { 'B', 8, 48 },  { 'B', 9, 49 },
+};
+
+//
+// Get analog input number of a pin, or -1 when the pin has none.
+//
+int gpio_adc_channel(int pin)
+{
+    unsigned i;
+
+    for (i = 0; i < sizeof(adc_pins) / sizeof(adc_pins[0]); i++) {
+        if (pin == GPIO_PIN(adc_pins[i].port, adc_pins[i].bit))
+            return adc_pins[i].channel;
+    }
+    return -1;
+}
+
+//
+// Wait until bits of an ADC register are set.
+// Return -1 on timeout.
+//
+static int adc_wait(unsigned reg, unsigned mask)
+{
+    int usec;
+
+    for (usec = 0; usec < ADC_TIMEOUT; usec++) {
+        if ((ADC(reg) & mask) == mask)
+            return 0;
+        gpio_udelay(1);
+    }
+    errno = EIO;
+    return -1;
+}
+
+//
+// Map the ADC registers.  When the ADC is not enabled yet,
+// load factory calibration, power up all converters and
+// enable them with 12-bit resolution.
+// Called with adc_lock held.
+//
+static int adc_setup()
+{
+    int i;
+
+    adc = gpio_map_sfr(ADC_ADDR, 0x1000);
+    if (!adc)
+        return -1;
+
+    if (ADC(ADCCON1) & CON1_ON)
+        return 0;
+
+    volatile unsigned *devadc = gpio_map_sfr(DEVADC0_ADDR, 0x20);
+    if (!devadc)
+        return -1;
+    for (i = 0; i < 8; i++) {
+        if (i != 5 && i != 6)
+            ADC(ADC0CFG + 4*i) = devadc[i];
+    }
+
+    ADC(ADCCON1) = CON1_SELRES_12 | CON1_STRG_GSW;
+    ADC(ADCCON2) = (SAMC << 16) | ADCDIV;
+    ADC(ADCCON3) = CON3_SYSCLK | (CONCLKDIV << 24);
+    for (i = 0; i < 5; i++)
+        ADC(ADC0TIME + 0x10*i) = (3 << 24) | (ADCDIV << 16) | SAMC;
+
+    ADC_SET(ADCCON1) = CON1_ON;
+    if (adc_wait(ADCCON2, CON2_BGVRRDY) < 0)
+        return -1;
+
+    ADC(ADCANCON) = ANCON_WKUP | ANCON_ANEN;
+    if (adc_wait(ADCANCON, ANCON_WKRDY) < 0)
+        return -1;
+
+    ADC_SET(ADCCON3) = CON3_DIGEN;
+    return 0;
+}
+
+//
+// Set up the ADC once, when first used by any thread.
+//
+static int adc_init()
+{
+    int status = 0;
+
+    if (__atomic_load_n(&adc_ready, __ATOMIC_ACQUIRE))
+        return 0;
+
+    pthread_mutex_lock(&adc_lock);
+    if (!adc_ready) {
+        status = adc_setup();
+        if (status == 0)
+            __atomic_store_n(&adc_ready, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&adc_lock);
+    return status;
+}
+
+//
+// Convert one analog input.  Return 12-bit value, or -1 on error.
+//
+int gpio_adc_read(int channel)
+{
+    if (channel < 0 || channel > 63) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (adc_init() < 0)
+        return -1;
+
+    unsigned stat = (channel < 32) ? ADCDSTAT1 : ADCDSTAT2;
+    int value = -1;
+
+    // Channel select and conversion request share ADCCON3.
+    pthread_mutex_lock(&adc_lock);
+    ADC_CLR(ADCCON3) = 0x3f;
+    ADC_SET(ADCCON3) = CON3_RQCNVRT | channel;
+    if (adc_wait(stat, 1 << (channel & 31)) == 0)
+        value = ADC(ADCDATA0 + 0x10*channel);
+    pthread_mutex_unlock(&adc_lock);
+    return value;
+}
+
+//
+// Scan thread: trigger a scan every period and
+// put the results into the ring.
+//
+static void *adc_scan_thread(void *arg)
+{
+    gpio_adc_scan_t *scan = arg;
+    struct timespec deadline = { 0 };
+    int i;
+
+    while (!scan->stop) {
+        gpio_sleep_period(&deadline, scan->period_usec * 1000LL);
+
+        (void) ADC(ADCCON2);
+        ADC_SET(ADCCON3) = CON3_GSWTRG;
+        uint64_t t = gpio_time_ns();
+        if (adc_wait(ADCCON2, CON2_EOSRDY) < 0)
+            continue;
+
+        // Drop the frame when the reader is behind.
+        unsigned head = scan->head;
+        if (head - __atomic_load_n(&scan->tail, __ATOMIC_ACQUIRE) >= scan->size) {
+            scan->overruns++;
+            continue;
+        }
+
+        gpio_adc_frame_t *f = &scan->ring[head & (scan->size - 1)];
+        f->time_ns = t;
+        for (i = 0; i < scan->nchan; i++)
+            f->value[i] = ADC(ADCDATA0 + 0x10*scan->channel[i]);
+
+        __atomic_store_n(&scan->head, head + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+//
+// Start continuous scan of several analog inputs at a given rate.
+// The ring holds nframes (rounded up to a power of two).
+//
+int gpio_adc_scan_start(gpio_adc_scan_t *scan, const int *channel, int nchan,
+                        unsigned rate_hz, unsigned nframes)
+{
+    unsigned css[2] = { 0, 0 };
+    int i;
+
+    memset(scan, 0, sizeof(*scan));
+    if (nchan < 1 || nchan > GPIO_ADC_MAXSCAN || rate_hz == 0 || rate_hz > 1000000) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < nchan; i++) {
+        if (channel[i] < 0 || channel[i] > 63) {
+            errno = EINVAL;
+            return -1;
+        }
+        scan->channel[i] = channel[i];
+        css[channel[i] >> 5] |= 1 << (channel[i] & 31);
+    }
+    if (adc_init() < 0)
+        return -1;
+
+    scan->nchan = nchan;
+    scan->period_usec = 1000000 / rate_hz;
+    for (scan->size = 1; scan->size < nframes; scan->size <<= 1)
+        continue;
+    scan->ring = calloc(scan->size, sizeof(gpio_adc_frame_t));
+    if (!scan->ring)
+        return -1;
+
+    // Dedicated and shared class 2 inputs need the scan trigger.
+    for (i = 0; i < nchan; i++) {
+        int ch = channel[i];
+
+        if (ch < 12) {
+            unsigned reg = ADCTRG1 + 0x10 * (ch / 4);
+            int shift = 8 * (ch % 4);
+
+            ADC(reg) = (ADC(reg) & ~(0x1f << shift)) | (TRG_STRIG << shift);
+        }
+    }
+    ADC(ADCCSS1) = css[0];
+    ADC(ADCCSS2) = css[1];
+
+    int err = pthread_create(&scan->thread, 0, adc_scan_thread, scan);
+    if (err) {
+        free(scan->ring);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Get the next frame from the ring.
+// Return 0 when the ring is empty.
+//
+int gpio_adc_scan_get(gpio_adc_scan_t *scan, gpio_adc_frame_t *frame)
+{
+    unsigned tail = scan->tail;
+
+    if (__atomic_load_n(&scan->head, __ATOMIC_ACQUIRE) == tail)
+        return 0;
+
+    *frame = scan->ring[tail & (scan->size - 1)];
+    __atomic_store_n(&scan->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+//
+// Stop the scan thread and free the ring.
+//
+void gpio_adc_scan_stop(gpio_adc_scan_t *scan)
+{
+    scan->stop = 1;
+    pthread_join(scan->thread, 0);
+
+    ADC(ADCCSS1) = 0;
+    ADC(ADCCSS2) = 0;
+    free(scan->ring);
+    scan->ring = 0;
+}
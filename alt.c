@@ -146,36 +146,77 @@
 #define RPG8R           0x16A0
 #define RPG9R           0x16A4
 
+//
+// Names of PPS control registers, for gpio save.
+//
+#define PPS_REG(r)      { r, #r }
+
+static const struct {
+    int         offset;
+    const char *name;
+} pps_regs[] = {
+    PPS_REG(INT1R), PPS_REG(INT2R), PPS_REG(INT3R), PPS_REG(INT4R),
+    PPS_REG(T2CKR), PPS_REG(T3CKR), PPS_REG(T4CKR), PPS_REG(T5CKR),
+    PPS_REG(T6CKR), PPS_REG(T7CKR), PPS_REG(T8CKR), PPS_REG(T9CKR),
+    PPS_REG(IC1R), PPS_REG(IC2R), PPS_REG(IC3R), PPS_REG(IC4R), PPS_REG(IC5R),
+    PPS_REG(IC6R), PPS_REG(IC7R), PPS_REG(IC8R), PPS_REG(IC9R),
+    PPS_REG(OCFAR), PPS_REG(U1RXR), PPS_REG(U1CTSR), PPS_REG(U2RXR),
+    PPS_REG(U2CTSR), PPS_REG(U3RXR), PPS_REG(U3CTSR), PPS_REG(U4RXR),
+    PPS_REG(U4CTSR), PPS_REG(U5RXR), PPS_REG(U5CTSR), PPS_REG(U6RXR),
+    PPS_REG(U6CTSR), PPS_REG(SDI1R), PPS_REG(SS1R), PPS_REG(SDI2R),
+    PPS_REG(SS2R), PPS_REG(SDI3R), PPS_REG(SS3R), PPS_REG(SDI4R),
+    PPS_REG(SS4R), PPS_REG(SDI5R), PPS_REG(SS5R), PPS_REG(SDI6R),
+    PPS_REG(SS6R), PPS_REG(C1RXR), PPS_REG(C2RXR), PPS_REG(REFCLKI1R),
+    PPS_REG(REFCLKI3R), PPS_REG(REFCLKI4R), PPS_REG(RPA14R), PPS_REG(RPA15R),
+    PPS_REG(RPB0R), PPS_REG(RPB1R), PPS_REG(RPB2R), PPS_REG(RPB3R),
+    PPS_REG(RPB5R), PPS_REG(RPB6R), PPS_REG(RPB7R), PPS_REG(RPB8R),
+    PPS_REG(RPB9R), PPS_REG(RPB10R), PPS_REG(RPB14R), PPS_REG(RPB15R),
+    PPS_REG(RPC1R), PPS_REG(RPC2R), PPS_REG(RPC3R), PPS_REG(RPC4R),
+    PPS_REG(RPC13R), PPS_REG(RPC14R), PPS_REG(RPD0R), PPS_REG(RPD1R),
+    PPS_REG(RPD2R), PPS_REG(RPD3R), PPS_REG(RPD4R), PPS_REG(RPD5R),
+    PPS_REG(RPD6R), PPS_REG(RPD7R), PPS_REG(RPD9R), PPS_REG(RPD10R),
+    PPS_REG(RPD11R), PPS_REG(RPD12R), PPS_REG(RPD14R), PPS_REG(RPD15R),
+    PPS_REG(RPE3R), PPS_REG(RPE5R), PPS_REG(RPE8R), PPS_REG(RPE9R),
+    PPS_REG(RPF0R), PPS_REG(RPF1R), PPS_REG(RPF2R), PPS_REG(RPF3R),
+    PPS_REG(RPF4R), PPS_REG(RPF5R), PPS_REG(RPF8R), PPS_REG(RPF12R),
+    PPS_REG(RPF13R), PPS_REG(RPG0R), PPS_REG(RPG1R), PPS_REG(RPG6R),
+    PPS_REG(RPG7R), PPS_REG(RPG8R), PPS_REG(RPG9R),
+};
+
 static ptrdiff_t pps_base;          // PPS registers mapped here
+static __thread uint8_t *pps_image; // Registers are redirected here
+static __thread unsigned pps_accesses;  // Register reads and writes, for statistics
 
 //
 // Get access to PPS control registers.
 // Set pps_base to a base address of the appropriate page.
+// Return -1 on failure, with errno set.
 //
-static void pps_init()
+static int pps_init()
 {
     const int PPS_ADDR = 0x1f801000;
-    extern int gpio_mem_fd;
-
-    // Map a page of memory to the PPS address
-    pps_base = (ptrdiff_t) mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED,
-        gpio_mem_fd, PPS_ADDR);
-    if (pps_base < 0) {
-        printf("PPS mmap failed: %s\n", strerror(errno));
-        exit(-1);
-    }
+
+    volatile unsigned *base = gpio_map_sfr(PPS_ADDR, 4096);
+    if (!base)
+        return -1;
+
+    pps_base = (ptrdiff_t) base;
+    return 0;
 }
 
 //
 // Read PPS control register.
-// Return bits 3:0.
+// Return bits 3:0, or 0 when registers are not accessible.
 //
 static uint32_t read_sfr(int offset)
 {
-    if (!pps_base)
-        pps_init();
+    if (pps_image)
+        return pps_image[(offset - GPIO_PPS_FIRST) / 4];
+    if (!pps_base && pps_init() < 0)
+        return 0;
 
     volatile uint32_t *regp = (uint32_t*) (pps_base + (offset & 0xfff));
+    pps_accesses++;
     uint32_t value = *regp;
     if (gpio_debug > 1)
         printf("--- %s: [%04x] -> %08x\n", __func__, offset, value);
@@ -184,16 +225,25 @@ static uint32_t read_sfr(int offset)
 
 //
 // Write PPS control register.
+// Negative value means the pin or mode is wrong: nothing is written.
 //
-static void write_sfr(int offset, uint32_t value)
+static int write_sfr(int offset, int value)
 {
-    if (!pps_base)
-        pps_init();
+    if (value < 0)
+        return -1;
+    if (pps_image) {
+        pps_image[(offset - GPIO_PPS_FIRST) / 4] = value;
+        return 0;
+    }
+    if (!pps_base && pps_init() < 0)
+        return -1;
 
     volatile uint32_t *regp = (uint32_t*) (pps_base + (offset & 0xfff));
+    pps_accesses++;
     *regp = value;
     if (gpio_debug > 0)
         printf("--- %s: %08x -> [%04x]\n", __func__, value, offset);
+    return 0;
 }
 
 //
@@ -201,10 +251,15 @@ static void write_sfr(int offset, uint32_t value)
 //
 static void clear_sfr(int offset)
 {
-    if (!pps_base)
-        pps_init();
+    if (pps_image) {
+        pps_image[(offset - GPIO_PPS_FIRST) / 4] = 0;
+        return;
+    }
+    if (!pps_base && pps_init() < 0)
+        return;
 
     volatile uint32_t *regp = (uint32_t*) (pps_base + (offset & 0xfff));
+    pps_accesses++;
     uint32_t value = *regp;
     if (value & 0xf) {
         *regp = 0;
@@ -324,7 +379,7 @@ static gpio_mode_t output_group4_to_mode(uint32_t value)
 //
 // Get output mapping for a given pin.
 //
-gpio_mode_t gpio_get_output_mapping(int pin)
+static gpio_mode_t output_mapping(int pin)
 {
     switch (pin) {
     case GPIO_PIN('D',2):  return output_group1_to_mode(read_sfr(RPD2R));
@@ -469,7 +524,7 @@ static gpio_mode_t read_input_group4(int value)
 //
 // Get input mapping for a given pin.
 //
-gpio_mode_t gpio_get_input_mapping(int pin)
+static gpio_mode_t input_mapping(int pin)
 {
     switch (pin) {
     case GPIO_PIN('A',14): return read_input_group1(13);
@@ -609,7 +664,7 @@ static gpio_mode_t clear_input_group4(int value)
 //
 // Clear mapping for a given pin.
 //
-void gpio_clear_mapping(int pin)
+static void clear_mapping(int pin)
 {
     switch (pin) {
     case GPIO_PIN('A',14): clear_input_group1(13); clear_sfr(RPA14R); break;
@@ -668,8 +723,8 @@ static int pin_to_input_group1(int pin)
 {
     switch (pin) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case GPIO_PIN('A',14): return 13;
     case GPIO_PIN('B',10): return 6;
     case GPIO_PIN('B',5):  return 8;
@@ -690,8 +745,8 @@ static int pin_to_input_group2(int pin)
 {
     switch (pin) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case GPIO_PIN('A',15): return 13;
     case GPIO_PIN('B',1):  return 5;
     case GPIO_PIN('B',3):  return 8;
@@ -712,8 +767,8 @@ static int pin_to_input_group3(int pin)
 {
     switch (pin) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case GPIO_PIN('B',0):  return 5;
     case GPIO_PIN('B',15): return 3;
     case GPIO_PIN('B',7):  return 7;
@@ -733,8 +788,8 @@ static int pin_to_input_group4(int pin)
 {
     switch (pin) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case GPIO_PIN('B',2): return 7;
     case GPIO_PIN('B',6): return 5;
     case GPIO_PIN('C',2): return 12;
@@ -755,8 +810,8 @@ static int mode_to_output_group1(gpio_mode_t mode)
 {
     switch (mode) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case MODE_C1TX:     return 15;
     case MODE_C2OUT:    return 14;
     case MODE_OC3:      return 11;
@@ -780,8 +835,8 @@ static int mode_to_output_group2(gpio_mode_t mode)
 {
     switch (mode) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case MODE_OC4:      return 11;
     case MODE_OC7:      return 12;
     case MODE_REFCLKO1: return 15;
@@ -805,8 +860,8 @@ static int mode_to_output_group3(gpio_mode_t mode)
 {
     switch (mode) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case MODE_C1OUT:    return 14;
     case MODE_OC5:      return 11;
     case MODE_OC8:      return 12;
@@ -830,8 +885,8 @@ static int mode_to_output_group4(gpio_mode_t mode)
 {
     switch (mode) {
     default:
-        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
-        exit(-1);
+        errno = EINVAL;
+        return -1;
     case MODE_C2TX:  return 15;
     case MODE_OC1:   return 12;
     case MODE_OC2:   return 11;
@@ -848,64 +903,65 @@ static int mode_to_output_group4(gpio_mode_t mode)
 
 //
 // Set given pin to a specified mode.
+// Return -1 when the pin has no such function.
 //
-void gpio_set_mapping(int pin, gpio_mode_t mode)
+static int set_mapping(int pin, gpio_mode_t mode)
 {
     //
     // Input modes.
     //
     switch (mode) {
-    case MODE_C1RX:      write_sfr(C1RXR,     pin_to_input_group2(pin)); return;
-    case MODE_C2RX:      write_sfr(C2RXR,     pin_to_input_group3(pin)); return;
-    case MODE_IC1:       write_sfr(IC1R,      pin_to_input_group4(pin)); return;
-    case MODE_IC2:       write_sfr(IC2R,      pin_to_input_group3(pin)); return;
-    case MODE_IC3:       write_sfr(IC3R,      pin_to_input_group1(pin)); return;
-    case MODE_IC4:       write_sfr(IC4R,      pin_to_input_group2(pin)); return;
-    case MODE_IC5:       write_sfr(IC5R,      pin_to_input_group3(pin)); return;
-    case MODE_IC6:       write_sfr(IC6R,      pin_to_input_group4(pin)); return;
-    case MODE_IC7:       write_sfr(IC7R,      pin_to_input_group1(pin)); return;
-    case MODE_IC8:       write_sfr(IC8R,      pin_to_input_group2(pin)); return;
-    case MODE_IC9:       write_sfr(IC9R,      pin_to_input_group3(pin)); return;
-    case MODE_INT1:      write_sfr(INT1R,     pin_to_input_group4(pin)); return;
-    case MODE_INT2:      write_sfr(INT2R,     pin_to_input_group3(pin)); return;
-    case MODE_INT3:      write_sfr(INT3R,     pin_to_input_group1(pin)); return;
-    case MODE_INT4:      write_sfr(INT4R,     pin_to_input_group2(pin)); return;
-    case MODE_OCFA:      write_sfr(OCFAR,     pin_to_input_group4(pin)); return;
-    case MODE_REFCLKI1:  write_sfr(REFCLKI1R, pin_to_input_group1(pin)); return;
-    case MODE_REFCLKI3:  write_sfr(REFCLKI3R, pin_to_input_group4(pin)); return;
-    case MODE_REFCLKI4:  write_sfr(REFCLKI4R, pin_to_input_group2(pin)); return;
-    case MODE_SDI1:      write_sfr(SDI1R,     pin_to_input_group1(pin)); return;
-    case MODE_SDI2:      write_sfr(SDI2R,     pin_to_input_group2(pin)); return;
-    case MODE_SDI3:      write_sfr(SDI3R,     pin_to_input_group1(pin)); return;
-    case MODE_SDI4:      write_sfr(SDI4R,     pin_to_input_group2(pin)); return;
-    case MODE_SDI5:      write_sfr(SDI5R,     pin_to_input_group1(pin)); return;
-    case MODE_SDI6:      write_sfr(SDI6R,     pin_to_input_group4(pin)); return;
-    case MODE_SS1I:      write_sfr(SS1R,      pin_to_input_group3(pin)); return;
-    case MODE_SS2I:      write_sfr(SS2R,      pin_to_input_group4(pin)); return;
-    case MODE_SS3I:      write_sfr(SS3R,      pin_to_input_group3(pin)); return;
-    case MODE_SS4I:      write_sfr(SS4R,      pin_to_input_group3(pin)); return;
-    case MODE_SS5I:      write_sfr(SS5R,      pin_to_input_group3(pin)); return;
-    case MODE_SS6I:      write_sfr(SS6R,      pin_to_input_group1(pin)); return;
-    case MODE_T2CK:      write_sfr(T2CKR,     pin_to_input_group1(pin)); return;
-    case MODE_T3CK:      write_sfr(T3CKR,     pin_to_input_group3(pin)); return;
-    case MODE_T4CK:      write_sfr(T4CKR,     pin_to_input_group4(pin)); return;
-    case MODE_T5CK:      write_sfr(T5CKR,     pin_to_input_group2(pin)); return;
-    case MODE_T6CK:      write_sfr(T6CKR,     pin_to_input_group1(pin)); return;
-    case MODE_T7CK:      write_sfr(T7CKR,     pin_to_input_group2(pin)); return;
-    case MODE_T8CK:      write_sfr(T8CKR,     pin_to_input_group3(pin)); return;
-    case MODE_T9CK:      write_sfr(T9CKR,     pin_to_input_group4(pin)); return;
-    case MODE_U1CTS:     write_sfr(U1CTSR,    pin_to_input_group3(pin)); return;
-    case MODE_U1RX:      write_sfr(U1RXR,     pin_to_input_group1(pin)); return;
-    case MODE_U2CTS:     write_sfr(U2CTSR,    pin_to_input_group1(pin)); return;
-    case MODE_U2RX:      write_sfr(U2RXR,     pin_to_input_group3(pin)); return;
-    case MODE_U3CTS:     write_sfr(U3CTSR,    pin_to_input_group4(pin)); return;
-    case MODE_U3RX:      write_sfr(U3RXR,     pin_to_input_group2(pin)); return;
-    case MODE_U4CTS:     write_sfr(U4CTSR,    pin_to_input_group2(pin)); return;
-    case MODE_U4RX:      write_sfr(U4RXR,     pin_to_input_group4(pin)); return;
-    case MODE_U5CTS:     write_sfr(U5CTSR,    pin_to_input_group3(pin)); return;
-    case MODE_U5RX:      write_sfr(U5RXR,     pin_to_input_group1(pin)); return;
-    case MODE_U6CTS:     write_sfr(U6CTSR,    pin_to_input_group1(pin)); return;
-    case MODE_U6RX:      write_sfr(U6RXR,     pin_to_input_group4(pin)); return;
+    case MODE_C1RX:      return write_sfr(C1RXR,     pin_to_input_group2(pin));
+    case MODE_C2RX:      return write_sfr(C2RXR,     pin_to_input_group3(pin));
+    case MODE_IC1:       return write_sfr(IC1R,      pin_to_input_group4(pin));
+    case MODE_IC2:       return write_sfr(IC2R,      pin_to_input_group3(pin));
+    case MODE_IC3:       return write_sfr(IC3R,      pin_to_input_group1(pin));
+    case MODE_IC4:       return write_sfr(IC4R,      pin_to_input_group2(pin));
+    case MODE_IC5:       return write_sfr(IC5R,      pin_to_input_group3(pin));
+    case MODE_IC6:       return write_sfr(IC6R,      pin_to_input_group4(pin));
+    case MODE_IC7:       return write_sfr(IC7R,      pin_to_input_group1(pin));
+    case MODE_IC8:       return write_sfr(IC8R,      pin_to_input_group2(pin));
+    case MODE_IC9:       return write_sfr(IC9R,      pin_to_input_group3(pin));
+    case MODE_INT1:      return write_sfr(INT1R,     pin_to_input_group4(pin));
+    case MODE_INT2:      return write_sfr(INT2R,     pin_to_input_group3(pin));
+    case MODE_INT3:      return write_sfr(INT3R,     pin_to_input_group1(pin));
+    case MODE_INT4:      return write_sfr(INT4R,     pin_to_input_group2(pin));
+    case MODE_OCFA:      return write_sfr(OCFAR,     pin_to_input_group4(pin));
+    case MODE_REFCLKI1:  return write_sfr(REFCLKI1R, pin_to_input_group1(pin));
+    case MODE_REFCLKI3:  return write_sfr(REFCLKI3R, pin_to_input_group4(pin));
+    case MODE_REFCLKI4:  return write_sfr(REFCLKI4R, pin_to_input_group2(pin));
+    case MODE_SDI1:      return write_sfr(SDI1R,     pin_to_input_group1(pin));
+    case MODE_SDI2:      return write_sfr(SDI2R,     pin_to_input_group2(pin));
+    case MODE_SDI3:      return write_sfr(SDI3R,     pin_to_input_group1(pin));
+    case MODE_SDI4:      return write_sfr(SDI4R,     pin_to_input_group2(pin));
+    case MODE_SDI5:      return write_sfr(SDI5R,     pin_to_input_group1(pin));
+    case MODE_SDI6:      return write_sfr(SDI6R,     pin_to_input_group4(pin));
+    case MODE_SS1I:      return write_sfr(SS1R,      pin_to_input_group3(pin));
+    case MODE_SS2I:      return write_sfr(SS2R,      pin_to_input_group4(pin));
+    case MODE_SS3I:      return write_sfr(SS3R,      pin_to_input_group3(pin));
+    case MODE_SS4I:      return write_sfr(SS4R,      pin_to_input_group3(pin));
+    case MODE_SS5I:      return write_sfr(SS5R,      pin_to_input_group3(pin));
+    case MODE_SS6I:      return write_sfr(SS6R,      pin_to_input_group1(pin));
+    case MODE_T2CK:      return write_sfr(T2CKR,     pin_to_input_group1(pin));
+    case MODE_T3CK:      return write_sfr(T3CKR,     pin_to_input_group3(pin));
+    case MODE_T4CK:      return write_sfr(T4CKR,     pin_to_input_group4(pin));
+    case MODE_T5CK:      return write_sfr(T5CKR,     pin_to_input_group2(pin));
+    case MODE_T6CK:      return write_sfr(T6CKR,     pin_to_input_group1(pin));
+    case MODE_T7CK:      return write_sfr(T7CKR,     pin_to_input_group2(pin));
+    case MODE_T8CK:      return write_sfr(T8CKR,     pin_to_input_group3(pin));
+    case MODE_T9CK:      return write_sfr(T9CKR,     pin_to_input_group4(pin));
+    case MODE_U1CTS:     return write_sfr(U1CTSR,    pin_to_input_group3(pin));
+    case MODE_U1RX:      return write_sfr(U1RXR,     pin_to_input_group1(pin));
+    case MODE_U2CTS:     return write_sfr(U2CTSR,    pin_to_input_group1(pin));
+    case MODE_U2RX:      return write_sfr(U2RXR,     pin_to_input_group3(pin));
+    case MODE_U3CTS:     return write_sfr(U3CTSR,    pin_to_input_group4(pin));
+    case MODE_U3RX:      return write_sfr(U3RXR,     pin_to_input_group2(pin));
+    case MODE_U4CTS:     return write_sfr(U4CTSR,    pin_to_input_group2(pin));
+    case MODE_U4RX:      return write_sfr(U4RXR,     pin_to_input_group4(pin));
+    case MODE_U5CTS:     return write_sfr(U5CTSR,    pin_to_input_group3(pin));
+    case MODE_U5RX:      return write_sfr(U5RXR,     pin_to_input_group1(pin));
+    case MODE_U6CTS:     return write_sfr(U6CTSR,    pin_to_input_group1(pin));
+    case MODE_U6RX:      return write_sfr(U6RXR,     pin_to_input_group4(pin));
     default:
         break;
     }
@@ -914,54 +970,56 @@ void gpio_set_mapping(int pin, gpio_mode_t mode)
     // Output modes.
     //
     switch (pin) {
-    case GPIO_PIN('A',14): write_sfr(RPA14R, mode_to_output_group1(mode)); return;
-    case GPIO_PIN('A',15): write_sfr(RPA15R, mode_to_output_group2(mode)); return;
-    case GPIO_PIN('B',0):  write_sfr(RPB0R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('B',10): write_sfr(RPB10R, mode_to_output_group1(mode)); return;
-    case GPIO_PIN('B',15): write_sfr(RPB15R, mode_to_output_group3(mode)); return;
-    case GPIO_PIN('B',1):  write_sfr(RPB1R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('B',2):  write_sfr(RPB2R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('B',3):  write_sfr(RPB3R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('B',5):  write_sfr(RPB5R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('B',6):  write_sfr(RPB6R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('B',7):  write_sfr(RPB7R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('B',8):  write_sfr(RPB8R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('B',9):  write_sfr(RPB9R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('C',1):  write_sfr(RPC1R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('C',2):  write_sfr(RPC2R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('C',3):  write_sfr(RPC3R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('C',4):  write_sfr(RPC4R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('D',0):  write_sfr(RPD0R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('D',11): write_sfr(RPD11R, mode_to_output_group2(mode)); return;
-    case GPIO_PIN('D',12): write_sfr(RPD12R, mode_to_output_group3(mode)); return;
-    case GPIO_PIN('D',14): write_sfr(RPD14R, mode_to_output_group1(mode)); return;
-    case GPIO_PIN('D',2):  write_sfr(RPD2R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('D',3):  write_sfr(RPD3R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('D',4):  write_sfr(RPD4R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('D',5):  write_sfr(RPD5R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('D',6):  write_sfr(RPD6R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('D',7):  write_sfr(RPD7R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('D',9):  write_sfr(RPD9R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('E',3):  write_sfr(RPE3R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('E',5):  write_sfr(RPE5R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('E',8):  write_sfr(RPE8R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('E',9):  write_sfr(RPE9R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('F',0):  write_sfr(RPF0R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('F',12): write_sfr(RPF12R, mode_to_output_group3(mode)); return;
-    case GPIO_PIN('F',1):  write_sfr(RPF1R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('F',2):  write_sfr(RPF2R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('F',3):  write_sfr(RPF3R,  mode_to_output_group4(mode)); return;
-    case GPIO_PIN('F',4):  write_sfr(RPF4R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('F',5):  write_sfr(RPF5R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('F',8):  write_sfr(RPF8R,  mode_to_output_group3(mode)); return;
-    case GPIO_PIN('G',0):  write_sfr(RPG0R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('G',1):  write_sfr(RPG1R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('G',7):  write_sfr(RPG7R,  mode_to_output_group2(mode)); return;
-    case GPIO_PIN('G',8):  write_sfr(RPG8R,  mode_to_output_group1(mode)); return;
-    case GPIO_PIN('G',9):  write_sfr(RPG9R,  mode_to_output_group4(mode)); return;
+    case GPIO_PIN('A',14): return write_sfr(RPA14R, mode_to_output_group1(mode));
+    case GPIO_PIN('A',15): return write_sfr(RPA15R, mode_to_output_group2(mode));
+    case GPIO_PIN('B',0):  return write_sfr(RPB0R,  mode_to_output_group3(mode));
+    case GPIO_PIN('B',10): return write_sfr(RPB10R, mode_to_output_group1(mode));
+    case GPIO_PIN('B',15): return write_sfr(RPB15R, mode_to_output_group3(mode));
+    case GPIO_PIN('B',1):  return write_sfr(RPB1R,  mode_to_output_group2(mode));
+    case GPIO_PIN('B',2):  return write_sfr(RPB2R,  mode_to_output_group4(mode));
+    case GPIO_PIN('B',3):  return write_sfr(RPB3R,  mode_to_output_group2(mode));
+    case GPIO_PIN('B',5):  return write_sfr(RPB5R,  mode_to_output_group1(mode));
+    case GPIO_PIN('B',6):  return write_sfr(RPB6R,  mode_to_output_group4(mode));
+    case GPIO_PIN('B',7):  return write_sfr(RPB7R,  mode_to_output_group3(mode));
+    case GPIO_PIN('B',8):  return write_sfr(RPB8R,  mode_to_output_group3(mode));
+    case GPIO_PIN('B',9):  return write_sfr(RPB9R,  mode_to_output_group1(mode));
+    case GPIO_PIN('C',1):  return write_sfr(RPC1R,  mode_to_output_group1(mode));
+    case GPIO_PIN('C',2):  return write_sfr(RPC2R,  mode_to_output_group4(mode));
+    case GPIO_PIN('C',3):  return write_sfr(RPC3R,  mode_to_output_group3(mode));
+    case GPIO_PIN('C',4):  return write_sfr(RPC4R,  mode_to_output_group2(mode));
+    case GPIO_PIN('D',0):  return write_sfr(RPD0R,  mode_to_output_group4(mode));
+    case GPIO_PIN('D',11): return write_sfr(RPD11R, mode_to_output_group2(mode));
+    case GPIO_PIN('D',12): return write_sfr(RPD12R, mode_to_output_group3(mode));
+    case GPIO_PIN('D',14): return write_sfr(RPD14R, mode_to_output_group1(mode));
+    case GPIO_PIN('D',2):  return write_sfr(RPD2R,  mode_to_output_group1(mode));
+    case GPIO_PIN('D',3):  return write_sfr(RPD3R,  mode_to_output_group2(mode));
+    case GPIO_PIN('D',4):  return write_sfr(RPD4R,  mode_to_output_group3(mode));
+    case GPIO_PIN('D',5):  return write_sfr(RPD5R,  mode_to_output_group4(mode));
+    case GPIO_PIN('D',6):  return write_sfr(RPD6R,  mode_to_output_group1(mode));
+    case GPIO_PIN('D',7):  return write_sfr(RPD7R,  mode_to_output_group2(mode));
+    case GPIO_PIN('D',9):  return write_sfr(RPD9R,  mode_to_output_group3(mode));
+    case GPIO_PIN('E',3):  return write_sfr(RPE3R,  mode_to_output_group3(mode));
+    case GPIO_PIN('E',5):  return write_sfr(RPE5R,  mode_to_output_group2(mode));
+    case GPIO_PIN('E',8):  return write_sfr(RPE8R,  mode_to_output_group4(mode));
+    case GPIO_PIN('E',9):  return write_sfr(RPE9R,  mode_to_output_group3(mode));
+    case GPIO_PIN('F',0):  return write_sfr(RPF0R,  mode_to_output_group2(mode));
+    case GPIO_PIN('F',12): return write_sfr(RPF12R, mode_to_output_group3(mode));
+    case GPIO_PIN('F',1):  return write_sfr(RPF1R,  mode_to_output_group1(mode));
+    case GPIO_PIN('F',2):  return write_sfr(RPF2R,  mode_to_output_group4(mode));
+    case GPIO_PIN('F',3):  return write_sfr(RPF3R,  mode_to_output_group4(mode));
+    case GPIO_PIN('F',4):  return write_sfr(RPF4R,  mode_to_output_group1(mode));
+    case GPIO_PIN('F',5):  return write_sfr(RPF5R,  mode_to_output_group2(mode));
+    case GPIO_PIN('F',8):  return write_sfr(RPF8R,  mode_to_output_group3(mode));
+    case GPIO_PIN('G',0):  return write_sfr(RPG0R,  mode_to_output_group2(mode));
+    case GPIO_PIN('G',1):  return write_sfr(RPG1R,  mode_to_output_group1(mode));
+    case GPIO_PIN('G',7):  return write_sfr(RPG7R,  mode_to_output_group2(mode));
+    case GPIO_PIN('G',8):  return write_sfr(RPG8R,  mode_to_output_group1(mode));
+    case GPIO_PIN('G',9):  return write_sfr(RPG9R,  mode_to_output_group4(mode));
     default:
         break;
     }
+    errno = EINVAL;
+    return -1;
 }
 
 static int pin_in_input_group1(int pin)
@@ -1248,3 +1306,86 @@ int gpio_has_mapping(int pin, gpio_mode_t mode)
     }
     return 0;
 }
+
+//
+// Get output mapping for a given pin, counted in statistics.
+//
+gpio_mode_t gpio_get_output_mapping(int pin)
+{
+    uint64_t t0 = GPIO_STATS_START();
+    unsigned n = pps_accesses;
+    gpio_mode_t mode = output_mapping(pin);
+
+    GPIO_STATS_END(GPIO_OP_GET_MAPPING, pin, pps_accesses - n, t0);
+    return mode;
+}
+
+//
+// Get input mapping for a given pin.
+//
+gpio_mode_t gpio_get_input_mapping(int pin)
+{
+    uint64_t t0 = GPIO_STATS_START();
+    unsigned n = pps_accesses;
+    gpio_mode_t mode = input_mapping(pin);
+
+    GPIO_STATS_END(GPIO_OP_GET_MAPPING, pin, pps_accesses - n, t0);
+    return mode;
+}
+
+//
+// Clear mapping for a given pin.
+//
+void gpio_clear_mapping(int pin)
+{
+    uint64_t t0 = GPIO_STATS_START();
+    unsigned n = pps_accesses;
+
+    clear_mapping(pin);
+    GPIO_STATS_END(GPIO_OP_CLEAR_MAPPING, pin, pps_accesses - n, t0);
+}
+
+//
+// Set given pin to a specified mode.
+// Return -1 when the pin has no such function.
+//
+int gpio_set_mapping(int pin, gpio_mode_t mode)
+{
+    uint64_t t0 = GPIO_STATS_START();
+    unsigned n = pps_accesses;
+    int status = set_mapping(pin, mode);
+
+    GPIO_STATS_END(GPIO_OP_SET_MAPPING, pin, pps_accesses - n, t0);
+    return status;
+}
+
+//
+// Get name of PPS register by offset, or 0 when there is no such register.
+//
+const char *gpio_pps_name(int offset)
+{
+    unsigned i;
+
+    for (i = 0; i < sizeof(pps_regs) / sizeof(pps_regs[0]); i++) {
+        if (pps_regs[i].offset == offset)
+            return pps_regs[i].name;
+    }
+    return 0;
+}
+
+//
+// Set mapping of a pin in an image of PPS registers instead of
+// the hardware: clear the old mapping, and map an alternative function.
+// Plain input, output and analog modes only clear the mapping.
+//
+int gpio_pps_set_mode(uint8_t *pps, int pin, gpio_mode_t mode)
+{
+    int status = 0;
+
+    pps_image = pps;
+    clear_mapping(pin);
+    if (mode != MODE_INPUT && mode != MODE_OUTPUT && mode != MODE_ANALOG)
+        status = set_mapping(pin, mode);
+    pps_image = 0;
+    return status;
+}
@@ -0,0 +1,564 @@
+/*
+ * Capture of PIC32 port samples to a file.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gpio.h"
+
+//
+// Ring size in frames, and the smallest chunk written at once.
+//
+#define RING_FRAMES     (1 << 20)
+#define WRITE_FRAMES    4096
+
+//
+// Write a buffer completely.
+//
+static int write_all(int fd, const void *data, size_t nbytes)
+{
+    const char *p = data;
+
+    while (nbytes > 0) {
+        ssize_t n = write(fd, p, nbytes);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        nbytes -= n;
+    }
+    return 0;
+}
+
+//
+// Write frames tail...tail+n-1 of the ring to the file.
+//
+static int write_frames(gpio_capture_t *cap, unsigned tail, unsigned n)
+{
+    while (n > 0) {
+        // Up to the end of the ring.
+        unsigned index = tail & (cap->size - 1);
+        unsigned chunk = (n < cap->size - index) ? n : cap->size - index;
+
+        if (write_all(cap->fd, cap->ring + index * cap->hdr.nports,
+                      chunk * cap->hdr.nports * sizeof(uint16_t)) < 0)
+            return -1;
+        cap->written += chunk;
+        tail += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+//
+// Writer thread: move samples from the ring to the file,
+// in contiguous chunks.  In a triggered capture, the sampler puts
+// every frame into the ring and queues the frame numbers of triggers;
+// the writer takes the segments around them and drops other frames,
+// keeping pretrigger frames of history for the next trigger.
+//
+static void *capture_writer(void *arg)
+{
+    gpio_capture_t *cap = arg;
+
+    for (;;) {
+        int done = __atomic_load_n(&cap->done, __ATOMIC_ACQUIRE);
+        unsigned head = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+        unsigned tail = cap->tail;
+        unsigned end = head;
+        int complete = 0;
+
+        if (cap->hdr.flags & GPIO_CAPTURE_TRIGGERED) {
+            const unsigned pre = cap->hdr.pretrigger;
+
+            if (cap->ttail == __atomic_load_n(&cap->thead, __ATOMIC_ACQUIRE)) {
+                // No trigger: drop all but the history.
+                if (done)
+                    break;
+                if ((int) (head - pre - tail) > 0)
+                    __atomic_store_n(&cap->tail, head - pre, __ATOMIC_RELEASE);
+                usleep(1000);
+                continue;
+            }
+
+            // Segment of the oldest trigger.
+            unsigned t = cap->trig[cap->ttail % GPIO_CAPTURE_NTRIG];
+            unsigned last = t + cap->hdr.posttrigger + 1;
+
+            if ((int) (t - pre - tail) > 0)
+                tail = t - pre;
+            if ((int) (last - head) <= 0) {
+                end = last;
+                complete = 1;
+            }
+        }
+
+        unsigned n = end - tail;
+        if (n < WRITE_FRAMES && !complete && !done) {
+            __atomic_store_n(&cap->tail, tail, __ATOMIC_RELEASE);
+            usleep(1000);
+            continue;
+        }
+        if (write_frames(cap, tail, n) < 0) {
+            cap->error = errno;
+            break;
+        }
+        __atomic_store_n(&cap->tail, tail + n, __ATOMIC_RELEASE);
+        if (complete)
+            __atomic_store_n(&cap->ttail, cap->ttail + 1, __ATOMIC_RELEASE);
+        else if (done)
+            break;
+    }
+    return 0;
+}
+
+//
+// Prepare capture of ports, given by letters like "BD", to a file.
+// Period 0 means sampling as fast as possible.
+//
+int gpio_capture_open(gpio_capture_t *cap, int fd, const char *ports, unsigned period_ns)
+{
+    int i;
+
+    memset(cap, 0, sizeof(*cap));
+    cap->fd = fd;
+    memcpy(cap->hdr.magic, GPIO_CAPTURE_MAGIC, sizeof(cap->hdr.magic));
+    cap->hdr.version = GPIO_CAPTURE_VERSION;
+    cap->hdr.period_ns = period_ns;
+
+    for (i = 0; ports[i]; i++) {
+        if (i >= GPIO_NPORTS || !strchr("ABCDEFGHJK", ports[i])) {
+            errno = EINVAL;
+            return -1;
+        }
+        cap->reg[i] = gpio_port_reg(ports[i]);
+        if (!cap->reg[i])
+            return -1;
+        cap->hdr.port[i] = ports[i];
+    }
+    if (i == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    cap->hdr.nports = i;
+
+    cap->size = RING_FRAMES;
+    cap->ring = malloc(cap->size * i * sizeof(uint16_t));
+    if (!cap->ring)
+        return -1;
+
+    // Header is written again at close, with the final counts.
+    if (write_all(fd, &cap->hdr, sizeof(cap->hdr)) < 0) {
+        free(cap->ring);
+        return -1;
+    }
+    int err = pthread_create(&cap->writer, 0, capture_writer, cap);
+    if (err) {
+        free(cap->ring);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Write only segments around triggers.  Convert the condition
+// to frame order; every port in it must be captured.
+//
+int gpio_capture_trigger(gpio_capture_t *cap, const gpio_trigger_t *trig,
+                         unsigned pre, unsigned post)
+{
+    const unsigned nports = cap->hdr.nports;
+    unsigned i, k;
+
+    memset(cap->tmask, 0, sizeof(cap->tmask));
+    memset(cap->tvalue, 0, sizeof(cap->tvalue));
+    memset(cap->trise, 0, sizeof(cap->trise));
+    memset(cap->tfall, 0, sizeof(cap->tfall));
+    cap->tedges = 0;
+
+    for (i = 0; i < GPIO_NPORTS; i++) {
+        if (!(trig->mask[i] | trig->rise[i] | trig->fall[i]))
+            continue;
+        for (k = 0; k < nports; k++)
+            if (cap->hdr.port[k] == "ABCDEFGHJK"[i])
+                break;
+        if (k == nports) {
+            errno = EINVAL;
+            return -1;
+        }
+        cap->tmask[k] = trig->mask[i];
+        cap->tvalue[k] = trig->value[i] & trig->mask[i];
+        cap->trise[k] = trig->rise[i];
+        cap->tfall[k] = trig->fall[i];
+        if (trig->rise[i] | trig->fall[i])
+            cap->tedges = 1;
+    }
+
+    // History stays in the ring until the writer drops it.
+    if (pre >= cap->size / 2) {
+        errno = EINVAL;
+        return -1;
+    }
+    cap->hdr.flags |= GPIO_CAPTURE_TRIGGERED;
+    cap->hdr.pretrigger = pre;
+    cap->hdr.posttrigger = post;
+
+    // Header is already written, update it.
+    if (pwrite(cap->fd, &cap->hdr, sizeof(cap->hdr), 0) != sizeof(cap->hdr) &&
+        errno != ESPIPE)
+        return -1;
+    return 0;
+}
+
+//
+// The ring or the trigger queue is full: sleep, so that the writer
+// gets the CPU even when it shares one with the sampler.
+//
+static void capture_overrun()
+{
+    struct timespec t = { 0, 50000 };
+
+    nanosleep(&t, 0);
+}
+
+//
+// Wait for room in the ring for one frame.
+// Return the frame, or 0 when the writer has failed.
+//
+static uint16_t *capture_frame(gpio_capture_t *cap)
+{
+    while (cap->head - __atomic_load_n(&cap->tail, __ATOMIC_ACQUIRE) >= cap->size) {
+        if (cap->error)
+            return 0;
+        capture_overrun();
+    }
+    return cap->ring + (cap->head & (cap->size - 1)) * cap->hdr.nports;
+}
+
+//
+// Queue the frame at the head of the ring as a trigger.
+// Return -1 when the writer has failed.
+//
+static int capture_queue_trigger(gpio_capture_t *cap)
+{
+    while (cap->thead - __atomic_load_n(&cap->ttail, __ATOMIC_ACQUIRE) >= GPIO_CAPTURE_NTRIG) {
+        if (cap->error)
+            return -1;
+        capture_overrun();
+    }
+    cap->trig[cap->thead % GPIO_CAPTURE_NTRIG] = cap->head;
+    __atomic_store_n(&cap->thead, cap->thead + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//
+// Check the trigger condition on a sample: a few bitwise
+// operations per port.  A condition of levels only fires when
+// it becomes true, and again only after it was false, like rules.
+// Call it for every sample, to follow the level condition.
+//
+static int capture_triggered(gpio_capture_t *cap, const uint16_t *cur,
+                             const uint16_t *prev)
+{
+    unsigned level = 0, edge = 0;
+    int i;
+
+    for (i = 0; i < (int) cap->hdr.nports; i++) {
+        level |= (cur[i] & cap->tmask[i]) ^ cap->tvalue[i];
+        edge  |= (cur[i] & ~prev[i] & cap->trise[i]) |
+                 (~cur[i] & prev[i] & cap->tfall[i]);
+    }
+    if (cap->tedges)
+        return level == 0 && edge;
+
+    int fire = (level == 0 && !cap->tmatched);
+    cap->tmatched = (level == 0);
+    return fire;
+}
+
+//
+// Triggered capture: every sample goes to the ring, as in a free-running
+// capture, and triggers are queued for the writer, which picks
+// the segments.  Nothing is copied here.
+//
+static void capture_segments(gpio_capture_t *cap, uint64_t nsamples)
+{
+    const int nports = cap->hdr.nports;
+    const unsigned period = cap->hdr.period_ns;
+    const unsigned pre = cap->hdr.pretrigger;
+    const uint16_t *prev = 0;
+    unsigned hcount = 0, post = 0;
+    uint64_t next, now;
+    int i;
+
+    next = cap->hdr.start_ns;
+    while (!cap->stop && (nsamples == 0 || cap->taken < nsamples)) {
+        uint16_t *frame = capture_frame(cap);
+        if (!frame)
+            break;
+
+        if (period) {
+            do {
+                now = gpio_time_ns();
+            } while (now < next);
+            if (now >= next + period)
+                cap->late++;
+            next += period;
+        }
+        for (i = 0; i < nports; i++)
+            frame[i] = cap->reg[i]->port;
+        if (!prev) {
+            // A condition true from the start is not a trigger.
+            prev = frame;
+            capture_triggered(cap, frame, prev);
+        }
+        int fire = capture_triggered(cap, frame, prev);
+
+        if (post > 0) {
+            // After a trigger.
+            if (--post == 0)
+                hcount = 0;
+        } else if (hcount >= pre && fire) {
+            if (capture_queue_trigger(cap) < 0)
+                break;
+            cap->hdr.ntriggers++;
+            post = cap->hdr.posttrigger;
+            hcount = 0;
+        } else if (hcount < pre) {
+            hcount++;
+        }
+        prev = frame;
+
+        // The slot of prev is not reused before the ring wraps.
+        __atomic_store_n(&cap->head, cap->head + 1, __ATOMIC_RELEASE);
+        cap->taken++;
+    }
+}
+
+//
+// Free-running capture: every sample goes to the ring.
+//
+static void capture_all(gpio_capture_t *cap, uint64_t nsamples)
+{
+    const int nports = cap->hdr.nports;
+    const unsigned period = cap->hdr.period_ns;
+    uint64_t next, now;
+    int i;
+
+    next = cap->hdr.start_ns;
+    while (!cap->stop && (nsamples == 0 || cap->taken < nsamples)) {
+        uint16_t *frame = capture_frame(cap);
+        if (!frame)
+            break;
+
+        if (period) {
+            // Spin until the sample is due.
+            do {
+                now = gpio_time_ns();
+            } while (now < next);
+            if (now >= next + period)
+                cap->late++;
+            next += period;
+        }
+        for (i = 0; i < nports; i++)
+            frame[i] = cap->reg[i]->port;
+
+        __atomic_store_n(&cap->head, cap->head + 1, __ATOMIC_RELEASE);
+        cap->hdr.nsamples++;
+        cap->taken++;
+    }
+}
+
+//
+// Take samples in the calling thread, until nsamples are taken
+// (0 for no limit) or cap->stop is set.  When the caller runs
+// at a real-time priority, the writer gets the one just below,
+// so a busy system cannot starve it while the sampler waits.
+//
+int gpio_capture_run(gpio_capture_t *cap, uint64_t nsamples)
+{
+    struct sched_param param;
+    int policy;
+
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0 &&
+        (policy == SCHED_FIFO || policy == SCHED_RR)) {
+        if (param.sched_priority > sched_get_priority_min(policy))
+            param.sched_priority--;
+        pthread_setschedparam(cap->writer, policy, &param);
+    }
+
+    cap->hdr.start_ns = gpio_time_ns();
+    if (cap->hdr.flags & GPIO_CAPTURE_TRIGGERED)
+        capture_segments(cap, nsamples);
+    else
+        capture_all(cap, nsamples);
+    cap->end_ns = gpio_time_ns();
+    if (cap->error) {
+        errno = cap->error;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Flush the ring and update the header.  Free-running captures
+// get the average sampling period.  Return -1 on write error.
+//
+int gpio_capture_close(gpio_capture_t *cap)
+{
+    __atomic_store_n(&cap->done, 1, __ATOMIC_RELEASE);
+    pthread_join(cap->writer, 0);
+    free(cap->ring);
+    cap->ring = 0;
+
+    // Segments were picked by the writer.
+    if (cap->hdr.flags & GPIO_CAPTURE_TRIGGERED)
+        cap->hdr.nsamples = cap->written;
+
+    if (cap->hdr.period_ns == 0 && cap->taken > 1)
+        cap->hdr.period_ns = (cap->end_ns - cap->hdr.start_ns) / cap->taken;
+
+    if (cap->error) {
+        errno = cap->error;
+        return -1;
+    }
+    if (pwrite(cap->fd, &cap->hdr, sizeof(cap->hdr), 0) != sizeof(cap->hdr) &&
+        errno != ESPIPE)
+        return -1;
+    return 0;
+}
+
+//
+// Open a capture file for reading.  Only the header is read here:
+// samples are mapped in windows by gpio_capfile_map(), so files
+// larger than the address space can be processed.
+//
+int gpio_capfile_open(gpio_capfile_t *f, const char *path)
+{
+    gpio_capture_header_t *hdr;
+    struct stat st;
+
+    memset(f, 0, sizeof(*f));
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0)
+        return -1;
+    hdr = malloc(sizeof(*hdr));
+    if (!hdr)
+        goto fail;
+    f->hdr = hdr;
+    if (fstat(f->fd, &st) < 0)
+        goto fail;
+    if (st.st_size < (off_t) sizeof(*hdr) ||
+        pread(f->fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+        memcmp(hdr->magic, GPIO_CAPTURE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != GPIO_CAPTURE_VERSION ||
+        hdr->nports < 1 || hdr->nports > GPIO_NPORTS) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    // Trust the file size more than the header, which
+    // is not updated when the capture was interrupted.
+    f->nsamples = (st.st_size - sizeof(*hdr)) / (hdr->nports * sizeof(uint16_t));
+    if (hdr->flags & GPIO_CAPTURE_TRIGGERED)
+        f->segment = (uint64_t) hdr->pretrigger + 1 + hdr->posttrigger;
+    return 0;
+
+fail:
+    gpio_capfile_close(f);
+    return -1;
+}
+
+//
+// Map frames first...first+count-1 of a capture file.
+// The mapping starts at a page boundary, so it may begin
+// a little before the first frame.
+//
+int gpio_capfile_map(const gpio_capfile_t *f, gpio_capwin_t *w,
+                     uint64_t first, uint64_t count)
+{
+    const uint64_t frame_bytes = f->hdr->nports * sizeof(uint16_t);
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+
+    memset(w, 0, sizeof(*w));
+    if (first >= f->nsamples || count == 0 || count > f->nsamples - first) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t offset = sizeof(gpio_capture_header_t) + first * frame_bytes;
+    uint64_t start = offset & ~(page - 1);
+    uint64_t size = offset - start + count * frame_bytes;
+
+    if (size != (size_t) size) {
+        errno = EFBIG;
+        return -1;
+    }
+    void *base = mmap(0, size, PROT_READ, MAP_SHARED, f->fd, start);
+    if (base == MAP_FAILED)
+        return -1;
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    w->base = base;
+    w->size = size;
+    w->first = first;
+    w->count = count;
+    w->frames = (const uint16_t*) ((char*) base + (offset - start));
+    return 0;
+}
+
+//
+// Unmap a window of a capture file.
+//
+void gpio_capfile_unmap(gpio_capwin_t *w)
+{
+    if (w->base)
+        munmap(w->base, w->size);
+    w->base = 0;
+    w->frames = 0;
+}
+
+//
+// Close a capture file.
+//
+void gpio_capfile_close(gpio_capfile_t *f)
+{
+    if (f->fd >= 0)
+        close(f->fd);
+    free((void*) f->hdr);
+    f->fd = -1;
+    f->hdr = 0;
+}
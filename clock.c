@@ -0,0 +1,266 @@
+/*
+ * Clock frequencies of PIC32.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include "gpio.h"
+
+//
+// Peripheral bus clock divisor registers.
+//
+#define PB1DIV_ADDR     0x1f801300
+#define PBDIV_STRIDE    0x10
+
+//
+// Reference oscillator registers: REFO1CON...REFO4CON with step 0x20,
+// REFOxTRIM follows at +0x10.  All have CLR/SET/INV companions.
+//
+#define REFO1CON_ADDR   0x1f801280
+#define REFO_STRIDE     0x20
+#define REFOCON         0
+#define REFOCONCLR      1
+#define REFOCONSET      2
+#define REFOTRIM        4
+
+#define REFO_ON         (1 << 15)   // Enable
+#define REFO_OE         (1 << 12)   // Output enable
+#define REFO_DIVSWEN    (1 << 9)    // Divider switch in progress
+#define REFO_ACTIVE     (1 << 8)    // Request active
+
+//
+// Nominal frequencies of internal oscillators.
+//
+#define FRC_HZ          8000000
+#define LPRC_HZ         32000
+
+//
+// Default system clock frequency of pic32mz-da.
+//
+#define SYSCLK_DEFAULT  200000000
+
+//
+// Get system clock frequency, in Hz.
+// The PLL setup is done by the boot loader and cannot be reliably
+// recovered, so the nominal value is used unless
+// environment variable GPIO_SYSCLK is set.
+//
+unsigned long gpio_sysclk()
+{
+    const char *env = getenv("GPIO_SYSCLK");
+
+    if (env) {
+        unsigned long hz = strtoul(env, 0, 0);
+        if (hz > 0)
+            return hz;
+    }
+    return SYSCLK_DEFAULT;
+}
+
+//
+// Get frequency of peripheral bus clock 1...8, in Hz.
+// See pic32mz-da data sheet, section 8 "Oscillator configuration".
+//
+unsigned long gpio_pbclk(int bus)
+{
+    static volatile unsigned *pbdiv;
+
+    if (bus < 1 || bus > 8)
+        return 0;
+
+    if (!pbdiv) {
+        pbdiv = gpio_map_sfr(PB1DIV_ADDR, 8 * PBDIV_STRIDE);
+        if (!pbdiv)
+            return 0;
+    }
+
+    unsigned div = pbdiv[(bus - 1) * PBDIV_STRIDE / 4] & 0x7f;
+    return gpio_sysclk() / (div + 1);
+}
+
+//
+// Get registers of reference oscillator 1...4, or 0 on error.
+//
+static volatile unsigned *refclk_reg(int refo)
+{
+    static volatile unsigned *refcon;
+
+    if (refo < 1 || refo > 4) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (!refcon) {
+        refcon = gpio_map_sfr(REFO1CON_ADDR, 4 * REFO_STRIDE);
+        if (!refcon)
+            return 0;
+    }
+    return refcon + (refo - 1) * REFO_STRIDE / 4;
+}
+
+//
+// Get frequency of a reference oscillator source, in Hz.
+// Primary oscillator depends on the board, so it is known
+// only from environment variable GPIO_POSC.  Return 0 when unknown.
+//
+static double refclk_source_hz(int source)
+{
+    const char *env;
+
+    switch (source) {
+    case GPIO_REFCLK_SYSCLK:
+        return gpio_sysclk();
+    case GPIO_REFCLK_PBCLK1:
+        return gpio_pbclk(1);
+    case GPIO_REFCLK_POSC:
+        env = getenv("GPIO_POSC");
+        return env ? strtod(env, 0) : 0;
+    case GPIO_REFCLK_FRC:
+        return FRC_HZ;
+    case GPIO_REFCLK_LPRC:
+        return LPRC_HZ;
+    }
+    return 0;
+}
+
+//
+// Compute divider and trim for a given input and output frequency.
+// Output is Fin / (2 * (RODIV + ROTRIM/512)), or Fin when RODIV is 0.
+// Return the frequency which the hardware will actually produce.
+//
+static double refclk_divider(double fin, double hz, unsigned *div, unsigned *trim)
+{
+    if (hz >= fin) {
+        *div = 0;
+        *trim = 0;
+        return fin;
+    }
+
+    double d = fin / (2 * hz);
+    unsigned n = (unsigned) d;
+    unsigned m = lround((d - n) * 512);
+
+    if (m == 512) {
+        n++;
+        m = 0;
+    }
+    if (n == 0) {
+        // RODIV 0 bypasses the divider and trim: between
+        // Fin/2 and Fin, only these two are possible.
+        *trim = 0;
+        if (fin - hz < hz - fin / 2) {
+            *div = 0;
+            return fin;
+        }
+        *div = 1;
+        return fin / 2;
+    }
+    if (n > 32767) {
+        n = 32767;
+        m = 511;
+    }
+    *div = n;
+    *trim = m;
+    return fin / (2 * (n + m / 512.0));
+}
+
+//
+// Enable reference clock output 1...4 at a frequency closest to the given.
+// With negative source, try all sources with known frequency
+// and take the one with the smallest error, preferring integer
+// division (no jitter from trim) and faster input clock.
+// Return the achieved frequency, or -1 on error.
+//
+double gpio_refclk_enable(int refo, int source, double hz)
+{
+    volatile unsigned *reg = refclk_reg(refo);
+    int best_source = -1;
+    double best_hz = 0, best_err = 0;
+    unsigned div = 0, trim = 0;
+    int s;
+
+    if (!reg)
+        return -1;
+    if (hz <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (s = GPIO_REFCLK_SYSCLK; s <= GPIO_REFCLK_LPRC; s++) {
+        double fin = refclk_source_hz(s);
+        unsigned d, t;
+
+        if ((source >= 0 && s != source) || fin <= 0)
+            continue;
+
+        double f = refclk_divider(fin, hz, &d, &t);
+        double err = fabs(f - hz);
+
+        // Integer division wins ties within 1 ppm.
+        if (best_source < 0 || err < best_err - hz * 1e-6 ||
+            (err <= best_err + hz * 1e-6 && t == 0 && trim != 0)) {
+            best_source = s;
+            best_hz = f;
+            best_err = err;
+            div = d;
+            trim = t;
+        }
+    }
+    if (best_source < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Stop the output, then switch source and divider.
+    int usec;
+
+    reg[REFOCONCLR] = REFO_ON | REFO_OE;
+    for (usec = 0; usec < 1000 && (reg[REFOCON] & REFO_ACTIVE); usec++)
+        gpio_udelay(1);
+
+    reg[REFOTRIM] = trim << 23;
+    reg[REFOCON] = (div << 16) | best_source;
+    reg[REFOCONSET] = REFO_DIVSWEN;
+    for (usec = 0; usec < 1000 && (reg[REFOCON] & REFO_DIVSWEN); usec++)
+        gpio_udelay(1);
+
+    reg[REFOCONSET] = REFO_ON | REFO_OE;
+    return best_hz;
+}
+
+//
+// Disable reference clock output 1...4.
+//
+int gpio_refclk_disable(int refo)
+{
+    volatile unsigned *reg = refclk_reg(refo);
+
+    if (!reg)
+        return -1;
+
+    reg[REFOCONCLR] = REFO_ON | REFO_OE;
+    return 0;
+}
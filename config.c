@@ -0,0 +1,176 @@
+/*
+ * Save and apply pin configuration of PIC32.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include "gpio.h"
+
+//
+// Read the live configuration of all ports and PPS registers.
+//
+int gpio_config_read(gpio_config_t *cfg)
+{
+    volatile unsigned *pps = gpio_map_sfr(0x1f800000 + GPIO_PPS_FIRST,
+                                          GPIO_PPS_LAST + 4 - GPIO_PPS_FIRST);
+    int i;
+
+    if (!pps)
+        return -1;
+
+    for (i = 0; i < GPIO_NPORTS; i++) {
+        struct gpioreg *reg = gpio_port_reg("ABCDEFGHJK"[i]);
+        gpio_port_config_t *p = &cfg->port[i];
+
+        p->ansel = reg->ansel;
+        p->tris  = reg->tris;
+        p->lat   = reg->lat;
+        p->odc   = reg->odc;
+        p->cnpu  = reg->cnpu;
+        p->cnpd  = reg->cnpd;
+    }
+    for (i = 0; i < GPIO_PPS_NREGS; i++)
+        cfg->pps[i] = gpio_pps_name(GPIO_PPS_FIRST + 4*i) ? (pps[i] & 0xf) : 0;
+    return 0;
+}
+
+//
+// Change bits of a port register by SET and CLR writes,
+// only when they differ.  Return the number of writes.
+//
+static int update_reg(volatile unsigned *reg, unsigned old, unsigned new,
+                      int port, const char *name)
+{
+    unsigned set = new & ~old;
+    unsigned clr = old & ~new;
+
+    if (gpio_debug > 0 && (set | clr))
+        printf("--- %s%c: %04x -> %04x\n", name, port, old, new);
+    if (clr)
+        reg[1] = clr;
+    if (set)
+        reg[2] = set;
+    return (set != 0) + (clr != 0);
+}
+
+//
+// Write only the registers which differ from the live configuration.
+// Output latches go first, so that pins turned into outputs
+// come up at the right level; directions go last.
+//
+int gpio_config_apply(const gpio_config_t *cfg)
+{
+    volatile unsigned *pps = gpio_map_sfr(0x1f800000 + GPIO_PPS_FIRST,
+                                          GPIO_PPS_LAST + 4 - GPIO_PPS_FIRST);
+    gpio_config_t live;
+    int nwrites = 0, i;
+
+    if (!pps || gpio_config_read(&live) < 0)
+        return -1;
+
+    for (i = 0; i < GPIO_NPORTS; i++) {
+        int port = "ABCDEFGHJK"[i];
+        struct gpioreg *reg = gpio_port_reg(port);
+        const gpio_port_config_t *old = &live.port[i], *new = &cfg->port[i];
+
+        nwrites += update_reg(&reg->lat,   old->lat,   new->lat,   port, "LAT");
+        nwrites += update_reg(&reg->odc,   old->odc,   new->odc,   port, "ODC");
+        nwrites += update_reg(&reg->cnpu,  old->cnpu,  new->cnpu,  port, "CNPU");
+        nwrites += update_reg(&reg->cnpd,  old->cnpd,  new->cnpd,  port, "CNPD");
+        nwrites += update_reg(&reg->ansel, old->ansel, new->ansel, port, "ANSEL");
+    }
+    for (i = 0; i < GPIO_PPS_NREGS; i++) {
+        const char *name = gpio_pps_name(GPIO_PPS_FIRST + 4*i);
+
+        if (name && cfg->pps[i] != live.pps[i]) {
+            if (gpio_debug > 0)
+                printf("--- %s: %d -> %d\n", name, live.pps[i], cfg->pps[i]);
+            pps[i] = cfg->pps[i];
+            nwrites++;
+        }
+    }
+    for (i = 0; i < GPIO_NPORTS; i++) {
+        int port = "ABCDEFGHJK"[i];
+
+        nwrites += update_reg(&gpio_port_reg(port)->tris, live.port[i].tris,
+                              cfg->port[i].tris, port, "TRIS");
+    }
+    return nwrites;
+}
+
+//
+// Set pin direction or alternative function in a configuration.
+//
+int gpio_config_set_mode(gpio_config_t *cfg, int pin, gpio_mode_t mode)
+{
+    if (pin & GPIO_VIRTUAL) {
+        errno = EINVAL;
+        return -1;
+    }
+    gpio_port_config_t *p = &cfg->port[pin >> 24];
+    unsigned mask = GPIO_MASK(pin);
+
+    if (gpio_pps_set_mode(cfg->pps, pin, mode) < 0)
+        return -1;
+
+    switch (mode) {
+    case MODE_ANALOG:
+        p->tris |= mask;
+        p->ansel |= mask;
+        break;
+    case MODE_OUTPUT:
+        p->ansel &= ~mask;
+        p->tris &= ~mask;
+        break;
+    default:
+        // Digital input or alternative function.
+        p->ansel &= ~mask;
+        p->tris |= mask;
+        break;
+    }
+    return 0;
+}
+
+//
+// Set pull up/down resistors in a configuration.
+//
+int gpio_config_set_pull(gpio_config_t *cfg, int pin, gpio_pull_t pull)
+{
+    if (pin & GPIO_VIRTUAL) {
+        errno = EINVAL;
+        return -1;
+    }
+    gpio_port_config_t *p = &cfg->port[pin >> 24];
+    unsigned mask = GPIO_MASK(pin);
+
+    p->cnpu &= ~mask;
+    p->cnpd &= ~mask;
+    if (pull == PULL_UP)
+        p->cnpu |= mask;
+    else if (pull == PULL_DOWN)
+        p->cnpd |= mask;
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Debounce filter for PIC32 GPIO inputs.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// Start filtering a given set of pins of a port.
+// The current input values become the stable state.
+// Port 0 gives a filter for arbitrary bits, not tied to a port:
+// samples are passed to gpio_debounce_update() and the stable
+// state starts at zero.
+//
+int gpio_debounce_init(gpio_debounce_t *db, int port, unsigned mask, int nsamples)
+{
+    if (nsamples < 1 || nsamples > GPIO_DEBOUNCE_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(db, 0, sizeof(*db));
+    db->port = port;
+    db->mask = mask & 0xffff;
+
+    int i;
+    for (i = 0; i < GPIO_DEBOUNCE_BITS; i++) {
+        if (nsamples & (1 << i))
+            db->limit[i] = db->mask;
+    }
+    if (port)
+        db->state = gpio_read_port(port) & db->mask;
+    return 0;
+}
+
+//
+// Set the number of consecutive samples, required to change
+// the stable state of a pin.
+//
+int gpio_debounce_set_samples(gpio_debounce_t *db, int pin, int nsamples)
+{
+    unsigned mask = GPIO_MASK(pin);
+
+    if (GPIO_PORT(pin) != db->port || nsamples < 1 || nsamples > GPIO_DEBOUNCE_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < GPIO_DEBOUNCE_BITS; i++) {
+        if (nsamples & (1 << i))
+            db->limit[i] |= mask;
+        else
+            db->limit[i] &= ~mask;
+    }
+    return 0;
+}
+
+//
+// Process a sample of the port.
+// Counters of pins, which differ from the stable state, are incremented;
+// all other counters are reset.  A pin, whose counter reaches the limit,
+// changes the stable state.
+// Return a mask of pins which changed their stable state.
+//
+unsigned gpio_debounce_update(gpio_debounce_t *db, unsigned sample)
+{
+    unsigned delta = (sample ^ db->state) & db->mask;
+    unsigned carry = delta;
+    unsigned match = delta;
+    int i;
+
+    for (i = 0; i < GPIO_DEBOUNCE_BITS; i++) {
+        unsigned c = db->count[i];
+
+        c = (c ^ carry) & delta;
+        carry &= db->count[i];
+        db->count[i] = c;
+        match &= ~(c ^ db->limit[i]);
+    }
+
+    if (match) {
+        db->state ^= match;
+        for (i = 0; i < GPIO_DEBOUNCE_BITS; i++)
+            db->count[i] &= ~match;
+    }
+    return match;
+}
+
+//
+// Read the port and process the sample.
+//
+unsigned gpio_debounce_poll(gpio_debounce_t *db)
+{
+    return gpio_debounce_update(db, gpio_read_port(db->port));
+}
+
+//
+// Sample a set of debounce filters with a given period,
+// and call func() for every change of a stable state.
+// Return when func() returns nonzero.
+//
+int gpio_debounce_run(gpio_debounce_t *db, int ndb, unsigned period_usec,
+                      gpio_event_func_t *func, void *arg)
+{
+    struct timespec deadline = { 0 };
+
+    for (;;) {
+        int i;
+        for (i = 0; i < ndb; i++) {
+            unsigned changed = gpio_debounce_poll(&db[i]);
+
+            while (changed) {
+                unsigned mask = changed & -changed;
+                int pin = (GPIO_OFFSET(db[i].port) << 16) | mask;
+
+                changed &= ~mask;
+                if (func(pin, (db[i].state & mask) != 0, arg))
+                    return 0;
+            }
+        }
+        gpio_sleep_period(&deadline, period_usec * 1000LL);
+    }
+}
@@ -0,0 +1,457 @@
+/*
+ * Protocol decoders over captured PIC32 port samples.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "gpio.h"
+
+//
+// Block of samples, processed at once by vector instructions
+// where the target has them.
+//
+#define VLANES  16
+typedef uint16_t vec_t __attribute__((vector_size(VLANES * 2)));
+
+//
+// Size of the file window, mapped by every decoder thread.
+//
+#define WINDOW_BYTES    (4 << 20)
+
+//
+// Append a decoded frame.  When out of memory, the frame is lost
+// and the decoder stops with ENOMEM in d->error.
+//
+static void emit(gpio_decoder_t *d, uint64_t sample, int type, uint32_t value, int flags)
+{
+    if (d->nframes >= d->maxframes) {
+        size_t n = d->maxframes ? 2 * d->maxframes : 1024;
+        gpio_frame_t *p = realloc(d->frame, n * sizeof(gpio_frame_t));
+
+        if (!p) {
+            d->error = ENOMEM;
+            return;
+        }
+        d->frame = p;
+        d->maxframes = n;
+    }
+    gpio_frame_t *f = &d->frame[d->nframes++];
+    f->sample = sample;
+    f->value = value;
+    f->type = type;
+    f->flags = flags;
+    f->decoder = 0;
+    f->reserved = 0;
+}
+
+//
+// UART: sample the bits, which are centered before a given sample,
+// at the current level.  There is an edge at every start bit,
+// but a byte may have no more edges, so this is also called at the end.
+//
+static void uart_advance(gpio_decoder_t *d, uint64_t until)
+{
+    while (d->busy) {
+        double center = d->start + (d->nbits + 1.5) * d->bit_samples;
+
+        if (center >= until)
+            break;
+        if (d->nbits < 8) {
+            if (d->level[0])
+                d->value |= 1 << d->nbits;
+            d->nbits++;
+        } else {
+            // Stop bit.
+            emit(d, d->start, GPIO_FRAME_DATA, d->value, d->level[0] ? 0 : GPIO_FLAG_ERROR);
+            d->busy = 0;
+        }
+    }
+}
+
+static void uart_edge(gpio_decoder_t *d, uint64_t n, const int *level)
+{
+    uart_advance(d, n);
+    d->level[0] = level[0];
+    if (!d->busy && level[0] == 0) {
+        d->busy = 1;
+        d->start = n;
+        d->nbits = 0;
+        d->value = 0;
+    }
+}
+
+//
+// SPI: data is sampled on the leading clock edge in modes 0 and 2,
+// on the trailing edge in modes 1 and 3.  Inactive CS resets the byte.
+//
+static void spi_edge(gpio_decoder_t *d, uint64_t n, const int *level)
+{
+    int cpol = d->mode >> 1, cpha = d->mode & 1;
+    int sample_level = !cpol ^ cpha;
+
+    if (d->pin[3] >= 0 && level[3]) {
+        d->nbits = 0;
+        d->value = 0;
+        return;
+    }
+    if (level[0] == d->level[0] || level[0] != sample_level)
+        return;
+
+    if (d->nbits == 0)
+        d->start = n;
+    d->value = (d->value << 1 & 0xfefe) | level[1];
+    if (d->pin[2] >= 0)
+        d->value |= level[2] << 8;
+    if (++d->nbits == 8) {
+        emit(d, d->start, GPIO_FRAME_DATA, d->value, d->pin[2] >= 0 ? GPIO_FLAG_MISO : 0);
+        d->nbits = 0;
+        d->value = 0;
+    }
+}
+
+//
+// I2C: SDA changing while SCL is high is start or stop;
+// otherwise SDA is sampled on rising SCL, 8 data bits and acknowledge.
+//
+static void i2c_edge(gpio_decoder_t *d, uint64_t n, const int *level)
+{
+    int sda = level[0], scl = level[1];
+
+    if (scl && d->level[1] && sda != d->level[0]) {
+        if (sda) {
+            emit(d, n, GPIO_FRAME_STOP, 0, 0);
+            d->busy = 0;
+        } else {
+            emit(d, n, GPIO_FRAME_START, 0, 0);
+            d->busy = 1;
+            d->first = 1;
+        }
+        d->nbits = 0;
+        d->value = 0;
+        return;
+    }
+    if (!d->busy || !scl || d->level[1])
+        return;
+
+    if (d->nbits == 0)
+        d->start = n;
+    if (d->nbits < 8) {
+        d->value = d->value << 1 | sda;
+        d->nbits++;
+        return;
+    }
+    emit(d, d->start, GPIO_FRAME_DATA, d->value,
+        (sda ? GPIO_FLAG_NAK : 0) | (d->first ? GPIO_FLAG_ADDRESS : 0));
+    d->first = 0;
+    d->nbits = 0;
+    d->value = 0;
+}
+
+//
+// 1-Wire: decode by width of low pulses.  Reset is 480 usec or more,
+// followed by a presence pulse; a bit is 1 when shorter than 15 usec.
+// Bytes go LSB first.
+//
+static void onewire_edge(gpio_decoder_t *d, uint64_t n, const int *level)
+{
+    if (!level[0]) {
+        d->start = n;
+        return;
+    }
+    if (d->start == (uint64_t) -1)
+        return;
+
+    double usec = (n - d->start) * (double) d->file->hdr->period_ns / 1000;
+
+    if (usec >= 480) {
+        emit(d, d->start, GPIO_FRAME_RESET, 0, 0);
+        d->reset = 1;
+        d->nbits = 0;
+        d->value = 0;
+    } else if (d->reset) {
+        emit(d, d->start, GPIO_FRAME_PRESENCE, 0, 0);
+        d->reset = 0;
+    } else {
+        if (d->nbits == 0)
+            d->byte_start = d->start;
+        if (usec < 15)
+            d->value |= 1 << d->nbits;
+        if (++d->nbits == 8) {
+            emit(d, d->byte_start, GPIO_FRAME_DATA, d->value, 0);
+            d->nbits = 0;
+            d->value = 0;
+        }
+    }
+}
+
+//
+// Get levels of the decoder pins in a frame.
+//
+static void get_levels(const gpio_decoder_t *d, const uint16_t *frame, int *level)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        level[i] = d->mask[i] ? (frame[d->index[i]] & d->mask[i]) != 0 : 0;
+}
+
+//
+// Call the decoder when any of its pins changed in frame n.
+//
+static void check_frame(gpio_decoder_t *d, uint64_t n, const uint16_t *frame,
+                        const uint16_t *prev)
+{
+    int i, level[4];
+
+    for (i = 0; i < 4; i++) {
+        if (d->mask[i] && ((frame[d->index[i]] ^ prev[d->index[i]]) & d->mask[i]))
+            break;
+    }
+    if (i == 4)
+        return;
+
+    d->nedges++;
+    get_levels(d, frame, level);
+    switch (d->proto) {
+    case GPIO_PROTO_UART:    uart_edge(d, n, level);    break;
+    case GPIO_PROTO_SPI:     spi_edge(d, n, level);     break;
+    case GPIO_PROTO_I2C:     i2c_edge(d, n, level);     break;
+    case GPIO_PROTO_ONEWIRE: onewire_edge(d, n, level); break;
+    }
+    if (d->proto != GPIO_PROTO_UART)
+        memcpy(d->level, level, sizeof(level));
+}
+
+//
+// Scan frames from...end-1 of a window for one decoder.  Blocks of
+// VLANES values are compared with the values one frame earlier: XOR,
+// mask and population count find the blocks without any change of the
+// decoder pins, which are skipped.  The mask has the pin bits of all
+// ports, so a block may be checked in vain, but no change is missed.
+// The window must also have the frame before the first one.
+//
+static void scan_window(gpio_decoder_t *d, const vec_t *vmask,
+                        const gpio_capwin_t *w, uint64_t from, uint64_t end)
+{
+    const unsigned nports = d->file->hdr->nports;
+    const uint16_t *s = w->frames;
+    const uint64_t total = (end - w->first) * nports;
+    uint64_t e, n, done = from - 1 - w->first;
+    int i;
+
+    for (e = (from - w->first) * nports; e + VLANES <= total; e += VLANES) {
+        vec_t cur, prev, x;
+        uint64_t v[sizeof(vec_t) / 8];
+        int bits = 0;
+
+        memcpy(&cur, s + e, sizeof(cur));
+        memcpy(&prev, s + e - nports, sizeof(prev));
+        x = (cur ^ prev) & *vmask;
+        memcpy(v, &x, sizeof(v));
+        for (i = 0; i < (int) (sizeof(v) / 8); i++)
+            bits += __builtin_popcountll(v[i]);
+        if (bits == 0)
+            continue;
+
+        // Frames which have values in this block.
+        uint64_t last = (e + VLANES - 1) / nports;
+        for (n = e / nports; n <= last; n++) {
+            if (n > done)
+                check_frame(d, w->first + n, s + n * nports, s + (n - 1) * nports);
+        }
+        done = last;
+    }
+
+    // The rest of the frames, one by one.
+    for (n = e / nports; n < end - w->first; n++) {
+        if (n > done)
+            check_frame(d, w->first + n, s + n * nports, s + (n - 1) * nports);
+    }
+}
+
+//
+// Decode frames first...end-1, which are contiguous in time.
+// The file is mapped one window at a time; windows overlap
+// by one frame, to compare it with the next.
+// Return -1 when a window cannot be mapped, or frames cannot be stored.
+//
+static int decode_range(gpio_decoder_t *d, const vec_t *vmask, uint64_t first, uint64_t end)
+{
+    const uint64_t window = WINDOW_BYTES / (d->file->hdr->nports * sizeof(uint16_t));
+    gpio_capwin_t w;
+    uint64_t from;
+
+    // Start from idle state, at the levels of the first frame.
+    d->busy = d->nbits = d->first = d->reset = 0;
+    d->value = 0;
+    d->start = (uint64_t) -1;
+
+    for (from = first; from < end; from += window - 1) {
+        uint64_t count = (end - from < window) ? end - from : window;
+
+        if (gpio_capfile_map(d->file, &w, from, count) < 0)
+            return -1;
+        if (from == first)
+            get_levels(d, w.frames, d->level);
+        if (count > 1)
+            scan_window(d, vmask, &w, from + 1, from + count);
+        gpio_capfile_unmap(&w);
+        if (d->error) {
+            errno = d->error;
+            return -1;
+        }
+        if (from + count == end)
+            break;
+    }
+
+    if (d->proto == GPIO_PROTO_UART)
+        uart_advance(d, end);
+    return 0;
+}
+
+//
+// Decoder thread.  Segments of a triggered capture
+// are not contiguous in time, so each is decoded alone.
+// A failure is left in d->error.
+//
+static void *decode_thread(void *arg)
+{
+    gpio_decoder_t *d = arg;
+    const gpio_capfile_t *f = d->file;
+    uint64_t first, step;
+    uint16_t umask = 0;
+    vec_t vmask;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        umask |= d->mask[i];
+    for (i = 0; i < VLANES; i++)
+        vmask[i] = umask;
+
+    step = f->segment ? f->segment : f->nsamples;
+    for (first = 0; first < f->nsamples; first += step) {
+        uint64_t end = first + step;
+
+        if (decode_range(d, &vmask, first, end < f->nsamples ? end : f->nsamples) < 0) {
+            d->error = errno;
+            break;
+        }
+    }
+    return 0;
+}
+
+//
+// Find the pins of a decoder in the frame.
+//
+static int decoder_init(gpio_decoder_t *d, const gpio_capfile_t *f)
+{
+    static const int npins[] = {
+        [GPIO_PROTO_UART] = 1, [GPIO_PROTO_SPI] = 4,
+        [GPIO_PROTO_I2C] = 2,  [GPIO_PROTO_ONEWIRE] = 1,
+    };
+    unsigned i, k;
+
+    d->file = f;
+    d->frame = 0;
+    d->nframes = d->maxframes = 0;
+    d->nedges = 0;
+    d->error = 0;
+    memset(d->mask, 0, sizeof(d->mask));
+    memset(d->index, 0, sizeof(d->index));
+
+    for (i = 0; i < (unsigned) npins[d->proto]; i++) {
+        int pin = d->pin[i];
+
+        if (pin < 0 && d->proto == GPIO_PROTO_SPI && i >= 2)
+            continue;               // No MISO or CS
+        if (pin < 0 || (pin & GPIO_VIRTUAL))
+            goto bad;
+        for (k = 0; k < f->hdr->nports; k++)
+            if (f->hdr->port[k] == GPIO_PORT(pin))
+                break;
+        if (k == f->hdr->nports)
+            goto bad;
+        d->index[i] = k;
+        d->mask[i] = GPIO_MASK(pin);
+    }
+    if (d->proto == GPIO_PROTO_UART) {
+        if (d->baud == 0 || f->hdr->period_ns == 0)
+            goto bad;
+        d->bit_samples = 1e9 / d->baud / f->hdr->period_ns;
+    }
+    return 0;
+bad:
+    errno = EINVAL;
+    return -1;
+}
+
+//
+// Run decoders over a capture file, each on its own thread.
+//
+int gpio_decode(const gpio_capfile_t *f, gpio_decoder_t *dec, int ndec)
+{
+    pthread_t thread[ndec];
+    int started[ndec];
+    size_t k;
+    int i;
+
+    for (i = 0; i < ndec; i++) {
+        if (decoder_init(&dec[i], f) < 0)
+            return -1;
+    }
+    for (i = 0; i < ndec; i++) {
+        started[i] = (pthread_create(&thread[i], 0, decode_thread, &dec[i]) == 0);
+        if (!started[i]) {
+            // Out of threads: run it here instead.
+            decode_thread(&dec[i]);
+        }
+    }
+    int err = 0;
+    for (i = 0; i < ndec; i++) {
+        if (started[i])
+            pthread_join(thread[i], 0);
+        for (k = 0; k < dec[i].nframes; k++)
+            dec[i].frame[k].decoder = i;
+        if (dec[i].error && !err)
+            err = dec[i].error;
+    }
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Free decoded frames.
+//
+void gpio_decoder_free(gpio_decoder_t *dec)
+{
+    free(dec->frame);
+    dec->frame = 0;
+    dec->nframes = dec->maxframes = 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Timing helpers for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "gpio.h"
+
+//
+// Get monotonic time in nanoseconds.
+//
+uint64_t gpio_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+//
+// Advance the deadline by a given period and sleep until it.
+// A zero deadline is first set to the current time.
+// Absolute deadlines keep the rate without drift.
+//
+void gpio_sleep_period(struct timespec *deadline, int64_t nsec)
+{
+    if (deadline->tv_sec == 0 && deadline->tv_nsec == 0)
+        clock_gettime(CLOCK_MONOTONIC, deadline);
+
+    // Seconds separately, so that tv_nsec never overflows.
+    deadline->tv_sec += nsec / 1000000000;
+    deadline->tv_nsec += nsec % 1000000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_nsec -= 1000000000;
+        deadline->tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, 0) == EINTR)
+        continue;
+}
+
+//
+// Wait until a given monotonic time in nanoseconds.
+// Sleep while far from the deadline, then spin on the clock
+// for the last part, which the scheduler cannot hit exactly.
+//
+void gpio_wait_until(uint64_t ns)
+{
+    const uint64_t spin_ns = 100000;
+    uint64_t now = gpio_time_ns();
+
+    if (ns > now + spin_ns) {
+        struct timespec t;
+
+        t.tv_sec = (ns - spin_ns) / 1000000000;
+        t.tv_nsec = (ns - spin_ns) % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, 0) == EINTR)
+            continue;
+    }
+    while (gpio_time_ns() < ns)
+        continue;
+}
+
+//
+// Number of delay loop iterations per microsecond,
+// measured on the first call of gpio_udelay().
+//
+static unsigned loops_per_usec;
+
+//
+// Busy loop for a given number of iterations.
+//
+static void delay_loop(unsigned count)
+{
+    while (count-- > 0)
+        __asm__ volatile ("");
+}
+
+//
+// Measure the speed of the delay loop.
+// Take the best of several runs, to skip the ones
+// interrupted by the scheduler.
+//
+static void delay_calibrate()
+{
+    const unsigned count = 100000;
+    uint64_t best = ~0ULL;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        uint64_t t0 = gpio_time_ns();
+        delay_loop(count);
+        uint64_t t = gpio_time_ns() - t0;
+
+        if (t < best)
+            best = t;
+    }
+    if (best == 0)
+        best = 1;
+    loops_per_usec = (count * 1000ULL + best - 1) / best;
+    if (loops_per_usec == 0)
+        loops_per_usec = 1;
+}
+
+//
+// Busy wait for a given number of microseconds.
+// The loop is calibrated against the monotonic clock,
+// so short delays need no system calls.
+//
+void gpio_udelay(unsigned usec)
+{
+    if (!loops_per_usec)
+        delay_calibrate();
+
+    delay_loop(usec * loops_per_usec);
+}
+
+//
+// Prepare the calling thread for time-critical work:
+// lock memory, switch to real-time priority and optionally
+// bind the thread to a given CPU (negative to leave as is).
+// Return -1 when not permitted.
+//
+int gpio_set_realtime(int cpu)
+{
+    struct sched_param param = { 0 };
+    int status = 0;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        status = -1;
+
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+        status = -1;
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            status = -1;
+    }
+    return status;
+}
@@ -0,0 +1,214 @@
+/*
+ * Quadrature encoder decoder for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// Transition table, indexed by previous and new AB state.
+// Value is the position increment; ERR marks an invalid transition,
+// when both inputs changed between samples.
+//
+#define ERR 2
+
+static const int8_t transition[16] = {
+    /* 00->00 */ 0,   /* 00->01 */ +1,  /* 00->10 */ -1,  /* 00->11 */ ERR,
+    /* 01->00 */ -1,  /* 01->01 */ 0,   /* 01->10 */ ERR, /* 01->11 */ +1,
+    /* 10->00 */ +1,  /* 10->01 */ ERR, /* 10->10 */ 0,   /* 10->11 */ -1,
+    /* 11->00 */ ERR, /* 11->01 */ -1,  /* 11->10 */ +1,  /* 11->11 */ 0,
+};
+
+//
+// Velocity is recalculated with this interval, in nanoseconds.
+//
+#define VELOCITY_INTERVAL 100000000
+
+//
+// Get AB state of encoder from the port values.
+//
+static unsigned encoder_state(const gpio_encoder_t *enc, unsigned a, unsigned b)
+{
+    return ((a & GPIO_MASK(enc->pin_a)) ? 2 : 0) |
+           ((b & GPIO_MASK(enc->pin_b)) ? 1 : 0);
+}
+
+//
+// Configure pins of encoder as inputs and get the initial state.
+//
+int gpio_encoder_init(gpio_encoder_t *enc, int pin_a, int pin_b)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->pin_a = pin_a;
+    enc->pin_b = pin_b;
+    gpio_set_mode(pin_a, MODE_INPUT);
+    gpio_set_mode(pin_b, MODE_INPUT);
+
+    enc->state = encoder_state(enc, gpio_read_port(GPIO_PORT(pin_a)),
+                                    gpio_read_port(GPIO_PORT(pin_b)));
+    enc->last_time = gpio_time_ns();
+    return 0;
+}
+
+//
+// Find index of port in the group, or add a new one.
+//
+static int group_port(gpio_encoder_group_t *grp, int port)
+{
+    int i;
+
+    for (i = 0; i < grp->nports; i++) {
+        if (grp->port[i] == port)
+            return i;
+    }
+    grp->port[i] = port;
+    grp->mask[i] = 0;
+    grp->nports++;
+    return i;
+}
+
+//
+// Prepare a group of encoders for sampling.
+// Every port is read once per pass, whatever number of encoders it has.
+//
+int gpio_encoder_group_init(gpio_encoder_group_t *grp, gpio_encoder_t *enc, int nenc,
+                            unsigned period_usec, int use_change)
+{
+    int i;
+
+    memset(grp, 0, sizeof(*grp));
+    grp->enc = enc;
+    grp->nenc = nenc;
+    grp->period_usec = period_usec;
+    grp->use_change = use_change;
+
+    for (i = 0; i < nenc; i++) {
+        enc[i].ia = group_port(grp, GPIO_PORT(enc[i].pin_a));
+        enc[i].ib = group_port(grp, GPIO_PORT(enc[i].pin_b));
+        grp->mask[enc[i].ia] |= GPIO_MASK(enc[i].pin_a);
+        grp->mask[enc[i].ib] |= GPIO_MASK(enc[i].pin_b);
+    }
+    if (use_change) {
+        for (i = 0; i < grp->nports; i++) {
+            gpio_enable_change(grp->port[i], grp->mask[i]);
+            gpio_read_port(grp->port[i]);
+        }
+    }
+    return 0;
+}
+
+//
+// Sample all ports of the group once and update every encoder.
+// With change notification enabled, a pin which changed
+// and came back between two samples is detected as a missed edge.
+//
+void gpio_encoder_sample(gpio_encoder_group_t *grp)
+{
+    unsigned value[GPIO_NPORTS], change[GPIO_NPORTS];
+    int i;
+
+    for (i = 0; i < grp->nports; i++) {
+        change[i] = grp->use_change ? gpio_read_change(grp->port[i]) : 0;
+        value[i] = gpio_read_port(grp->port[i]);
+    }
+
+    uint64_t now = 0;
+    for (i = 0; i < grp->nenc; i++) {
+        gpio_encoder_t *enc = &grp->enc[i];
+        int ia = enc->ia;
+        int ib = enc->ib;
+        unsigned state = encoder_state(enc, value[ia], value[ib]);
+        int delta = transition[enc->state << 2 | state];
+
+        if (delta == ERR ||
+            (state == enc->state && ((change[ia] & GPIO_MASK(enc->pin_a)) ||
+                                     (change[ib] & GPIO_MASK(enc->pin_b))))) {
+            __atomic_store_n(&enc->errors, enc->errors + 1, __ATOMIC_RELAXED);
+        } else if (delta != 0) {
+            __atomic_store_n(&enc->position, enc->position + delta, __ATOMIC_RELAXED);
+        }
+        enc->state = state;
+
+        // Update velocity.
+        if (now == 0)
+            now = gpio_time_ns();
+        if (now - enc->last_time >= VELOCITY_INTERVAL) {
+            int32_t v = (int64_t)(enc->position - enc->last_position) * 1000000000 /
+                        (int64_t)(now - enc->last_time);
+
+            __atomic_store_n(&enc->velocity, v, __ATOMIC_RELAXED);
+            enc->last_position = enc->position;
+            enc->last_time = now;
+        }
+    }
+}
+
+//
+// Sampling thread.
+//
+static void *encoder_thread(void *arg)
+{
+    gpio_encoder_group_t *grp = arg;
+    struct timespec deadline = { 0 };
+
+    while (!grp->stop) {
+        gpio_encoder_sample(grp);
+        if (grp->period_usec)
+            gpio_sleep_period(&deadline, grp->period_usec * 1000LL);
+    }
+    return 0;
+}
+
+//
+// Start a thread, which samples the group periodically.
+//
+int gpio_encoder_start(gpio_encoder_group_t *grp)
+{
+    grp->stop = 0;
+    int err = pthread_create(&grp->thread, 0, encoder_thread, grp);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Stop the sampling thread.
+//
+void gpio_encoder_stop(gpio_encoder_group_t *grp)
+{
+    int i;
+
+    grp->stop = 1;
+    pthread_join(grp->thread, 0);
+
+    if (grp->use_change) {
+        for (i = 0; i < grp->nports; i++)
+            gpio_disable_change(grp->port[i], grp->mask[i]);
+    }
+}
@@ -0,0 +1,154 @@
+/*
+ * External interrupt flag polling for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// Interrupt controller registers.  Interrupts stay disabled in IEC0,
+// the flags in IFS0 are latched by hardware anyway.
+//
+#define INTCON_ADDR     0x1f810000
+#define INTCON          (0x00 / 4)
+#define INTCONCLR       (0x04 / 4)
+#define INTCONSET       (0x08 / 4)
+#define INTCONINV       (0x0c / 4)
+#define IFS0            (0x40 / 4)
+#define IFS0CLR         (0x44 / 4)
+
+//
+// Flag of INTx in IFS0.  Edge polarity of INTx is bit x of INTCON.
+//
+#define INT_FLAG(x)     (1 << (3 + 5*(x)))
+
+static volatile unsigned *intc;
+
+//
+// Route a pin to a free external interrupt input INT1...INT4
+// and set the edge.  Return the input number, or -1 on error.
+//
+int gpio_extint_add(gpio_extint_t *ei, int pin, gpio_edge_t edge)
+{
+    int x;
+
+    if (!intc) {
+        intc = gpio_map_sfr(INTCON_ADDR, 0x100);
+        if (!intc)
+            return -1;
+    }
+    for (x = 1; x <= 4; x++) {
+        if (!(ei->mask & INT_FLAG(x)) && gpio_has_mapping(pin, MODE_INT1 + x - 1))
+            break;
+    }
+    if (x > 4) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    gpio_set_mode(pin, MODE_INT1 + x - 1);
+    ei->pin[x-1] = pin;
+    ei->edge[x-1] = edge;
+    ei->count[x-1] = 0;
+    ei->max_latency_ns[x-1] = 0;
+
+    // Both edges: start with the edge opposite to the current level.
+    if (edge == GPIO_EDGE_RISING || (edge == GPIO_EDGE_BOTH && !gpio_read(pin)))
+        intc[INTCONSET] = 1 << x;
+    else
+        intc[INTCONCLR] = 1 << x;
+
+    intc[IFS0CLR] = INT_FLAG(x);
+    ei->mask |= INT_FLAG(x);
+    ei->last_poll = gpio_time_ns();
+    return x;
+}
+
+//
+// Check interrupt flags once.  Fired flags are cleared with
+// one write, events are counted and timestamped.
+// Return a mask of inputs with events, bit 0 for INT1.
+//
+unsigned gpio_extint_poll(gpio_extint_t *ei)
+{
+    unsigned flags = intc[IFS0] & ei->mask;
+    uint64_t now = gpio_time_ns();
+    unsigned fired = 0, flip = 0;
+    int x;
+
+    if (flags) {
+        unsigned polarity = intc[INTCON];
+
+        intc[IFS0CLR] = flags;
+        for (x = 1; x <= 4; x++) {
+            if (!(flags & INT_FLAG(x)))
+                continue;
+
+            // Event happened since the previous poll.
+            ei->count[x-1]++;
+            ei->time_ns[x-1] = now;
+            ei->level[x-1] = (polarity >> x) & 1;
+            if (now - ei->last_poll > ei->max_latency_ns[x-1])
+                ei->max_latency_ns[x-1] = now - ei->last_poll;
+            if (ei->edge[x-1] == GPIO_EDGE_BOTH)
+                flip |= 1 << x;
+            fired |= 1 << (x-1);
+        }
+
+        // For both edges, wait for the opposite one.
+        if (flip)
+            intc[INTCONINV] = flip;
+    }
+    ei->last_poll = now;
+    return fired;
+}
+
+//
+// Poll the flags with a given period, or in a tight loop when
+// the period is zero, and call func() for every event.
+// The value given to func() is the level after the edge.
+// Return when func() returns nonzero.
+//
+int gpio_extint_run(gpio_extint_t *ei, unsigned period_usec,
+                    gpio_event_func_t *func, void *arg)
+{
+    struct timespec deadline = { 0 };
+
+    for (;;) {
+        unsigned fired = gpio_extint_poll(ei);
+
+        while (fired) {
+            int x = __builtin_ctz(fired) + 1;
+
+            fired &= fired - 1;
+            if (func(ei->pin[x-1], ei->level[x-1], arg))
+                return 0;
+        }
+        if (period_usec)
+            gpio_sleep_period(&deadline, period_usec * 1000LL);
+    }
+}
@@ -0,0 +1,162 @@
+/*
+ * Frequency counter on PIC32 timer clock inputs.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// A 16-bit counter is read at least this often, to catch every wrap.
+//
+#define POLL_USEC_16    1000
+
+//
+// Find a free timer, which can be clocked from a given pin.
+// Even timers are paired with the next odd one into 32-bit counters,
+// so they are tried first.  A timer is free when it is not enabled.
+//
+static int freq_find_timer(int pin, int *bits)
+{
+    static const int order[] = { 2, 4, 6, 8, 3, 5, 7, 9 };
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        int n = order[i];
+        struct tmrreg *t = gpio_timer_reg(n);
+
+        if (!t || !gpio_has_mapping(pin, MODE_T2CK + n - 2))
+            continue;
+        if (t->con & GPIO_TCON_ON)
+            continue;
+        if (n % 2 == 0) {
+            if (gpio_timer_reg(n + 1)->con & GPIO_TCON_ON)
+                continue;
+            *bits = 32;
+        } else {
+            // Odd timer must not be the upper half of a 32-bit pair.
+            if (gpio_timer_reg(n - 1)->con & GPIO_TCON_T32)
+                continue;
+            *bits = 16;
+        }
+        return n;
+    }
+    return -1;
+}
+
+//
+// Read the counter together with a timestamp.
+// The timestamp is the middle of the read, and the uncertainty
+// is half of its duration.  The count is extended to 64 bits.
+//
+static void freq_sample(gpio_freq_t *fc)
+{
+    uint64_t t1 = gpio_time_ns();
+    unsigned c = fc->tmr->tmr;
+    uint64_t t2 = gpio_time_ns();
+    unsigned wrap = (fc->bits == 32) ? 0xffffffff : 0xffff;
+
+    fc->count += (c - fc->last) & wrap;
+    fc->last = c;
+    fc->time_ns = (t1 + t2) / 2;
+    fc->uncert_ns = (t2 - t1 + 1) / 2;
+}
+
+//
+// Route a pin to a free timer clock input, and start counting.
+//
+int gpio_freq_open(gpio_freq_t *fc, int pin)
+{
+    memset(fc, 0, sizeof(*fc));
+    fc->timer = freq_find_timer(pin, &fc->bits);
+    if (fc->timer < 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    fc->pin = pin;
+    fc->tmr = gpio_timer_reg(fc->timer);
+
+    // External clock, no prescaler.
+    struct tmrreg *t = fc->tmr;
+    gpio_set_mode(pin, MODE_T2CK + fc->timer - 2);
+    if (fc->bits == 32) {
+        t->con = GPIO_TCON_T32 | GPIO_TCON_TCS;
+        t->pr = 0xffffffff;
+    } else {
+        t->con = GPIO_TCON_TCS;
+        t->pr = 0xffff;
+    }
+    t->tmr = 0;
+    t->conset = GPIO_TCON_ON;
+
+    freq_sample(fc);
+    return 0;
+}
+
+//
+// Count for a given window, starting at the end of the previous one,
+// so that consecutive measurements have no dead time.
+// Frequency error bound is one count plus the uncertainty
+// of both gate times.
+//
+int gpio_freq_measure(gpio_freq_t *fc, unsigned window_usec, double *hz, double *err)
+{
+    uint64_t start_time = fc->time_ns;
+    uint64_t start_count = fc->count;
+    unsigned start_uncert = fc->uncert_ns;
+    uint64_t end = start_time + window_usec * 1000ULL;
+
+    if (window_usec == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (;;) {
+        uint64_t next = end;
+
+        if (fc->bits == 16 && next > fc->time_ns + POLL_USEC_16 * 1000)
+            next = fc->time_ns + POLL_USEC_16 * 1000;
+        gpio_wait_until(next);
+        freq_sample(fc);
+        if (fc->time_ns >= end)
+            break;
+    }
+
+    double t = (fc->time_ns - start_time) / 1e9;
+    double n = fc->count - start_count;
+
+    *hz = n / t;
+    *err = (1 + *hz * (start_uncert + fc->uncert_ns) / 1e9) / t;
+    return 0;
+}
+
+//
+// Stop the timer and release the pin.
+//
+void gpio_freq_close(gpio_freq_t *fc)
+{
+    fc->tmr->con = 0;
+    gpio_set_mode(fc->pin, MODE_INPUT);
+}
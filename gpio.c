@@ -32,80 +32,332 @@
 #include <errno.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "gpio.h"
 
-struct gpioreg {
-    volatile unsigned ansel;        // Analog select
-    volatile unsigned anselclr;
-    volatile unsigned anselset;
-    volatile unsigned anselinv;
-    volatile unsigned tris;         // Mask of inputs
-    volatile unsigned trisclr;
-    volatile unsigned trisset;
-    volatile unsigned trisinv;
-    volatile unsigned port;         // Read inputs, write outputs
-    volatile unsigned portclr;
-    volatile unsigned portset;
-    volatile unsigned portinv;
-    volatile unsigned lat;          // Read/write outputs
-    volatile unsigned latclr;
-    volatile unsigned latset;
-    volatile unsigned latinv;
-    volatile unsigned odc;          // Open drain configuration
-    volatile unsigned odcclr;
-    volatile unsigned odcset;
-    volatile unsigned odcinv;
-    volatile unsigned cnpu;         // Input pin pull-up enable
-    volatile unsigned cnpuclr;
-    volatile unsigned cnpuset;
-    volatile unsigned cnpuinv;
-    volatile unsigned cnpd;         // Input pin pull-down enable
-    volatile unsigned cnpdclr;
-    volatile unsigned cnpdset;
-    volatile unsigned cnpdinv;
-    volatile unsigned cncon;        // Interrupt-on-change control
-    volatile unsigned cnconclr;
-    volatile unsigned cnconset;
-    volatile unsigned cnconinv;
-    volatile unsigned cnen;         // Input change interrupt enable
-    volatile unsigned cnenclr;
-    volatile unsigned cnenset;
-    volatile unsigned cneninv;
-    volatile unsigned cnstat;       // Change notification status
-    volatile unsigned cnstatclr;
-    volatile unsigned cnstatset;
-    volatile unsigned cnstatinv;
-    volatile unsigned unused[6*4];
-};
-
 int gpio_debug;                     // Debug output
-int gpio_mem_fd;                    // Access to /dev/mem
+int gpio_mem_fd = -1;               // Access to /dev/mem
 static ptrdiff_t gpio_base;         // GPIO registers mapped here
+static pthread_once_t gpio_once = PTHREAD_ONCE_INIT;
+static int gpio_init_errno;         // Why the mapping failed
+
+//
+// Mapped blocks of peripheral registers, shared by all callers.
+//
+#define MAX_SFR_MAPS    32
+
+static struct {
+    unsigned addr;                  // Physical address, page aligned
+    unsigned size;
+    char    *base;
+} sfr_map[MAX_SFR_MAPS];
+static int sfr_nmaps;
+static pthread_mutex_t sfr_lock = PTHREAD_MUTEX_INITIALIZER;
 
 //
-// Get access to GPIO control registers.
+// Locks for read-modify-write sequences on ports.
+//
+static pthread_mutex_t port_lock[GPIO_NPORTS] = {
+    [0 ... GPIO_NPORTS-1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+//
+// Get access to GPIO control registers, once per process.
 // Set gpio_base to a base address of the appropriate page.
 //
-static void gpio_init()
+static void gpio_init_once()
 {
     const int GPIO_ADDR = 0x1f860000;
 
     // Obtain handle to physical memory
     gpio_mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
     if (gpio_mem_fd < 0) {
-        printf("Unable to open /dev/mem: %s\n", strerror(errno));
-        exit(-1);
+        gpio_init_errno = errno;
+        return;
     }
 
     // Map a page of memory to gpio address
-    gpio_base = (ptrdiff_t) mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED,
+    void *base = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED,
         gpio_mem_fd, GPIO_ADDR);
-    if (gpio_base < 0) {
-        printf("Mmap failed: %s\n", strerror(errno));
-        exit(-1);
+    if (base == MAP_FAILED) {
+        gpio_init_errno = errno;
+        return;
+    }
+    __atomic_store_n(&gpio_base, (ptrdiff_t) base, __ATOMIC_RELEASE);
+}
+
+//
+// Map GPIO registers on first use.  Threads calling it at the same
+// time wait for a single initialization.
+// Return -1 on failure, with errno set.
+//
+static int gpio_init()
+{
+    pthread_once(&gpio_once, gpio_init_once);
+    if (!gpio_base) {
+        errno = gpio_init_errno;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Get version of the library, as GPIO_VERSION.
+//
+unsigned gpio_version()
+{
+    return GPIO_VERSION;
+}
+
+//
+// Open access to GPIO registers.
+// Return 0 on failure, with errno set.
+//
+gpio_t *gpio_open()
+{
+    if (!gpio_base && gpio_init() < 0)
+        return 0;
+
+    gpio_t *h = malloc(sizeof(gpio_t));
+    if (!h)
+        return 0;
+
+    h->base = (char*) gpio_base;
+    return h;
+}
+
+//
+// Close the handle.  Registers stay mapped, as pointers
+// to them may be kept by other parts of the application.
+//
+void gpio_close(gpio_t *h)
+{
+    free(h);
+}
+
+//
+// Map a block of peripheral registers at a given physical address.
+// Blocks are mapped once: repeated and concurrent calls for the same
+// registers get the same mapping.
+// Return a pointer to the first register, or 0 on failure.
+//
+volatile unsigned *gpio_map_sfr(unsigned addr, unsigned nbytes)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return 0;
+
+    unsigned offset = addr & 4095;
+    unsigned page = addr - offset;
+    unsigned size = (offset + nbytes + 4095) & ~4095;
+    char *base = 0;
+    int i;
+
+    pthread_mutex_lock(&sfr_lock);
+    for (i = 0; i < sfr_nmaps; i++) {
+        if (page >= sfr_map[i].addr &&
+            page + size <= sfr_map[i].addr + sfr_map[i].size) {
+            base = sfr_map[i].base + (page - sfr_map[i].addr);
+            break;
+        }
+    }
+    if (!base) {
+        void *p = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, gpio_mem_fd, page);
+
+        if (p != MAP_FAILED) {
+            base = p;
+            if (sfr_nmaps < MAX_SFR_MAPS) {
+                sfr_map[sfr_nmaps].addr = page;
+                sfr_map[sfr_nmaps].size = size;
+                sfr_map[sfr_nmaps].base = base;
+                sfr_nmaps++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sfr_lock);
+
+    if (!base)
+        return 0;
+    return (volatile unsigned*) (base + offset);
+}
+
+//
+// Get index of a port by letter, or -1.
+//
+static int port_index(int port)
+{
+    const char *p = strchr("ABCDEFGHJK", port);
+
+    if (!port || !p) {
+        errno = EINVAL;
+        return -1;
+    }
+    return p - "ABCDEFGHJK";
+}
+
+//
+// Lock a port for a read-modify-write sequence.
+//
+int gpio_port_lock(int port)
+{
+    int i = port_index(port);
+
+    if (i < 0)
+        return -1;
+    return -pthread_mutex_lock(&port_lock[i]);
+}
+
+//
+// Unlock a port.
+//
+int gpio_port_unlock(int port)
+{
+    int i = port_index(port);
+
+    if (i < 0)
+        return -1;
+    return -pthread_mutex_unlock(&port_lock[i]);
+}
+
+//
+// Write outputs of a port under a mask: ones by LATSET,
+// zeros by LATCLR.  Other pins are not touched, so no lock is needed.
+//
+int gpio_write_port(int port, unsigned mask, unsigned value)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
+
+    uint64_t t0 = GPIO_STATS_START();
+    struct gpioreg *reg = (struct gpioreg*) (gpio_base + GPIO_OFFSET(port));
+
+    reg->latset = value & mask;
+    reg->latclr = ~value & mask;
+    GPIO_STATS_END(GPIO_OP_WRITE_PORT, -1, 2, t0);
+    return 0;
+}
+
+//
+// Get control registers of timer 1...9, or 0 on failure.
+//
+struct tmrreg *gpio_timer_reg(int n)
+{
+    const unsigned TMR1_ADDR = 0x1f840000;
+    const unsigned TMR_STRIDE = 0x200;
+    static volatile unsigned *tmr_base;
+
+    if (n < 1 || n > 9) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (!tmr_base) {
+        tmr_base = gpio_map_sfr(TMR1_ADDR, 9 * TMR_STRIDE);
+        if (!tmr_base)
+            return 0;
+    }
+    return (struct tmrreg*) ((char*)tmr_base + (n - 1) * TMR_STRIDE);
+}
+
+//
+// Get a pin descriptor by a pic32 pin name, Broadcom name
+// or physical pin index.  Return -1 for unknown names.
+//
+int gpio_pin_by_name(const char *name)
+{
+    if (name[0] == 'r' || name[0] == 'R') {
+        // PIC32 pin names.
+        if      (strcasecmp(name, "RA9")  == 0) return GPIO_PIN('A', 9);
+        else if (strcasecmp(name, "RB0")  == 0) return GPIO_PIN('B', 0);
+        else if (strcasecmp(name, "RB2")  == 0) return GPIO_PIN('B', 2);
+        else if (strcasecmp(name, "RB4")  == 0) return GPIO_PIN('B', 4);
+        else if (strcasecmp(name, "RB8")  == 0) return GPIO_PIN('B', 8);
+        else if (strcasecmp(name, "RB15") == 0) return GPIO_PIN('B', 15);
+        else if (strcasecmp(name, "RC3")  == 0) return GPIO_PIN('C', 3);
+        else if (strcasecmp(name, "RD0")  == 0) return GPIO_PIN('D', 0);
+        else if (strcasecmp(name, "RD7")  == 0) return GPIO_PIN('D', 7);
+        else if (strcasecmp(name, "RD14") == 0) return GPIO_PIN('D', 14);
+        else if (strcasecmp(name, "RD15") == 0) return GPIO_PIN('D', 15);
+        else if (strcasecmp(name, "RE4")  == 0) return GPIO_PIN('E', 4);
+        else if (strcasecmp(name, "RE7")  == 0) return GPIO_PIN('E', 7);
+        else if (strcasecmp(name, "RE8")  == 0) return GPIO_PIN('E', 8);
+        else if (strcasecmp(name, "RF2")  == 0) return GPIO_PIN('F', 2);
+        else if (strcasecmp(name, "RF8")  == 0) return GPIO_PIN('F', 8);
+        else if (strcasecmp(name, "RG6")  == 0) return GPIO_PIN('G', 6);
+        else if (strcasecmp(name, "RG8")  == 0) return GPIO_PIN('G', 8);
+        else if (strcasecmp(name, "RG9")  == 0) return GPIO_PIN('G', 9);
+        else if (strcasecmp(name, "RH3")  == 0) return GPIO_PIN('H', 3);
+        else if (strcasecmp(name, "RH4")  == 0) return GPIO_PIN('H', 4);
+        else if (strcasecmp(name, "RH6")  == 0) return GPIO_PIN('H', 6);
+        else if (strcasecmp(name, "RH7")  == 0) return GPIO_PIN('H', 7);
+        else if (strcasecmp(name, "RH12") == 0) return GPIO_PIN('H', 12);
+        else if (strcasecmp(name, "RJ2")  == 0) return GPIO_PIN('J', 2);
+        else if (strcasecmp(name, "RK1")  == 0) return GPIO_PIN('K', 1);
+        else if (strcasecmp(name, "RK2")  == 0) return GPIO_PIN('K', 2);
+    } else
+    if (name[0] == 'j' || name[0] == 'J') {
+        // Physical pin indices on Extension connector.
+        if      (strcasecmp(name, "j3")  == 0) return GPIO_PIN('F', 2);
+        else if (strcasecmp(name, "j5")  == 0) return GPIO_PIN('F', 8);
+        else if (strcasecmp(name, "j7")  == 0) return GPIO_PIN('E', 4);
+        else if (strcasecmp(name, "j8")  == 0) return GPIO_PIN('C', 3);
+        else if (strcasecmp(name, "j10") == 0) return GPIO_PIN('E', 8);
+        else if (strcasecmp(name, "j11") == 0) return GPIO_PIN('E', 7);
+        else if (strcasecmp(name, "j12") == 0) return GPIO_PIN('H', 3);
+        else if (strcasecmp(name, "j13") == 0) return GPIO_PIN('B', 8);
+        else if (strcasecmp(name, "j15") == 0) return GPIO_PIN('A', 9);
+        else if (strcasecmp(name, "j16") == 0) return GPIO_PIN('B', 4);
+        else if (strcasecmp(name, "j18") == 0) return GPIO_PIN('H', 4);
+        else if (strcasecmp(name, "j19") == 0) return GPIO_PIN('G', 8);
+        else if (strcasecmp(name, "j21") == 0) return GPIO_PIN('D', 7);
+        else if (strcasecmp(name, "j22") == 0) return GPIO_PIN('H', 6);
+        else if (strcasecmp(name, "j23") == 0) return GPIO_PIN('G', 6);
+        else if (strcasecmp(name, "j24") == 0) return GPIO_PIN('D', 0);
+        else if (strcasecmp(name, "j26") == 0) return GPIO_PIN('D', 14);
+        else if (strcasecmp(name, "j27") == 0) return GPIO_PIN('B', 2);
+        else if (strcasecmp(name, "j29") == 0) return GPIO_PIN('K', 1);
+        else if (strcasecmp(name, "j31") == 0) return GPIO_PIN('K', 2);
+        else if (strcasecmp(name, "j32") == 0) return GPIO_PIN('J', 2);
+        else if (strcasecmp(name, "j33") == 0) return GPIO_PIN('G', 9);
+        else if (strcasecmp(name, "j35") == 0) return GPIO_PIN('B', 0);
+        else if (strcasecmp(name, "j36") == 0) return GPIO_PIN('B', 15);
+        else if (strcasecmp(name, "j37") == 0) return GPIO_PIN('H', 7);
+        else if (strcasecmp(name, "j38") == 0) return GPIO_PIN('H', 12);
+        else if (strcasecmp(name, "j40") == 0) return GPIO_PIN('D', 15);
+    } else
+    if (name[0] == 'p' || name[0] == 'P') {
+        // Broadcom pin names.
+        if      (strcasecmp(name, "p0")  == 0) return GPIO_PIN('B', 2);
+        else if (strcasecmp(name, "p2")  == 0) return GPIO_PIN('F', 2);
+        else if (strcasecmp(name, "p3")  == 0) return GPIO_PIN('F', 8);
+        else if (strcasecmp(name, "p4")  == 0) return GPIO_PIN('E', 4);
+        else if (strcasecmp(name, "p5")  == 0) return GPIO_PIN('K', 1);
+        else if (strcasecmp(name, "p6")  == 0) return GPIO_PIN('K', 2);
+        else if (strcasecmp(name, "p7")  == 0) return GPIO_PIN('D', 14);
+        else if (strcasecmp(name, "p8")  == 0) return GPIO_PIN('D', 0);
+        else if (strcasecmp(name, "p9")  == 0) return GPIO_PIN('D', 7);
+        else if (strcasecmp(name, "p10") == 0) return GPIO_PIN('G', 8);
+        else if (strcasecmp(name, "p11") == 0) return GPIO_PIN('G', 6);
+        else if (strcasecmp(name, "p12") == 0) return GPIO_PIN('J', 2);
+        else if (strcasecmp(name, "p13") == 0) return GPIO_PIN('G', 9);
+        else if (strcasecmp(name, "p14") == 0) return GPIO_PIN('C', 3);
+        else if (strcasecmp(name, "p15") == 0) return GPIO_PIN('E', 8);
+        else if (strcasecmp(name, "p16") == 0) return GPIO_PIN('B', 15);
+        else if (strcasecmp(name, "p17") == 0) return GPIO_PIN('E', 7);
+        else if (strcasecmp(name, "p18") == 0) return GPIO_PIN('H', 3);
+        else if (strcasecmp(name, "p19") == 0) return GPIO_PIN('B', 0);
+        else if (strcasecmp(name, "p20") == 0) return GPIO_PIN('H', 12);
+        else if (strcasecmp(name, "p21") == 0) return GPIO_PIN('D', 15);
+        else if (strcasecmp(name, "p22") == 0) return GPIO_PIN('A', 9);
+        else if (strcasecmp(name, "p23") == 0) return GPIO_PIN('B', 4);
+        else if (strcasecmp(name, "p24") == 0) return GPIO_PIN('H', 4);
+        else if (strcasecmp(name, "p25") == 0) return GPIO_PIN('H', 6);
+        else if (strcasecmp(name, "p26") == 0) return GPIO_PIN('H', 7);
+        else if (strcasecmp(name, "p27") == 0) return GPIO_PIN('B', 8);
     }
+    errno = EINVAL;
+    return -1;
 }
 
 //
@@ -113,9 +365,145 @@ static void gpio_init()
 //
 gpio_mode_t gpio_get_mode(int pin)
 {
-    if (!gpio_base)
-        gpio_init();
+    if (pin & GPIO_VIRTUAL)
+        return gpio_vpin_mode(pin);
+
+    if (!gpio_base && gpio_init() < 0)
+        return MODE_UNKNOWN;
 
+    uint64_t t0 = GPIO_STATS_START();
+    struct gpioreg *reg = (struct gpioreg*) (gpio_base + (pin >> 16));
+    uint16_t mask = (uint16_t) pin;
+    unsigned naccesses = 0;
+
+    // Check output mapping, then input mapping.
+    gpio_mode_t mode = gpio_get_output_mapping(pin);
+    if (!mode)
+        mode = gpio_get_input_mapping(pin);
+
+    if (!mode) {
+        naccesses = 2;
+        if (reg->ansel & mask)
+            mode = MODE_ANALOG;
+        else if (reg->tris & mask)
+            mode = MODE_INPUT;
+        else
+            mode = MODE_OUTPUT;
+    }
+    GPIO_STATS_END(GPIO_OP_GET_MODE, pin, naccesses, t0);
+    return mode;
+}
+
+//
+// Read all control registers of a port at once.
+// Port is given by letter, 'A'...'K'.
+//
+int gpio_get_port_state(int port, gpio_port_state_t *state)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
+
+    struct gpioreg *reg = (struct gpioreg*) (gpio_base + GPIO_OFFSET(port));
+
+    state->ansel  = reg->ansel;
+    state->tris   = reg->tris;
+    state->port   = reg->port;
+    state->lat    = reg->lat;
+    state->odc    = reg->odc;
+    state->cnpu   = reg->cnpu;
+    state->cnpd   = reg->cnpd;
+    state->cncon  = reg->cncon;
+    state->cnen   = reg->cnen;
+    state->cnstat = reg->cnstat;
+    return 0;
+}
+
+//
+// Get control registers of a port.
+// Port is given by letter, 'A'...'K'.
+//
+struct gpioreg *gpio_port_reg(int port)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return 0;
+
+    return (struct gpioreg*) (gpio_base + GPIO_OFFSET(port));
+}
+
+//
+// Read input values of all pins of a port.
+// Port is given by letter, 'A'...'K'.
+//
+unsigned gpio_read_port(int port)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return 0;
+
+    uint64_t t0 = GPIO_STATS_START();
+    struct gpioreg *reg = (struct gpioreg*) (gpio_base + GPIO_OFFSET(port));
+    unsigned value = reg->port;
+
+    GPIO_STATS_END(GPIO_OP_READ_PORT, -1, 1, t0);
+    return value;
+}
+
+//
+// Enable change notification for a set of pins of a port.
+//
+int gpio_enable_change(int port, unsigned mask)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
+
+    struct gpioreg *reg = (struct gpioreg*) (gpio_base + GPIO_OFFSET(port));
+
+    gpio_port_lock(port);
+    reg->cnconset = 1 << 15;        // ON
+    reg->cnenset = mask;
+    gpio_port_unlock(port);
+    return 0;
+}
+
+//
+// Disable change notification for a set of pins of a port.
+// The notification module of the port is turned off
+// when no pins remain enabled.
+//
+int gpio_disable_change(int port, unsigned mask)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
+
+    struct gpioreg *reg = (struct gpioreg*) (gpio_base + GPIO_OFFSET(port));
+
+    gpio_port_lock(port);
+    reg->cnenclr = mask;
+    if (reg->cnen == 0)
+        reg->cnconclr = 1 << 15;    // ON
+    gpio_port_unlock(port);
+    return 0;
+}
+
+//
+// Read change notification status of a port: a mask of pins
+// which changed since the last read of the port.
+//
+unsigned gpio_read_change(int port)
+{
+    if (!gpio_base && gpio_init() < 0)
+        return 0;
+
+    struct gpioreg *reg = (struct gpioreg*) (gpio_base + GPIO_OFFSET(port));
+
+    return reg->cnstat;
+}
+
+//
+// Get pin direction or alternative function,
+// using a port snapshot instead of the live registers.
+//
+gpio_mode_t gpio_get_state_mode(int pin, const gpio_port_state_t *state)
+{
     // Check output mapping.
     gpio_mode_t mode = gpio_get_output_mapping(pin);
     if (mode)
@@ -126,13 +514,12 @@ gpio_mode_t gpio_get_mode(int pin)
     if (mode)
         return mode;
 
-    struct gpioreg *reg = (struct gpioreg*) (gpio_base + (pin >> 16));
     uint16_t mask = (uint16_t) pin;
 
-    if (reg->ansel & mask)
+    if (state->ansel & mask)
         return MODE_ANALOG;
 
-    if (reg->tris & mask)
+    if (state->tris & mask)
         return MODE_INPUT;
 
     return MODE_OUTPUT;
@@ -143,11 +530,16 @@ gpio_mode_t gpio_get_mode(int pin)
 //
 int gpio_set_mode(int pin, gpio_mode_t mode)
 {
-    if (!gpio_base)
-        gpio_init();
+    if (pin & GPIO_VIRTUAL)
+        return (mode == gpio_vpin_mode(pin)) ? 0 : -1;
+
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
 
+    uint64_t t0 = GPIO_STATS_START();
     struct gpioreg *reg = (struct gpioreg*) (gpio_base + (pin >> 16));
     uint16_t mask = (uint16_t) pin;
+    int status = 0;
 
     gpio_clear_mapping(pin);
     switch (mode) {
@@ -173,10 +565,11 @@ int gpio_set_mode(int pin, gpio_mode_t mode)
         // Alternative function.
         reg->trisset = mask;
         reg->anselclr = mask;
-        gpio_set_mapping(pin, mode);
+        status = gpio_set_mapping(pin, mode);
         break;
     }
-    return 0;
+    GPIO_STATS_END(GPIO_OP_SET_MODE, pin, 2, t0);
+    return status;
 }
 
 //
@@ -184,9 +577,13 @@ int gpio_set_mode(int pin, gpio_mode_t mode)
 //
 int gpio_set_pull(int pin, gpio_pull_t pull)
 {
-    if (!gpio_base)
-        gpio_init();
+    if (pin & GPIO_VIRTUAL)
+        return -1;
+
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
 
+    uint64_t t0 = GPIO_STATS_START();
     struct gpioreg *reg = (struct gpioreg*) (gpio_base + (pin >> 16));
     uint16_t mask = (uint16_t) pin;
 
@@ -206,6 +603,7 @@ int gpio_set_pull(int pin, gpio_pull_t pull)
         reg->cnpdset = mask;
         break;
     }
+    GPIO_STATS_END(GPIO_OP_SET_PULL, pin, 2, t0);
     return 0;
 }
 
@@ -215,16 +613,19 @@ int gpio_set_pull(int pin, gpio_pull_t pull)
 //
 int gpio_read(int pin)
 {
-    if (!gpio_base)
-        gpio_init();
+    if (pin & GPIO_VIRTUAL)
+        return gpio_vpin_read(pin);
+
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
 
+    uint64_t t0 = GPIO_STATS_START();
     struct gpioreg *reg = (struct gpioreg*) (gpio_base + (pin >> 16));
     uint16_t mask = (uint16_t) pin;
+    int value = (reg->port & mask) != 0;
 
-    if (reg->port & mask)
-        return 1;
-
-    return 0;
+    GPIO_STATS_END(GPIO_OP_READ, pin, 1, t0);
+    return value;
 }
 
 //
@@ -232,9 +633,13 @@ int gpio_read(int pin)
 //
 int gpio_write(int pin, int value)
 {
-    if (!gpio_base)
-        gpio_init();
+    if (pin & GPIO_VIRTUAL)
+        return gpio_vpin_write(pin, value);
+
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
 
+    uint64_t t0 = GPIO_STATS_START();
     struct gpioreg *reg = (struct gpioreg*) (gpio_base + (pin >> 16));
     uint16_t mask = (uint16_t) pin;
 
@@ -243,6 +648,7 @@ int gpio_write(int pin, int value)
     else
         reg->latclr = mask;
 
+    GPIO_STATS_END(GPIO_OP_WRITE, pin, 1, t0);
     return 0;
 }
 
@@ -251,13 +657,119 @@ int gpio_write(int pin, int value)
 //
 int gpio_toggle(int pin)
 {
-    if (!gpio_base)
-        gpio_init();
+    if (pin & GPIO_VIRTUAL)
+        return gpio_vpin_toggle(pin);
 
+    if (!gpio_base && gpio_init() < 0)
+        return -1;
+
+    uint64_t t0 = GPIO_STATS_START();
     struct gpioreg *reg = (struct gpioreg*) (gpio_base + (pin >> 16));
     uint16_t mask = (uint16_t) pin;
 
     reg->latinv = mask;
 
+    GPIO_STATS_END(GPIO_OP_TOGGLE, pin, 1, t0);
     return 0;
 }
+
+//
+// Check a handle and a real port pin for the handle-based calls below.
+// Return the control registers of the pin's port, or 0 with errno set.
+//
+static struct gpioreg *gpio_handle_reg(const gpio_t *h, int pin)
+{
+    if (!h || !h->base) {
+        errno = EBADF;
+        return 0;
+    }
+    if (pin < 0 || (pin >> 24) >= GPIO_NPORTS || !GPIO_MASK(pin)) {
+        errno = EINVAL;
+        return 0;
+    }
+    return (struct gpioreg*) (h->base + (pin >> 16));
+}
+
+//
+// Read the input value by handle.
+//
+int gpio_h_read(const gpio_t *h, int pin)
+{
+    if (pin & GPIO_VIRTUAL)
+        return h ? gpio_vpin_read(pin) : (errno = EBADF, -1);
+
+    struct gpioreg *reg = gpio_handle_reg(h, pin);
+    if (!reg)
+        return -1;
+
+    uint64_t t0 = GPIO_STATS_START();
+    int value = (reg->port & GPIO_MASK(pin)) != 0;
+
+    GPIO_STATS_END(GPIO_OP_READ, pin, 1, t0);
+    return value;
+}
+
+//
+// Write the output value by handle.
+//
+int gpio_h_write(const gpio_t *h, int pin, int value)
+{
+    if (pin & GPIO_VIRTUAL)
+        return h ? gpio_vpin_write(pin, value) : (errno = EBADF, -1);
+
+    struct gpioreg *reg = gpio_handle_reg(h, pin);
+    if (!reg)
+        return -1;
+
+    uint64_t t0 = GPIO_STATS_START();
+    if (value & 1)
+        reg->latset = GPIO_MASK(pin);
+    else
+        reg->latclr = GPIO_MASK(pin);
+
+    GPIO_STATS_END(GPIO_OP_WRITE, pin, 1, t0);
+    return 0;
+}
+
+//
+// Toggle the output value by handle.
+//
+int gpio_h_toggle(const gpio_t *h, int pin)
+{
+    if (pin & GPIO_VIRTUAL)
+        return h ? gpio_vpin_toggle(pin) : (errno = EBADF, -1);
+
+    struct gpioreg *reg = gpio_handle_reg(h, pin);
+    if (!reg)
+        return -1;
+
+    uint64_t t0 = GPIO_STATS_START();
+    reg->latinv = GPIO_MASK(pin);
+
+    GPIO_STATS_END(GPIO_OP_TOGGLE, pin, 1, t0);
+    return 0;
+}
+
+//
+// Set pin direction or alternative function by handle.
+// The handle proves the registers are mapped; the work is shared
+// with gpio_set_mode(), which also manages the PPS mapping.
+//
+int gpio_h_set_mode(const gpio_t *h, int pin, gpio_mode_t mode)
+{
+    if (!h || !h->base) {
+        errno = EBADF;
+        return -1;
+    }
+    return gpio_set_mode(pin, mode);
+}
+
+//
+// Set pull up/down resistors by handle.
+//
+int gpio_h_set_pull(const gpio_t *h, int pin, gpio_pull_t pull)
+{
+    if (!gpio_handle_reg(h, pin))
+        return -1;
+    return gpio_set_pull(pin, pull);
+}
@@ -25,11 +25,36 @@
  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#ifndef GPIO_PIC32_H
+#define GPIO_PIC32_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Version of the library interface.  The major number changes
+// with incompatible changes, and is the soname version.
+//
+#define GPIO_VERSION_MAJOR  1
+#define GPIO_VERSION_MINOR  0
+#define GPIO_VERSION        ((GPIO_VERSION_MAJOR << 16) | GPIO_VERSION_MINOR)
+
+//
+// Get version of the library at run time, as GPIO_VERSION.
+//
+unsigned gpio_version(void);
 
 //
 // Pin modes.
 //
 typedef enum {
+    MODE_UNKNOWN = -1,      // Registers are not accessible
     MODE_OUTPUT,            // Output
     MODE_INPUT,             // Input
     MODE_ANALOG,            // Analog
@@ -140,8 +165,53 @@ typedef enum {
     PULL_DOWN   = 2,        // Pull down
 } gpio_pull_t;
 
+//
+// Handle of open GPIO registers.
+//
+typedef struct {
+    char    *base;              // Registers of all ports
+} gpio_t;
+
+//
+// Open access to GPIO registers, once per application.
+// All functions below also map the registers on first use,
+// but only gpio_open() reports a failure.
+// Return 0 on failure, with errno set.
+//
+gpio_t *gpio_open(void);
+
+//
+// Close the handle.  The registers stay mapped until exit.
+//
+void gpio_close(gpio_t *h);
+
+//
+// Thread safety.
+//
+// Mapping of registers is done once per process, and can be
+// triggered from any thread.  Functions which change a pin by
+// writing to SET/CLR/INV registers are atomic: gpio_write(),
+// gpio_toggle(), gpio_set_mode(), gpio_set_pull() and gpio_write_port()
+// can be called from different threads, for different pins
+// of the same port.  Direct writes to LAT, TRIS and other registers
+// by gpio_port_reg() are read-modify-write: protect them by
+// gpio_port_lock().  Virtual pins of shift register chains and
+// single ADC reads take the locks themselves.
+//
+// Driver objects (encoder, stepper, keypad, LCD, sequence, etc.)
+// are not locked: use each of them from one thread only.
+//
+
+//
+// Get a pin descriptor by name: pic32 name like "rb2",
+// Broadcom name like "p0", or header pin like "j27".
+// Return -1 for unknown names.
+//
+int gpio_pin_by_name(const char *name);
+
 //
 // Set pin direction or alternative function.
+// Return -1 when the pin has no such function.
 //
 int gpio_set_mode(int pin, gpio_mode_t dir);
 
@@ -172,9 +242,15 @@ int gpio_write(int pin, int value);
 int gpio_toggle(int pin);
 
 //
-// Enable debug output.
+// The same pin operations by handle of gpio_open().  They fail with
+// EBADF on a null handle and with EINVAL on a malformed pin descriptor,
+// and never map registers behind the caller's back.
 //
-extern int gpio_debug;
+int gpio_h_read(const gpio_t *h, int pin);
+int gpio_h_write(const gpio_t *h, int pin, int value);
+int gpio_h_toggle(const gpio_t *h, int pin);
+int gpio_h_set_mode(const gpio_t *h, int pin, gpio_mode_t mode);
+int gpio_h_set_pull(const gpio_t *h, int pin, gpio_pull_t pull);
 
 //
 // Calculate register offset by port name.
@@ -190,8 +266,1291 @@ extern int gpio_debug;
                            port == 'J' ? 0x800 : 0x900)
 #define GPIO_PIN(port, bitnum) ((GPIO_OFFSET(port) << 16) | (1 << bitnum))
 
+//
+// Get port letter and bit mask of a pin descriptor.
+//
+#define GPIO_PORT(pin)  ("ABCDEFGHJK"[(pin) >> 24])
+#define GPIO_MASK(pin)  ((pin) & 0xffff)
+#define GPIO_NPORTS     10
+
+//
+// Virtual pins: bits of shift register chains.
+//
+#define GPIO_VIRTUAL            0x40000000
+#define GPIO_VPIN(chain, bit)   (GPIO_VIRTUAL | (chain) << 16 | (bit))
+#define GPIO_VPIN_CHAIN(pin)    (((pin) >> 16) & 0xff)
+#define GPIO_VPIN_BIT(pin)      ((pin) & 0xffff)
+
+int gpio_vpin_read(int pin);
+int gpio_vpin_write(int pin, int value);
+int gpio_vpin_toggle(int pin);
+gpio_mode_t gpio_vpin_mode(int pin);
+
+//
+// Control registers of a port.
+// Every register has CLR, SET and INV companions: writing a mask
+// to them clears, sets or inverts the masked bits in one bus cycle.
+//
+struct gpioreg {
+    volatile unsigned ansel;        // Analog select
+    volatile unsigned anselclr;
+    volatile unsigned anselset;
+    volatile unsigned anselinv;
+    volatile unsigned tris;         // Mask of inputs
+    volatile unsigned trisclr;
+    volatile unsigned trisset;
+    volatile unsigned trisinv;
+    volatile unsigned port;         // Read inputs, write outputs
+    volatile unsigned portclr;
+    volatile unsigned portset;
+    volatile unsigned portinv;
+    volatile unsigned lat;          // Read/write outputs
+    volatile unsigned latclr;
+    volatile unsigned latset;
+    volatile unsigned latinv;
+    volatile unsigned odc;          // Open drain configuration
+    volatile unsigned odcclr;
+    volatile unsigned odcset;
+    volatile unsigned odcinv;
+    volatile unsigned cnpu;         // Input pin pull-up enable
+    volatile unsigned cnpuclr;
+    volatile unsigned cnpuset;
+    volatile unsigned cnpuinv;
+    volatile unsigned cnpd;         // Input pin pull-down enable
+    volatile unsigned cnpdclr;
+    volatile unsigned cnpdset;
+    volatile unsigned cnpdinv;
+    volatile unsigned cncon;        // Interrupt-on-change control
+    volatile unsigned cnconclr;
+    volatile unsigned cnconset;
+    volatile unsigned cnconinv;
+    volatile unsigned cnen;         // Input change interrupt enable
+    volatile unsigned cnenclr;
+    volatile unsigned cnenset;
+    volatile unsigned cneninv;
+    volatile unsigned cnstat;       // Change notification status
+    volatile unsigned cnstatclr;
+    volatile unsigned cnstatset;
+    volatile unsigned cnstatinv;
+    volatile unsigned unused[6*4];
+};
+
+//
+// Get control registers of a port, for direct access.
+// Port is given by letter, 'A'...'K'.
+//
+struct gpioreg *gpio_port_reg(int port);
+
+//
+// Lock or unlock a port for a read-modify-write sequence
+// of register accesses.  Port is given by letter, 'A'...'K'.
+//
+int gpio_port_lock(int port);
+int gpio_port_unlock(int port);
+
+//
+// Write output values of a set of pins of a port, at once.
+// Pins not in the mask are left untouched.
+//
+int gpio_write_port(int port, unsigned mask, unsigned value);
+
+//
+// Fast pin operations by handle, compiled inline into the caller.
+// No checks are made: the pin must be a real port pin, not a virtual one,
+// and the handle must be open.  Registers are LAT, LATCLR, LATSET, LATINV
+// in a row, so the write selects LATCLR or LATSET by value without a branch.
+//
+static inline struct gpioreg *gpio_fast_reg(const gpio_t *h, int pin)
+{
+    return (struct gpioreg*) (h->base + ((unsigned) pin >> 16));
+}
+
+static inline int gpio_fast_read(const gpio_t *h, int pin)
+{
+    return (gpio_fast_reg(h, pin)->port & GPIO_MASK(pin)) != 0;
+}
+
+static inline void gpio_fast_write(const gpio_t *h, int pin, int value)
+{
+    (&gpio_fast_reg(h, pin)->latclr)[value & 1] = GPIO_MASK(pin);
+}
+
+static inline void gpio_fast_set(const gpio_t *h, int pin)
+{
+    gpio_fast_reg(h, pin)->latset = GPIO_MASK(pin);
+}
+
+static inline void gpio_fast_clear(const gpio_t *h, int pin)
+{
+    gpio_fast_reg(h, pin)->latclr = GPIO_MASK(pin);
+}
+
+static inline void gpio_fast_toggle(const gpio_t *h, int pin)
+{
+    gpio_fast_reg(h, pin)->latinv = GPIO_MASK(pin);
+}
+
+//
+// Control registers of a timer.
+//
+struct tmrreg {
+    volatile unsigned con;          // Control
+    volatile unsigned conclr;
+    volatile unsigned conset;
+    volatile unsigned coninv;
+    volatile unsigned tmr;          // Counter
+    volatile unsigned tmrclr;
+    volatile unsigned tmrset;
+    volatile unsigned tmrinv;
+    volatile unsigned pr;           // Period
+    volatile unsigned prclr;
+    volatile unsigned prset;
+    volatile unsigned prinv;
+};
+
+#define GPIO_TCON_ON    (1 << 15)   // Timer enable
+#define GPIO_TCON_T32   (1 << 3)    // Timers 2/3, 4/5, 6/7, 8/9 as one 32-bit timer
+#define GPIO_TCON_TCS   (1 << 1)    // Clock from TxCK pin
+
+//
+// Get control registers of timer 1...9, or 0 on failure.
+//
+struct tmrreg *gpio_timer_reg(int n);
+
+//
+// Snapshot of the control registers of one port.
+//
+typedef struct {
+    unsigned ansel;         // Analog select
+    unsigned tris;          // Mask of inputs
+    unsigned port;          // Input values
+    unsigned lat;           // Output latch
+    unsigned odc;           // Open drain configuration
+    unsigned cnpu;          // Pull-up enable
+    unsigned cnpd;          // Pull-down enable
+    unsigned cncon;         // Interrupt-on-change control
+    unsigned cnen;          // Input change interrupt enable
+    unsigned cnstat;        // Change notification status
+} gpio_port_state_t;
+
+//
+// Read all control registers of a port at once.
+// Port is given by letter, 'A'...'K'.
+//
+int gpio_get_port_state(int port, gpio_port_state_t *state);
+
+//
+// Read input values of all pins of a port.
+//
+unsigned gpio_read_port(int port);
+
+//
+// Enable or disable change notification for a set of pins of a port.
+// Disabling the last enabled pin turns off notification for the port.
+//
+int gpio_enable_change(int port, unsigned mask);
+int gpio_disable_change(int port, unsigned mask);
+
+//
+// Read change notification status of a port: a mask of pins
+// which changed since the last read of the port.
+//
+unsigned gpio_read_change(int port);
+
+//
+// Get pin direction or alternative function from a port snapshot.
+// Only the PPS mapping is read from the hardware.
+//
+gpio_mode_t gpio_get_state_mode(int pin, const gpio_port_state_t *state);
+
+//
+// Callback for input events: pin descriptor and new value.
+// Return nonzero to stop the event loop.
+//
+typedef int gpio_event_func_t(int pin, int value, void *arg);
+
+//
+// Debounce filter for inputs of one port.
+// Every pin has a counter of samples, which differ from the stable state.
+// Counters are kept "vertically": bit N of all 16 counters is stored
+// in count[N], so a sample of the whole port is processed by a few
+// bitwise operations.  The per-pin limits are sliced the same way.
+// With 4-bit counters, integration is capped at GPIO_DEBOUNCE_MAX
+// (15) samples; larger counts fail with EINVAL.  For longer times,
+// sample with a longer period.
+//
+#define GPIO_DEBOUNCE_BITS  4
+#define GPIO_DEBOUNCE_MAX   ((1 << GPIO_DEBOUNCE_BITS) - 1)
+
+typedef struct {
+    int      port;                          // Port letter
+    unsigned mask;                          // Pins being filtered
+    unsigned state;                         // Debounced state
+    unsigned count[GPIO_DEBOUNCE_BITS];     // Vertical sample counters
+    unsigned limit[GPIO_DEBOUNCE_BITS];     // Vertical per-pin limits
+} gpio_debounce_t;
+
+//
+// Start filtering a given set of pins of a port.
+// The current input values become the stable state.
+// With port 0, the filter is for arbitrary bits with initial state zero.
+//
+int gpio_debounce_init(gpio_debounce_t *db, int port, unsigned mask, int nsamples);
+
+//
+// Set the number of consecutive samples (1...GPIO_DEBOUNCE_MAX),
+// required to change the stable state of a pin.
+//
+int gpio_debounce_set_samples(gpio_debounce_t *db, int pin, int nsamples);
+
+//
+// Process a sample of the port.
+// Return a mask of pins which changed their stable state.
+//
+unsigned gpio_debounce_update(gpio_debounce_t *db, unsigned sample);
+
+//
+// Read the port and process the sample.
+//
+unsigned gpio_debounce_poll(gpio_debounce_t *db);
+
+//
+// Sample a set of debounce filters with a given period,
+// and call func() for every change of a stable state.
+// Return when func() returns nonzero.
+//
+int gpio_debounce_run(gpio_debounce_t *db, int ndb, unsigned period_usec,
+                      gpio_event_func_t *func, void *arg);
+
+//
+// Quadrature encoder on a pair of pins.
+// Position, velocity and error count are updated by a single sampling
+// thread and can be read by any thread without locking,
+// using gpio_encoder_position() etc.
+//
+typedef struct {
+    int      pin_a;             // Channel A
+    int      pin_b;             // Channel B
+    unsigned state;             // Last AB state, 2 bits
+    int32_t  position;          // Counts
+    int32_t  velocity;          // Counts per second
+    uint32_t errors;            // Invalid transitions or missed edges
+    int32_t  last_position;     // For velocity calculation
+    uint64_t last_time;
+    int      ia, ib;            // Index of A and B ports in the group
+} gpio_encoder_t;
+
+//
+// Group of encoders, decoded in the same pass.
+//
+typedef struct {
+    gpio_encoder_t *enc;        // Array of encoders
+    int      nenc;
+    unsigned period_usec;       // Sampling period, or 0 to spin
+    int      use_change;        // Use change notification status
+    int      nports;            // Ports used by the encoders
+    char     port[GPIO_NPORTS];
+    unsigned mask[GPIO_NPORTS];
+    volatile int stop;          // Set to stop the sampling thread
+    pthread_t thread;
+} gpio_encoder_group_t;
+
+//
+// Configure pins of encoder as inputs and get the initial state.
+//
+int gpio_encoder_init(gpio_encoder_t *enc, int pin_a, int pin_b);
+
+//
+// Prepare a group of encoders for sampling.
+//
+int gpio_encoder_group_init(gpio_encoder_group_t *grp, gpio_encoder_t *enc, int nenc,
+                            unsigned period_usec, int use_change);
+
+//
+// Sample all ports of the group once and update every encoder.
+//
+void gpio_encoder_sample(gpio_encoder_group_t *grp);
+
+//
+// Start or stop a thread, which samples the group periodically.
+//
+int gpio_encoder_start(gpio_encoder_group_t *grp);
+void gpio_encoder_stop(gpio_encoder_group_t *grp);
+
+//
+// Lock-free access to the encoder values.
+//
+#define gpio_encoder_position(enc) __atomic_load_n(&(enc)->position, __ATOMIC_RELAXED)
+#define gpio_encoder_velocity(enc) __atomic_load_n(&(enc)->velocity, __ATOMIC_RELAXED)
+#define gpio_encoder_errors(enc)   __atomic_load_n(&(enc)->errors, __ATOMIC_RELAXED)
+
+//
+// 1-Wire bus master on one pin.
+// The pin is driven as open drain: low by LAT=0, released by LAT=1;
+// the bus needs an external pull-up resistor.
+//
+typedef struct {
+    struct gpioreg *reg;        // Port registers
+    unsigned mask;              // Pin mask
+    uint8_t  rom[8];            // Last ROM found by search
+    int      last_discrepancy;  // Search state
+    int      last_device;
+} gpio_onewire_t;
+
+//
+// Configure the pin for 1-Wire bus.
+//
+int gpio_onewire_init(gpio_onewire_t *ow, int pin);
+
+//
+// Send a reset pulse.  Return 1 when a presence pulse is detected.
+//
+int gpio_onewire_reset(gpio_onewire_t *ow);
+
+//
+// Write or read bits and bytes.
+//
+void gpio_onewire_write_bit(gpio_onewire_t *ow, int bit);
+int gpio_onewire_read_bit(gpio_onewire_t *ow);
+void gpio_onewire_write(gpio_onewire_t *ow, unsigned byte);
+unsigned gpio_onewire_read(gpio_onewire_t *ow);
+
+//
+// Compute Dallas/Maxim CRC8 of data.
+//
+unsigned gpio_onewire_crc8(const uint8_t *data, int nbytes);
+
+//
+// Find ROM codes of all devices on the bus.
+// Return the number of devices found, up to maxdev.
+//
+int gpio_onewire_search(gpio_onewire_t *ow, uint8_t (*rom)[8], int maxdev);
+
+//
+// Start temperature conversion on all sensors at once, wait for completion,
+// then read every sensor from the list.  Temperature is in 1/16 degrees C;
+// a sensor with a bad CRC gets GPIO_ONEWIRE_NOTEMP.
+// Return the number of sensors read successfully, or -1 when no bus.
+//
+#define GPIO_ONEWIRE_NOTEMP (-32768)
+
+int gpio_onewire_read_temps(gpio_onewire_t *ow, uint8_t (*rom)[8], int ndev, int *temp);
+
+//
+// Strip of WS2812 addressable LEDs, driven by SPI output.
+// Pixels are encoded into SPI bit patterns in the back buffer;
+// the front buffer is sent by a separate thread.
+//
+typedef struct {
+    struct spireg *spi;         // SPI registers
+    int      sdo;               // SPI port number, 1...6
+    int      npixels;
+    unsigned nbytes;            // Size of encoded frame
+    uint8_t *frame[2];          // Encoded frames
+    int      back;              // Index of back buffer
+    int      pending;           // Front buffer is not sent yet
+    int      stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t thread;
+} gpio_leds_t;
+
+#define GPIO_LEDS_MAX   10000   // Pixels per strip, 0.3 sec per frame
+
+//
+// Route SPI output to a given pin and prepare a strip of LEDs.
+// Return -1 when the pin has no SDO function, or the number
+// of pixels is not 1...GPIO_LEDS_MAX.
+//
+int gpio_leds_open(gpio_leds_t *leds, int pin, int npixels);
+
+//
+// Set color 0xRRGGBB of a pixel in the back buffer.
+//
+void gpio_leds_set(gpio_leds_t *leds, int index, unsigned rgb);
+
+//
+// Show the back buffer: wait for the previous frame, swap buffers
+// and start transmission.
+//
+void gpio_leds_show(gpio_leds_t *leds);
+
+//
+// Wait for the last frame and release the SPI port.
+//
+void gpio_leds_close(gpio_leds_t *leds);
+
+//
+// Chain of shift registers on three pins of the same port:
+// 74HC595 for outputs, or 74HC165 for inputs.
+//
+#define GPIO_SHIFT_MAXBITS 256
+
+typedef struct {
+    struct gpioreg *reg;        // Port registers
+    int      port;              // Port letter, for gpio_port_lock()
+    unsigned data;              // Mask of data pin: SER or QH
+    unsigned clock;             // Mask of clock pin
+    unsigned latch;             // Mask of latch pin: RCLK or SH/LD
+    unsigned clr_mask[2];       // LATxCLR value per data bit
+    unsigned set_mask[2];       // LATxSET value per data bit
+    int      nbits;             // Length of chain, multiple of 8
+    int      input;             // Input chain
+    int      valid;             // Frame was sent at least once
+    uint8_t  out[GPIO_SHIFT_MAXBITS/8];     // Output frame
+    uint8_t  sent[GPIO_SHIFT_MAXBITS/8];    // Last frame sent
+    uint8_t  in[GPIO_SHIFT_MAXBITS/8];      // Last frame read
+} gpio_shift_t;
+
+//
+// Prepare a chain of shift registers.  All pins must be on the same port.
+// Bit 0 is the first output (QA or A) of the register nearest to processor.
+//
+int gpio_shift_init(gpio_shift_t *sh, int data_pin, int clock_pin, int latch_pin,
+                    int nbits, int input);
+
+//
+// Send the output frame, unless it is the same as the last one.
+// Return 1 when the frame was sent.
+//
+int gpio_shift_update(gpio_shift_t *sh);
+
+//
+// Read the input frame.
+//
+void gpio_shift_read(gpio_shift_t *sh);
+
+//
+// Set a bit of the output frame, or get a bit of the frame.
+//
+void gpio_shift_set(gpio_shift_t *sh, int bit, int value);
+int gpio_shift_get(gpio_shift_t *sh, int bit);
+
+//
+// Make bits of the chain accessible as virtual pins GPIO_VPIN(chain, bit),
+// for gpio_read(), gpio_write() and gpio_toggle().
+// Return the chain number, or -1 when too many chains.
+//
+int gpio_shift_register(gpio_shift_t *sh);
+void gpio_shift_unregister(gpio_shift_t *sh);
+
+//
+// HD44780 character display, up to 4 rows of 40 characters.
+// Text is put into the framebuffer; only changed cells are sent
+// to the display by gpio_lcd_update().
+//
+typedef struct {
+    int      rows, cols;
+    int      rs, rw, e;         // Control pins; rw is -1 when not connected
+    int      nbits;             // Data width: 4 or 8
+    int      nports;            // Ports of data pins
+    char     port[4];
+    struct gpioreg *reg[4];
+    unsigned mask[4];           // Data pins of every port
+    int      dport[8];          // Port index of every data pin
+    unsigned dmask[8];          // Mask of every data pin
+    unsigned addr;              // Current DDRAM address
+    char     shadow[4][40];     // Framebuffer
+    char     shown[4][40];      // Contents of the display
+} gpio_lcd_t;
+
+//
+// Initialize the display.  Data pins are D0...D7, or D4...D7 in 4-bit mode,
+// on at most four ports.  RW is -1 when tied to ground.
+//
+int gpio_lcd_init(gpio_lcd_t *lcd, int rows, int cols,
+                  int rs, int rw, int e, const int *data, int nbits);
+
+//
+// Clear the framebuffer, or put text into it.
+//
+void gpio_lcd_clear(gpio_lcd_t *lcd);
+void gpio_lcd_print(gpio_lcd_t *lcd, int row, int col, const char *text);
+
+//
+// Send changed cells to the display.  Return the number of cells sent.
+//
+int gpio_lcd_update(gpio_lcd_t *lcd);
+
+//
+// Matrix keypad, up to 8 rows and 8 columns.
+// The active row is driven low by clearing its TRIS bit, other rows
+// are tristated.  Columns are inputs with pull-ups, read as whole ports.
+// Key states are debounced in groups of 16 keys.
+//
+#define GPIO_KEYPAD_MAX 8
+
+typedef struct {
+    int      nrows, ncols;
+    int      row[GPIO_KEYPAD_MAX];          // Row pins
+    int      col[GPIO_KEYPAD_MAX];          // Column pins
+    struct gpioreg *row_reg[GPIO_KEYPAD_MAX];
+    int      ncports;                       // Ports of column pins
+    char     cport[GPIO_KEYPAD_MAX];
+    unsigned cmask[GPIO_KEYPAD_MAX];        // Column pins of every port
+    uint64_t state;                         // Debounced keys, bit row*ncols+col
+    uint64_t raw;                           // Last scan, not debounced
+    gpio_debounce_t db[4];
+} gpio_keypad_t;
+
+//
+// Callback for key events.  Return nonzero to stop the event loop.
+//
+typedef int gpio_key_func_t(int row, int col, int pressed, void *arg);
+
+//
+// Configure pins of keypad.  A key needs nsamples equal scans
+// to change state.
+//
+int gpio_keypad_init(gpio_keypad_t *kp, const int *row, int nrows,
+                     const int *col, int ncols, int nsamples);
+
+//
+// Scan all rows once.  Return a mask of pressed keys, not debounced.
+//
+uint64_t gpio_keypad_scan(gpio_keypad_t *kp);
+
+//
+// Scan and debounce.  Return a mask of keys, which changed state.
+//
+uint64_t gpio_keypad_poll(gpio_keypad_t *kp);
+
+//
+// Scan with a given period and call func() for every key event.
+// When all keys are released, scanning stops until a change
+// notification comes from the columns.
+//
+int gpio_keypad_run(gpio_keypad_t *kp, unsigned period_usec,
+                    gpio_key_func_t *func, void *arg);
+
+//
+// Stepper motor with step/dir driver.
+// A move is precomputed into a table of step intervals; several axes
+// are then stepped together in one pass.  When the step pin has
+// an output compare function, pulses are generated by the OC module
+// at exact timer counts, and software only needs to arm it in advance.
+//
+typedef enum {
+    GPIO_PROFILE_TRAPEZOID,     // Constant acceleration
+    GPIO_PROFILE_SCURVE,        // Smooth acceleration, limited jerk
+} gpio_profile_t;
+
+typedef struct {
+    int      step, dir;         // Pins
+    struct gpioreg *reg;        // Port of step pin
+    int      oc;                // Output compare unit 1...9, or 0
+    struct ocreg *ocreg;
+    int32_t  position;          // Current position in steps
+    int      direction;         // +1 or -1 for planned move
+    unsigned nsteps;            // Steps in planned move
+    uint32_t *interval;         // Time from previous step, nsec
+    unsigned next;              // Index of next step
+    uint64_t due;               // Time of next step
+    uint32_t late_ns;           // Max lateness during the last move
+} gpio_stepper_t;
+
+//
+// Configure step and dir pins.  Take a free OC unit,
+// when the step pin has one and Timer2/3 is not in use by
+// somebody else; otherwise steps are timed in software.
+//
+int gpio_stepper_init(gpio_stepper_t *st, int step, int dir);
+
+//
+// Plan a relative move by a given number of steps.
+// Speed is in steps/sec, acceleration in steps/sec^2.
+//
+int gpio_stepper_plan(gpio_stepper_t *st, int32_t steps, double speed,
+                      double accel, gpio_profile_t profile);
+
+//
+// Execute planned moves of several axes together.
+// Return when all axes are finished.
+//
+int gpio_stepper_run(gpio_stepper_t *axis, int naxes);
+
+//
+// Release the step table and the OC unit.
+//
+void gpio_stepper_close(gpio_stepper_t *st);
+
+//
+// Analog inputs.  Pins must be in MODE_ANALOG.
+// Single reads and continuous scan should not be used at the same time.
+//
+#define GPIO_ADC_MAXSCAN 16
+
+//
+// Get analog input number of a pin, or -1 when the pin has none.
+//
+int gpio_adc_channel(int pin);
+
+//
+// Convert one analog input.  Return 12-bit value, or -1 on error.
+//
+int gpio_adc_read(int channel);
+
+//
+// Continuous scan.  The scan thread puts frames into a ring,
+// which is read without locks by a single consumer.
+// Head and tail are on separate cache lines.
+//
+typedef struct {
+    uint64_t time_ns;                       // Time of scan trigger
+    uint16_t value[GPIO_ADC_MAXSCAN];       // In order of channels
+} gpio_adc_frame_t;
+
+typedef struct {
+    int      nchan;
+    int      channel[GPIO_ADC_MAXSCAN];
+    unsigned period_usec;
+    gpio_adc_frame_t *ring;
+    unsigned size;                          // Power of two
+    unsigned overruns;                      // Frames dropped by full ring
+    volatile int stop;
+    pthread_t thread;
+    unsigned head __attribute__((aligned(64)));  // Written by scan thread
+    unsigned tail __attribute__((aligned(64)));  // Written by reader
+} gpio_adc_scan_t;
+
+//
+// Start continuous scan of several analog inputs at a given rate.
+//
+int gpio_adc_scan_start(gpio_adc_scan_t *scan, const int *channel, int nchan,
+                        unsigned rate_hz, unsigned nframes);
+
+//
+// Get the next frame from the ring.  Return 0 when the ring is empty.
+//
+int gpio_adc_scan_get(gpio_adc_scan_t *scan, gpio_adc_frame_t *frame);
+
+//
+// Stop the scan and free the ring.
+//
+void gpio_adc_scan_stop(gpio_adc_scan_t *scan);
+
+//
+// Frequency counter: a timer is clocked from a pin through TxCK,
+// and its count is read at both ends of a gate window.
+// Timers 2, 4, 6, 8 count in 32 bits; odd timers count in 16 bits
+// and are read every millisecond to extend the count.
+//
+typedef struct {
+    int      pin;
+    int      timer;             // Timer 2...9
+    int      bits;              // Width of the counter, 16 or 32
+    struct tmrreg *tmr;
+    unsigned last;              // Last counter value
+    uint64_t count;             // Extended count
+    uint64_t time_ns;           // Time of last read
+    unsigned uncert_ns;         // Uncertainty of the time
+} gpio_freq_t;
+
+//
+// Route a pin to a free timer clock input, and start counting.
+// Return -1 when no timer is available for this pin.
+//
+int gpio_freq_open(gpio_freq_t *fc, int pin);
+
+//
+// Count for a given window, right after the previous one.
+// Get the frequency and its error bound, in Hz.
+//
+int gpio_freq_measure(gpio_freq_t *fc, unsigned window_usec, double *hz, double *err);
+
+//
+// Stop the timer and release the pin.
+//
+void gpio_freq_close(gpio_freq_t *fc);
+
+//
+// External interrupt inputs INT1...INT4, polled without interrupts.
+// The hardware latches an edge in the flag register, so pulses
+// shorter than the polling period are not lost; several edges
+// between two polls are counted as one.
+//
+typedef enum {
+    GPIO_EDGE_FALLING,
+    GPIO_EDGE_RISING,
+    GPIO_EDGE_BOTH,             // Polarity is flipped after every edge
+} gpio_edge_t;
+
+typedef struct {
+    unsigned mask;              // Flags in use
+    int      pin[4];            // Pins of INT1...INT4
+    gpio_edge_t edge[4];
+    int      level[4];          // Level after the last edge
+    uint64_t count[4];          // Number of events
+    uint64_t time_ns[4];        // Time of the last event
+    uint64_t max_latency_ns[4]; // Longest time from poll to poll with event
+    uint64_t last_poll;
+} gpio_extint_t;
+
+//
+// Route a pin to a free input INT1...INT4 and set the edge.
+// The structure must be zeroed before the first call.
+// Return the input number, or -1 on error.
+//
+int gpio_extint_add(gpio_extint_t *ei, int pin, gpio_edge_t edge);
+
+//
+// Check and clear the flags once.  Return a mask of inputs
+// with events, bit 0 for INT1.
+//
+unsigned gpio_extint_poll(gpio_extint_t *ei);
+
+//
+// Poll with a given period (0 for a tight loop), and call
+// func() for every event.  Return when func() returns nonzero.
+//
+int gpio_extint_run(gpio_extint_t *ei, unsigned period_usec,
+                    gpio_event_func_t *func, void *arg);
+
+//
+// Result of waiting for an edge.
+//
+typedef struct {
+    gpio_edge_t edge;           // Edge seen; BOTH for a pulse between polls
+    int      level;             // Pin level at detection
+    int      spinning;          // Detected in the spin phase
+    uint64_t time_ns;           // Time of detection
+    uint64_t latency_ns;        // Upper bound of delay: time since the previous sample
+} gpio_wait_result_t;
+
+//
+// Wait for an edge on a pin, or until timeout (negative for none).
+// Spin on the port register for spin_usec, then poll change
+// notification status with exponentially growing sleeps.
+// Return 1 on edge, 0 on timeout, -1 on error.
+//
+int gpio_wait_edge(int pin, gpio_edge_t edge, int timeout_msec,
+                   unsigned spin_usec, gpio_wait_result_t *result);
+
+//
+// Wait for change notification on any pin of a set, or until
+// timeout (negative for none).  Ports are given by letters,
+// with a mask of pins for each; change notification must be
+// enabled for them.  The status is polled with exponentially
+// growing sleeps.  Return 1 on change, 0 on timeout.
+//
+int gpio_wait_change(const char *port, const unsigned *mask, int nports, int timeout_msec);
+
+//
+// Pin configuration of the whole chip: port registers
+// and PPS (peripheral pin select) registers.
+//
+#define GPIO_PPS_FIRST  0x1404      // Offset of INT1R
+#define GPIO_PPS_LAST   0x16a4      // Offset of RPG9R
+#define GPIO_PPS_NREGS  ((GPIO_PPS_LAST - GPIO_PPS_FIRST) / 4 + 1)
+
+typedef struct {
+    unsigned ansel;             // Analog select
+    unsigned tris;              // Mask of inputs
+    unsigned lat;               // Output latch
+    unsigned odc;               // Open drain configuration
+    unsigned cnpu;              // Pull-up enable
+    unsigned cnpd;              // Pull-down enable
+} gpio_port_config_t;
+
+typedef struct {
+    gpio_port_config_t port[GPIO_NPORTS];
+    uint8_t  pps[GPIO_PPS_NREGS];   // Indexed by (offset - GPIO_PPS_FIRST) / 4
+} gpio_config_t;
+
+//
+// Read the live configuration.
+//
+int gpio_config_read(gpio_config_t *cfg);
+
+//
+// Write only the registers which differ from the live configuration.
+// Return the number of register writes, or -1 on error.
+//
+int gpio_config_apply(const gpio_config_t *cfg);
+
+//
+// Change a configuration like gpio_set_mode() and gpio_set_pull()
+// change the hardware.
+//
+int gpio_config_set_mode(gpio_config_t *cfg, int pin, gpio_mode_t mode);
+int gpio_config_set_pull(gpio_config_t *cfg, int pin, gpio_pull_t pull);
+
+//
+// Get name of PPS register by offset, or 0 for unused offsets.
+//
+const char *gpio_pps_name(int offset);
+
+//
+// Set pin mapping in an image of PPS registers, as gpio_set_mode() would.
+//
+int gpio_pps_set_mode(uint8_t *pps, int pin, gpio_mode_t mode);
+
+//
+// Pin sequences: a small language compiled into bytecode,
+// which is executed with direct register access.
+// See seq.c for the syntax.
+//
+typedef struct {
+    uint32_t *code;             // Bytecode
+    unsigned ncode, maxcode;    // Words used and allocated
+    unsigned out[GPIO_NPORTS];  // Output pins of every port
+    unsigned in[GPIO_NPORTS];   // Input pins of every port
+    int32_t  reg[8];            // Counter registers r0...r7
+    unsigned used;              // Mask of registers in use
+    const char *error;          // Compile error message
+    int      error_line;
+    int      cpu;               // CPU for gpio_seq_run()
+    int      status;
+} gpio_seq_t;
+
+//
+// Compile a program text.  On error, return -1 and set
+// error message and line number.
+//
+int gpio_seq_compile(gpio_seq_t *seq, const char *text);
+
+//
+// Execute the program in the calling thread.
+//
+int gpio_seq_exec(gpio_seq_t *seq);
+
+//
+// Execute the program on a real-time thread, bound to
+// a given CPU (negative for any), and wait for completion.
+//
+int gpio_seq_run(gpio_seq_t *seq, int cpu);
+
+//
+// Free the bytecode.
+//
+void gpio_seq_free(gpio_seq_t *seq);
+
+//
+// Parse a duration like "10us": units ns, us, ms or s,
+// default microseconds.  Return nanoseconds, or -1 on error.
+//
+int64_t gpio_parse_time(const char *str);
+
+//
+// Capture of port samples to a file.  The file has a header,
+// followed by frames: one 16-bit PORT value per captured port.
+// Samples are taken by the calling thread and written
+// to the file by a background thread, through a ring.
+//
+// A triggered capture writes only segments around the triggers:
+// pretrigger frames, the frame of the trigger and posttrigger frames.
+//
+#define GPIO_CAPTURE_MAGIC      "PIC32CAP"
+#define GPIO_CAPTURE_VERSION    1
+
+#define GPIO_CAPTURE_TRIGGERED  0x0001  // File has segments around triggers
+
+#define GPIO_CAPTURE_NTRIG      64      // Triggers queued for the writer
+
+typedef struct {
+    char     magic[8];          // GPIO_CAPTURE_MAGIC, not terminated
+    uint32_t version;
+    uint32_t nports;            // Ports in every frame
+    char     port[GPIO_NPORTS]; // Port letters, in frame order
+    uint16_t flags;             // GPIO_CAPTURE_xxx
+    uint32_t period_ns;         // Sampling period
+    uint64_t start_ns;          // Time of the first sample
+    uint64_t nsamples;          // Number of frames
+    uint32_t pretrigger;        // Frames before trigger in a segment
+    uint32_t posttrigger;       // Frames after trigger in a segment
+    uint64_t ntriggers;         // Number of segments
+} gpio_capture_header_t;
+
+//
+// Trigger condition, per port, indexed like gpio_port_reg():
+// all pins in mask must have the levels given by value, and
+// when any rise or fall bits are set, one of these pins must
+// have that edge in the sample.
+//
+typedef struct {
+    uint16_t mask[GPIO_NPORTS];
+    uint16_t value[GPIO_NPORTS];
+    uint16_t rise[GPIO_NPORTS];
+    uint16_t fall[GPIO_NPORTS];
+} gpio_trigger_t;
+
+typedef struct {
+    gpio_capture_header_t hdr;
+    int      fd;                // Output file
+    struct gpioreg *reg[GPIO_NPORTS];
+    uint16_t *ring;             // Frames on the way to the file
+    unsigned size;              // Ring size in frames, a power of two
+    unsigned head __attribute__((aligned(64)));  // Written by sampler
+    unsigned tail __attribute__((aligned(64)));  // Written by writer thread
+    volatile int stop;          // Set to stop sampling
+    volatile int done;          // Sampling finished, flush the ring
+    int      error;             // Write error of the writer thread
+    uint64_t written;           // Frames written
+    uint64_t late;              // Samples taken a period or more late
+    uint64_t taken;             // Samples taken
+    uint64_t end_ns;            // Time of the last sample
+    pthread_t writer;
+
+    // Trigger, in frame order.
+    uint16_t tmask[GPIO_NPORTS], tvalue[GPIO_NPORTS];
+    uint16_t trise[GPIO_NPORTS], tfall[GPIO_NPORTS];
+    int      tedges;            // Some edge is required
+    int      tmatched;          // Level condition held at the last sample
+    unsigned trig[GPIO_CAPTURE_NTRIG];  // Ring frame numbers of triggers
+    unsigned thead;             // Written by sampler
+    unsigned ttail;             // Written by writer thread
+} gpio_capture_t;
+
+//
+// Prepare capture of ports, given by letters like "BD", to a file.
+// Period 0 means sampling as fast as possible.
+//
+int gpio_capture_open(gpio_capture_t *cap, int fd, const char *ports, unsigned period_ns);
+
+//
+// Write only segments around triggers: pre frames before
+// and post frames after every sample matching the condition.
+// A condition without edges triggers when it becomes true.
+// Call after gpio_capture_open(), before any samples are taken.
+// A trigger needs pre frames of history, so triggers
+// closer than that to the previous segment are ignored.
+// The history is kept in the ring, so pre must be less
+// than half of it.
+//
+int gpio_capture_trigger(gpio_capture_t *cap, const gpio_trigger_t *trig,
+                         unsigned pre, unsigned post);
+
+//
+// Take samples until nsamples are taken (0 for no limit)
+// or cap->stop is set.  Return -1 on write error.
+//
+int gpio_capture_run(gpio_capture_t *cap, uint64_t nsamples);
+
+//
+// Flush the samples and update the file header.
+//
+int gpio_capture_close(gpio_capture_t *cap);
+
+//
+// Capture file, open for reading.
+//
+typedef struct {
+    const gpio_capture_header_t *hdr;
+    uint64_t nsamples;          // Number of frames
+    uint64_t segment;           // Frames in a triggered segment, or 0
+    int      fd;
+} gpio_capfile_t;
+
+//
+// Window of frames of a capture file, mapped into memory.
+//
+typedef struct {
+    const uint16_t *frames;     // Frame first, of hdr->nports values each
+    uint64_t first, count;      // Frames in the window
+    void    *base;              // Mapping, page aligned
+    size_t   size;
+} gpio_capwin_t;
+
+int gpio_capfile_open(gpio_capfile_t *f, const char *path);
+int gpio_capfile_map(const gpio_capfile_t *f, gpio_capwin_t *w,
+                     uint64_t first, uint64_t count);
+void gpio_capfile_unmap(gpio_capwin_t *w);
+void gpio_capfile_close(gpio_capfile_t *f);
+
+//
+// Protocol decoders over captured samples.  Every decoder runs
+// on its own thread, and is called only for frames where one of
+// its pins changed.
+//
+typedef enum {
+    GPIO_PROTO_UART,            // pin[0] = RX, 8N1, idle high
+    GPIO_PROTO_SPI,             // pin[] = CLK, MOSI, MISO or -1, CS or -1
+    GPIO_PROTO_I2C,             // pin[] = SDA, SCL
+    GPIO_PROTO_ONEWIRE,         // pin[0] = DQ
+} gpio_proto_t;
+
+//
+// Decoded frame.  Time is given by the sample number.
+// Decoders restart at every segment of a triggered capture.
+//
+typedef struct {
+    uint64_t sample;            // Start of the frame
+    uint32_t value;             // Data byte; SPI has MISO in bits 15:8
+    uint8_t  decoder;           // Index of the decoder
+    uint8_t  type;              // GPIO_FRAME_xxx
+    uint8_t  flags;             // GPIO_FLAG_xxx
+    uint8_t  reserved;
+} gpio_frame_t;
+
+#define GPIO_FRAME_DATA         0
+#define GPIO_FRAME_START        1   // I2C start or repeated start
+#define GPIO_FRAME_STOP         2   // I2C stop
+#define GPIO_FRAME_RESET        3   // 1-Wire reset pulse
+#define GPIO_FRAME_PRESENCE     4   // 1-Wire presence pulse
+
+#define GPIO_FLAG_ERROR         0x01    // UART framing error
+#define GPIO_FLAG_NAK           0x02    // I2C byte not acknowledged
+#define GPIO_FLAG_ADDRESS       0x04    // I2C address byte
+#define GPIO_FLAG_MISO          0x08    // SPI frame has MISO byte
+
+typedef struct {
+    gpio_proto_t proto;
+    int      pin[4];            // Pins, see gpio_proto_t
+    unsigned baud;              // UART bit rate
+    int      mode;              // SPI mode 0...3
+
+    gpio_frame_t *frame;        // Decoded frames
+    size_t   nframes, maxframes;
+    uint64_t nedges;            // Frames with a change of decoder pins
+
+    // State of decoding.
+    int      index[4];          // Port index of every pin in the frame
+    unsigned mask[4];           // Bit mask of every pin
+    int      level[4];          // Last levels
+    int      busy;              // Inside of a byte
+    int      nbits;             // Bits received
+    uint32_t value;             // Bits of the byte
+    uint64_t start;             // Sample of the first bit
+    double   bit_samples;       // UART bit time, in samples
+    int      first;             // I2C byte after start
+    int      reset;             // 1-Wire: reset seen, waiting for presence
+    uint64_t byte_start;        // 1-Wire: sample of the first bit
+    int      error;             // Errno of a failure, or 0
+    const gpio_capfile_t *file;
+} gpio_decoder_t;
+
+//
+// Run decoders over a capture file, in parallel.
+// Return -1 with EINVAL when a pin is not in the capture,
+// or with the errno of a decoder which could not read the file
+// or store its frames.
+//
+int gpio_decode(const gpio_capfile_t *f, gpio_decoder_t *dec, int ndec);
+
+//
+// Free decoded frames.
+//
+void gpio_decoder_free(gpio_decoder_t *dec);
+
+//
+// Rules: conditions on input pins, which fire actions on output pins.
+// Conditions are compiled into per-port masks, and actions into
+// LATSET/LATCLR/LATINV writes, evaluated by a polling thread.
+// See rules.c for the syntax.
+//
+#define GPIO_MAX_RULES  64
+#define GPIO_MAX_PULSES 4       // Pulse actions per rule
+
+typedef struct {
+    gpio_trigger_t cond;        // Levels and edges of input pins
+    int      edges;             // Condition has edges
+    int      matched;           // Level condition held at the last sample
+    uint16_t set[GPIO_NPORTS];  // Pins to set, clear and invert
+    uint16_t clr[GPIO_NPORTS];
+    uint16_t inv[GPIO_NPORTS];
+    int      npulses;
+    struct {
+        int      port;
+        uint16_t mask;
+        uint32_t ns;            // Pulse width
+    } pulse[GPIO_MAX_PULSES];
+    int      line;              // Line in the source text
+    uint64_t count;             // Times fired
+} gpio_rule_t;
+
+typedef struct {
+    gpio_rule_t rule[GPIO_MAX_RULES];
+    int      nrules;
+    unsigned in[GPIO_NPORTS];   // Input pins of every port
+    unsigned out[GPIO_NPORTS];  // Output pins of every port
+    unsigned pulsed[GPIO_NPORTS];   // Pins of pulse actions
+    const char *error;          // Compile error message
+    int      error_line;
+    volatile int stop;          // Set to stop execution
+    int      cpu;               // CPU for gpio_rules_run()
+    unsigned period_ns;         // Poll period, 0 to spin
+    int      status;
+    uint64_t nsamples;          // Samples evaluated
+    uint64_t max_gap_ns;        // Longest time between samples
+} gpio_rules_t;
+
+//
+// Compile rules.  On error, return -1 and set
+// error message and line number.
+//
+int gpio_rules_compile(gpio_rules_t *rules, const char *text);
+
+//
+// Evaluate the rules in the calling thread until rules->stop is set.
+// Period 0 means spinning on the port registers; otherwise
+// the ports are polled with this period, and change notification
+// keeps pulses shorter than the period.
+//
+int gpio_rules_exec(gpio_rules_t *rules, unsigned period_ns);
+
+//
+// Evaluate the rules on a separate thread, and wait for it to stop.
+// Given a CPU, the thread runs there at real-time priority;
+// negative CPU leaves it at normal priority, which is the safe
+// choice with period 0.
+//
+int gpio_rules_run(gpio_rules_t *rules, int cpu, unsigned period_ns);
+
+//
+// Statistics of library operations: calls, register accesses
+// and latency histograms, kept per thread and summed on read.
+// Counting is off by default; when off, every operation
+// pays only a test of gpio_stats_enabled.
+//
+typedef enum {
+    GPIO_OP_READ,
+    GPIO_OP_WRITE,
+    GPIO_OP_TOGGLE,
+    GPIO_OP_SET_MODE,
+    GPIO_OP_GET_MODE,
+    GPIO_OP_SET_PULL,
+    GPIO_OP_READ_PORT,
+    GPIO_OP_WRITE_PORT,
+    GPIO_OP_SET_MAPPING,
+    GPIO_OP_GET_MAPPING,
+    GPIO_OP_CLEAR_MAPPING,
+    GPIO_NOPS
+} gpio_op_t;
+
+//
+// Bucket i of a histogram counts latencies below 2^i nsec.
+// The last bucket also holds all longer ones.
+//
+#define GPIO_STATS_NBUCKETS 24
+
+typedef struct {
+    uint64_t calls[GPIO_NOPS];
+    uint64_t accesses[GPIO_NOPS];       // Register reads and writes
+    uint64_t time_ns[GPIO_NOPS];        // Total time
+    uint64_t hist[GPIO_NOPS][GPIO_STATS_NBUCKETS];
+    uint64_t pin_writes[GPIO_NPORTS][16];   // Writes and toggles of every pin
+} gpio_stats_t;
+
+extern int gpio_stats_enabled;
+
+#define GPIO_STATS_START() \
+    (__builtin_expect(gpio_stats_enabled, 0) ? gpio_time_ns() : 0)
+#define GPIO_STATS_END(op, pin, naccesses, t0) \
+    do { if (__builtin_expect(gpio_stats_enabled, 0)) \
+        gpio_stats_count(op, pin, naccesses, t0); } while (0)
+
+//
+// Enable or disable counting.
+//
+void gpio_stats_enable(int on);
+
+//
+// Count one operation, started at time t0.  Pin is -1 when
+// the operation is not for a single pin.
+//
+void gpio_stats_count(gpio_op_t op, int pin, unsigned naccesses, uint64_t t0);
+
+//
+// Sum statistics of all threads.
+//
+void gpio_stats_read(gpio_stats_t *total);
+
+//
+// Get name of an operation, like "write".
+//
+const char *gpio_stats_op_name(gpio_op_t op);
+
+//
+// Write statistics in Prometheus text format.
+//
+void gpio_stats_prometheus(FILE *fd);
+
+//
+// Serve statistics in Prometheus text format on a Unix socket,
+// from a background thread.  A request starting with GET gets
+// an HTTP response, anything else gets the bare text.
+// A socket left at the path by an earlier run is replaced.
+// Return -1 on error, with errno EEXIST when the path is another file.
+//
+int gpio_stats_serve(const char *path);
+
+//
+// Get monotonic time in nanoseconds.
+//
+uint64_t gpio_time_ns(void);
+
+//
+// Advance the deadline by a given period and sleep until it.
+//
+void gpio_sleep_period(struct timespec *deadline, int64_t nsec);
+
+//
+// Wait until a given monotonic time in nanoseconds:
+// sleep first, then spin for the last 100 usec.
+//
+void gpio_wait_until(uint64_t ns);
+
+//
+// Busy wait for a given number of microseconds, using a calibrated loop.
+//
+void gpio_udelay(unsigned usec);
+
+//
+// Lock memory, switch to real-time priority and bind to a given CPU
+// (negative to leave as is).  Return -1 when not permitted.
+//
+int gpio_set_realtime(int cpu);
+
+//
+// Get system clock and peripheral bus clock 1...8 frequency, in Hz.
+//
+unsigned long gpio_sysclk(void);
+unsigned long gpio_pbclk(int bus);
+
+//
+// Sources of reference clock outputs.
+//
+enum {
+    GPIO_REFCLK_SYSCLK,         // System clock
+    GPIO_REFCLK_PBCLK1,         // Peripheral bus clock 1
+    GPIO_REFCLK_POSC,           // Primary oscillator, see GPIO_POSC
+    GPIO_REFCLK_FRC,            // Internal 8 MHz oscillator
+    GPIO_REFCLK_LPRC,           // Internal 32 kHz oscillator
+};
+
+//
+// Enable reference clock output REFCLKO1...REFCLKO4 at the frequency
+// closest to the given, from a given source (negative for the best one).
+// The divider has 1/512 fractional steps.
+// Return the achieved frequency, or -1 on error.
+//
+double gpio_refclk_enable(int refo, int source, double hz);
+
+//
+// Disable reference clock output.
+//
+int gpio_refclk_disable(int refo);
+
+//
+// Map a block of peripheral registers at a given physical address.
+// Every block is mapped only once per process.
+// Return 0 on failure.
+//
+volatile unsigned *gpio_map_sfr(unsigned addr, unsigned nbytes);
+
+//
+// Enable debug output.
+//
+extern int gpio_debug;
+
 gpio_mode_t gpio_get_output_mapping(int pin);
 gpio_mode_t gpio_get_input_mapping(int pin);
 void gpio_clear_mapping(int pin);
-void gpio_set_mapping(int pin, gpio_mode_t mode);
+int gpio_set_mapping(int pin, gpio_mode_t mode);
 int gpio_has_mapping(int pin, gpio_mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPIO_PIC32_H */
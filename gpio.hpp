@@ -0,0 +1,267 @@
+/*
+ * C++ interface for PIC32 GPIO: pins, ports and buses known at compile time.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef GPIO_PIC32_HPP
+#define GPIO_PIC32_HPP
+
+#include "gpio.h"
+
+//
+// Usage:
+//
+//      typedef gpio::Pin<'D', 7>                       Led;
+//      typedef gpio::Bus<gpio::Pin<'B', 0>, gpio::Pin<'B', 1>,
+//                        gpio::Pin<'E', 5>>            Nibble;
+//
+//      gpio_t *h = gpio_open();
+//      Led::mode(MODE_OUTPUT);
+//      Led::toggle(h);
+//      Nibble::write(h, 5);            // Two stores to port B, two to E
+//      Nibble::write<0xa>(h);          // Only the stores with nonzero masks
+//
+// Register offsets and masks are constants, and all functions are inline,
+// so pin operations compile to bare stores to LATxSET/LATxCLR/LATxINV.
+// No checks are made at run time: the handle must be open.
+//
+namespace gpio {
+
+//
+// Check whether a port letter is valid.
+//
+constexpr bool valid_port(char port, const char *ports = "ABCDEFGHJK")
+{
+    return *ports != 0 && (*ports == port || valid_port(port, ports + 1));
+}
+
+//
+// Offset of port registers, as in GPIO_OFFSET().
+//
+constexpr unsigned port_offset(char port)
+{
+    return GPIO_OFFSET(port);
+}
+
+//
+// All pins of one port.
+//
+template <char P>
+struct Port {
+    static_assert(valid_port(P), "No such port");
+
+    static constexpr char     letter = P;
+    static constexpr unsigned offset = port_offset(P);
+
+    static struct gpioreg *reg(const gpio_t *h)
+    {
+        return (struct gpioreg*) (h->base + offset);
+    }
+
+    static unsigned read(const gpio_t *h)           { return reg(h)->port; }
+    static void set(const gpio_t *h, unsigned mask)     { reg(h)->latset = mask; }
+    static void clear(const gpio_t *h, unsigned mask)   { reg(h)->latclr = mask; }
+    static void toggle(const gpio_t *h, unsigned mask)  { reg(h)->latinv = mask; }
+
+    //
+    // Write a set of pins at once, other pins are not touched.
+    //
+    static void write(const gpio_t *h, unsigned mask, unsigned value)
+    {
+        reg(h)->latset = value & mask;
+        reg(h)->latclr = ~value & mask;
+    }
+};
+
+//
+// One pin, like Pin<'D', 7> for RD7.
+//
+template <char P, int Bit>
+struct Pin {
+    static_assert(valid_port(P), "No such port");
+    static_assert(Bit >= 0 && Bit < 16, "Bit number out of range");
+
+    typedef gpio::Port<P> Port;
+
+    static constexpr char     port = P;
+    static constexpr int      bit = Bit;
+    static constexpr unsigned mask = 1u << Bit;
+    static constexpr int      descriptor = GPIO_PIN(P, Bit);
+
+    static int mode(gpio_mode_t mode)   { return gpio_set_mode(descriptor, mode); }
+    static int pull(gpio_pull_t pull)   { return gpio_set_pull(descriptor, pull); }
+
+    static int read(const gpio_t *h)    { return (Port::read(h) >> Bit) & 1; }
+    static void set(const gpio_t *h)    { Port::set(h, mask); }
+    static void clear(const gpio_t *h)  { Port::clear(h, mask); }
+    static void toggle(const gpio_t *h) { Port::toggle(h, mask); }
+
+    //
+    // LATCLR and LATSET follow each other, so no branch is needed.
+    //
+    static void write(const gpio_t *h, int value)
+    {
+        (&Port::reg(h)->latclr)[value & 1] = mask;
+    }
+};
+
+namespace detail {
+
+//
+// Bits of the pins which belong to port P.
+// Bit 0 of a bus value corresponds to the first pin.
+//
+template <char P, class... Pins>
+struct PortBits {
+    static constexpr unsigned mask = 0;
+
+    static constexpr unsigned select(unsigned)  { return 0; }
+    static constexpr unsigned gather(unsigned)  { return 0; }
+};
+
+template <char P, class First, class... Rest>
+struct PortBits<P, First, Rest...> {
+    typedef PortBits<P, Rest...> Next;
+
+    static constexpr unsigned own = (First::port == P) ? First::mask : 0;
+    static constexpr unsigned mask = own | Next::mask;
+
+    // Port bits to set for a bus value.
+    static constexpr unsigned select(unsigned value)
+    {
+        return (own & (0u - (value & 1))) | Next::select(value >> 1);
+    }
+
+    // Bus value from the port input register.
+    static constexpr unsigned gather(unsigned port)
+    {
+        return (own ? (port >> First::bit) & 1 : 0) | (Next::gather(port) << 1);
+    }
+};
+
+} // namespace detail
+
+//
+// Several pins, possibly on different ports, written and read
+// as one value.  Bit 0 of the value is the first pin.
+// Pins are grouped by port at compile time: every port is read
+// once and written by one LATSET and one LATCLR store.
+//
+template <class... Pins>
+struct Bus {
+    static_assert(sizeof...(Pins) > 0 && sizeof...(Pins) <= 32, "Bad bus width");
+
+    static constexpr int width = sizeof...(Pins);
+
+    //
+    // Write a value, known at run time.
+    //
+    static void write(const gpio_t *h, unsigned value)
+    {
+        write_port<'A'>(h, value); write_port<'B'>(h, value);
+        write_port<'C'>(h, value); write_port<'D'>(h, value);
+        write_port<'E'>(h, value); write_port<'F'>(h, value);
+        write_port<'G'>(h, value); write_port<'H'>(h, value);
+        write_port<'J'>(h, value); write_port<'K'>(h, value);
+    }
+
+    //
+    // Write a constant value: stores with empty masks are omitted.
+    //
+    template <unsigned Value>
+    static void write(const gpio_t *h)
+    {
+        write_const<'A', Value>(h); write_const<'B', Value>(h);
+        write_const<'C', Value>(h); write_const<'D', Value>(h);
+        write_const<'E', Value>(h); write_const<'F', Value>(h);
+        write_const<'G', Value>(h); write_const<'H', Value>(h);
+        write_const<'J', Value>(h); write_const<'K', Value>(h);
+    }
+
+    //
+    // Read the value of all pins.
+    //
+    static unsigned read(const gpio_t *h)
+    {
+        return read_port<'A'>(h) | read_port<'B'>(h) | read_port<'C'>(h) |
+               read_port<'D'>(h) | read_port<'E'>(h) | read_port<'F'>(h) |
+               read_port<'G'>(h) | read_port<'H'>(h) | read_port<'J'>(h) |
+               read_port<'K'>(h);
+    }
+
+    //
+    // Set mode of all pins.  Return -1 when any of them failed.
+    //
+    static int mode(gpio_mode_t mode)
+    {
+        int status[] = { gpio_set_mode(Pins::descriptor, mode)... };
+        int result = 0;
+
+        for (int s : status)
+            result |= s;
+        return result < 0 ? -1 : 0;
+    }
+
+private:
+    template <char P>
+    static void write_port(const gpio_t *h, unsigned value)
+    {
+        typedef detail::PortBits<P, Pins...> Bits;
+
+        if (Bits::mask != 0) {
+            unsigned set = Bits::select(value);
+
+            Port<P>::reg(h)->latset = set;
+            Port<P>::reg(h)->latclr = Bits::mask & ~set;
+        }
+    }
+
+    template <char P, unsigned Value>
+    static void write_const(const gpio_t *h)
+    {
+        typedef detail::PortBits<P, Pins...> Bits;
+        constexpr unsigned set = Bits::select(Value);
+        constexpr unsigned clr = Bits::mask & ~set;
+
+        if (set != 0)
+            Port<P>::reg(h)->latset = set;
+        if (clr != 0)
+            Port<P>::reg(h)->latclr = clr;
+    }
+
+    template <char P>
+    static unsigned read_port(const gpio_t *h)
+    {
+        typedef detail::PortBits<P, Pins...> Bits;
+
+        if (Bits::mask == 0)
+            return 0;
+        return Bits::gather(Port<P>::read(h));
+    }
+};
+
+} // namespace gpio
+
+#endif /* GPIO_PIC32_HPP */
@@ -0,0 +1,192 @@
+/*
+ * Matrix keypad scanner for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// Time for the column lines to settle after a row is switched, in usec.
+//
+#define SETTLE_USEC     5
+
+//
+// Configure pins of keypad.
+// Rows have output latch low and stay tristated until scanned.
+//
+int gpio_keypad_init(gpio_keypad_t *kp, const int *row, int nrows,
+                     const int *col, int ncols, int nsamples)
+{
+    int i, k;
+
+    if (nrows < 1 || nrows > GPIO_KEYPAD_MAX || ncols < 1 || ncols > GPIO_KEYPAD_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(kp, 0, sizeof(*kp));
+    kp->nrows = nrows;
+    kp->ncols = ncols;
+
+    for (i = 0; i < nrows; i++) {
+        kp->row[i] = row[i];
+        kp->row_reg[i] = gpio_port_reg(GPIO_PORT(row[i]));
+        gpio_set_mode(row[i], MODE_INPUT);
+        kp->row_reg[i]->latclr = GPIO_MASK(row[i]);
+    }
+
+    for (i = 0; i < ncols; i++) {
+        kp->col[i] = col[i];
+        gpio_set_mode(col[i], MODE_INPUT);
+        gpio_port_reg(GPIO_PORT(col[i]))->cnpuset = GPIO_MASK(col[i]);
+
+        for (k = 0; k < kp->ncports; k++) {
+            if (kp->cport[k] == GPIO_PORT(col[i]))
+                break;
+        }
+        if (k == kp->ncports) {
+            kp->cport[k] = GPIO_PORT(col[i]);
+            kp->ncports++;
+        }
+        kp->cmask[k] |= GPIO_MASK(col[i]);
+    }
+
+    int nkeys = nrows * ncols;
+    for (i = 0; i < 4; i++) {
+        unsigned mask = (nkeys >= 16*(i+1)) ? 0xffff :
+                        (nkeys > 16*i) ? (1 << (nkeys - 16*i)) - 1 : 0;
+        if (gpio_debounce_init(&kp->db[i], 0, mask, nsamples) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+//
+// Scan all rows once.  Return a mask of pressed keys, not debounced.
+//
+uint64_t gpio_keypad_scan(gpio_keypad_t *kp)
+{
+    uint64_t keys = 0;
+    unsigned value[GPIO_KEYPAD_MAX];
+    int r, c, k;
+
+    for (r = 0; r < kp->nrows; r++) {
+        struct gpioreg *reg = kp->row_reg[r];
+        unsigned mask = GPIO_MASK(kp->row[r]);
+
+        // Drive this row low, read all columns, release the row.
+        reg->trisclr = mask;
+        gpio_udelay(SETTLE_USEC);
+        for (k = 0; k < kp->ncports; k++)
+            value[k] = gpio_read_port(kp->cport[k]);
+        reg->trisset = mask;
+
+        for (c = 0; c < kp->ncols; c++) {
+            for (k = 0; kp->cport[k] != GPIO_PORT(kp->col[c]); k++)
+                continue;
+            if (!(value[k] & GPIO_MASK(kp->col[c])))
+                keys |= 1ULL << (r * kp->ncols + c);
+        }
+    }
+    return keys;
+}
+
+//
+// Scan and debounce.  Return a mask of keys, which changed state.
+//
+uint64_t gpio_keypad_poll(gpio_keypad_t *kp)
+{
+    uint64_t keys = gpio_keypad_scan(kp);
+    uint64_t changed = 0;
+    int i;
+
+    kp->raw = keys;
+    for (i = 0; i < 4; i++) {
+        if (kp->db[i].mask)
+            changed |= (uint64_t) gpio_debounce_update(&kp->db[i], keys >> (16*i)) << (16*i);
+    }
+    kp->state ^= changed;
+    return changed;
+}
+
+//
+// Wait for any key press: drive all rows low and wait
+// for change notification from the columns.
+//
+static void keypad_idle(gpio_keypad_t *kp)
+{
+    int r, k;
+
+    for (r = 0; r < kp->nrows; r++)
+        kp->row_reg[r]->trisclr = GPIO_MASK(kp->row[r]);
+    for (k = 0; k < kp->ncports; k++) {
+        gpio_enable_change(kp->cport[k], kp->cmask[k]);
+        gpio_read_port(kp->cport[k]);
+    }
+
+    gpio_wait_change(kp->cport, kp->cmask, kp->ncports, -1);
+
+    for (k = 0; k < kp->ncports; k++)
+        gpio_disable_change(kp->cport[k], kp->cmask[k]);
+    for (r = 0; r < kp->nrows; r++)
+        kp->row_reg[r]->trisset = GPIO_MASK(kp->row[r]);
+}
+
+//
+// Scan with a given period and call func() for every key event.
+// Return when func() returns nonzero.
+//
+int gpio_keypad_run(gpio_keypad_t *kp, unsigned period_usec,
+                    gpio_key_func_t *func, void *arg)
+{
+    struct timespec deadline = { 0 };
+    int idle_scans = 0;
+
+    for (;;) {
+        uint64_t changed = gpio_keypad_poll(kp);
+
+        while (changed) {
+            int key = __builtin_ctzll(changed);
+
+            changed &= changed - 1;
+            if (func(key / kp->ncols, key % kp->ncols, (kp->state >> key) & 1, arg))
+                return 0;
+        }
+
+        // Go idle after all keys are released, and filters settled.
+        // The scan of the poll tells that, no need to scan again.
+        if (kp->state == 0 && kp->raw == 0) {
+            if (++idle_scans > GPIO_DEBOUNCE_MAX) {
+                keypad_idle(kp);
+                idle_scans = 0;
+                deadline.tv_sec = deadline.tv_nsec = 0;
+            }
+        } else
+            idle_scans = 0;
+
+        gpio_sleep_period(&deadline, period_usec * 1000LL);
+    }
+}
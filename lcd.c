@@ -0,0 +1,337 @@
+/*
+ * HD44780 character LCD driver for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "gpio.h"
+
+//
+// HD44780 commands.
+//
+#define CMD_CLEAR       0x01
+#define CMD_ENTRY_MODE  0x04    // | INCREMENT
+#define CMD_DISPLAY     0x08    // | DISPLAY_ON
+#define CMD_FUNCTION    0x20    // | 8BIT | 2LINES
+#define CMD_DDRAM       0x80    // | address
+
+#define INCREMENT       0x02
+#define DISPLAY_ON      0x04
+#define FUNC_8BIT       0x10
+#define FUNC_2LINES     0x08
+
+#define BUSY_FLAG       0x80
+
+//
+// Execution times, when the busy flag cannot be read.
+//
+#define DELAY_CMD_USEC      40
+#define DELAY_CLEAR_USEC    1600
+
+//
+// Busy flag is polled at most this many times,
+// then the controller is assumed to be absent.
+//
+#define BUSY_TIMEOUT        1000
+
+//
+// DDRAM address of a row.  Rows 3 and 4 of a four-line module
+// continue lines 1 and 2, right after the visible columns:
+// 0x14/0x54 on 20-column modules, 0x10/0x50 on 16-column ones.
+//
+static unsigned row_addr(const gpio_lcd_t *lcd, int row)
+{
+    return (row & 1) * 0x40 + (row >> 1) * lcd->cols;
+}
+
+//
+// Pulse the enable line.
+//
+static void lcd_strobe(gpio_lcd_t *lcd)
+{
+    gpio_write(lcd->e, 1);
+    gpio_udelay(1);
+    gpio_write(lcd->e, 0);
+    gpio_udelay(1);
+}
+
+//
+// Put a value on the data lines: one LATxSET and one LATxCLR per port.
+//
+static void lcd_put(gpio_lcd_t *lcd, unsigned value)
+{
+    unsigned set[4] = { 0 }, clr[4] = { 0 };
+    int i;
+
+    for (i = 0; i < lcd->nbits; i++) {
+        if (value & (1 << i))
+            set[lcd->dport[i]] |= lcd->dmask[i];
+        else
+            clr[lcd->dport[i]] |= lcd->dmask[i];
+    }
+    for (i = 0; i < lcd->nports; i++) {
+        lcd->reg[i]->latset = set[i];
+        lcd->reg[i]->latclr = clr[i];
+    }
+}
+
+//
+// Switch data lines between output and input.
+//
+static void lcd_data_direction(gpio_lcd_t *lcd, int input)
+{
+    int i;
+
+    for (i = 0; i < lcd->nports; i++) {
+        if (input)
+            lcd->reg[i]->trisset = lcd->mask[i];
+        else
+            lcd->reg[i]->trisclr = lcd->mask[i];
+    }
+}
+
+//
+// Read a value from the data lines.
+//
+static unsigned lcd_get(gpio_lcd_t *lcd)
+{
+    unsigned port[4], value = 0;
+    int i;
+
+    for (i = 0; i < lcd->nports; i++)
+        port[i] = lcd->reg[i]->port;
+    for (i = 0; i < lcd->nbits; i++) {
+        if (port[lcd->dport[i]] & lcd->dmask[i])
+            value |= 1 << i;
+    }
+    return value;
+}
+
+//
+// Wait until the controller is ready.
+// Poll the busy flag when RW is connected, otherwise wait
+// for the worst-case execution time.
+//
+static void lcd_wait(gpio_lcd_t *lcd, unsigned usec)
+{
+    int i;
+
+    if (lcd->rw < 0) {
+        gpio_udelay(usec);
+        return;
+    }
+
+    lcd_data_direction(lcd, 1);
+    gpio_write(lcd->rs, 0);
+    gpio_write(lcd->rw, 1);
+    for (i = 0; i < BUSY_TIMEOUT; i++) {
+        unsigned status;
+
+        gpio_write(lcd->e, 1);
+        gpio_udelay(1);
+        status = lcd_get(lcd);
+        gpio_write(lcd->e, 0);
+        gpio_udelay(1);
+        if (lcd->nbits == 4) {
+            // Busy flag is in the high nibble; skip the low one.
+            status <<= 4;
+            lcd_strobe(lcd);
+        }
+        if (!(status & BUSY_FLAG))
+            break;
+    }
+    gpio_write(lcd->rw, 0);
+    lcd_data_direction(lcd, 0);
+}
+
+//
+// Send a byte: command when rs=0, data when rs=1.
+//
+static void lcd_send(gpio_lcd_t *lcd, int rs, unsigned byte, unsigned usec)
+{
+    gpio_write(lcd->rs, rs);
+    if (lcd->nbits == 8) {
+        lcd_put(lcd, byte);
+        lcd_strobe(lcd);
+    } else {
+        lcd_put(lcd, byte >> 4);
+        lcd_strobe(lcd);
+        lcd_put(lcd, byte & 15);
+        lcd_strobe(lcd);
+    }
+    lcd_wait(lcd, usec);
+}
+
+//
+// Find index of port of data pins, or add a new one.
+// Return -1 when data pins already use four ports.
+//
+static int lcd_port(gpio_lcd_t *lcd, int pin)
+{
+    int i;
+
+    for (i = 0; i < lcd->nports; i++) {
+        if (lcd->port[i] == GPIO_PORT(pin))
+            return i;
+    }
+    if (lcd->nports == 4) {
+        errno = EINVAL;
+        return -1;
+    }
+    lcd->port[i] = GPIO_PORT(pin);
+    lcd->reg[i] = gpio_port_reg(lcd->port[i]);
+    lcd->nports++;
+    return i;
+}
+
+//
+// Initialize the display.  Data pins are D0...D7, or D4...D7 in 4-bit mode.
+// RW pin is -1 when tied to ground; then the busy flag cannot be read.
+//
+int gpio_lcd_init(gpio_lcd_t *lcd, int rows, int cols,
+                  int rs, int rw, int e, const int *data, int nbits)
+{
+    int i;
+
+    if (rows < 1 || rows > 4 || cols < 1 || cols > 40 ||
+        (nbits != 4 && nbits != 8)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(lcd, 0, sizeof(*lcd));
+    lcd->rows = rows;
+    lcd->cols = cols;
+    lcd->rs = rs;
+    lcd->rw = rw;
+    lcd->e = e;
+    lcd->nbits = nbits;
+
+    for (i = 0; i < nbits; i++) {
+        int p = lcd_port(lcd, data[i]);
+
+        if (p < 0)
+            return -1;
+        lcd->dport[i] = p;
+        lcd->dmask[i] = GPIO_MASK(data[i]);
+        lcd->mask[p] |= GPIO_MASK(data[i]);
+        gpio_set_mode(data[i], MODE_OUTPUT);
+    }
+    gpio_write(e, 0);
+    gpio_write(rs, 0);
+    gpio_set_mode(e, MODE_OUTPUT);
+    gpio_set_mode(rs, MODE_OUTPUT);
+    if (rw >= 0) {
+        gpio_write(rw, 0);
+        gpio_set_mode(rw, MODE_OUTPUT);
+    }
+
+    // Reset by instruction: busy flag is not valid yet.
+    usleep(40000);
+    for (i = 0; i < 3; i++) {
+        lcd_put(lcd, nbits == 8 ? 0x30 : 0x3);
+        lcd_strobe(lcd);
+        usleep(i == 0 ? 4100 : 100);
+    }
+    if (nbits == 4) {
+        lcd_put(lcd, 0x2);
+        lcd_strobe(lcd);
+        gpio_udelay(DELAY_CMD_USEC);
+    }
+
+    lcd_send(lcd, 0, CMD_FUNCTION | (nbits == 8 ? FUNC_8BIT : 0) |
+                     (rows > 1 ? FUNC_2LINES : 0), DELAY_CMD_USEC);
+    lcd_send(lcd, 0, CMD_DISPLAY | DISPLAY_ON, DELAY_CMD_USEC);
+    lcd_send(lcd, 0, CMD_CLEAR, DELAY_CLEAR_USEC);
+    lcd_send(lcd, 0, CMD_ENTRY_MODE | INCREMENT, DELAY_CMD_USEC);
+
+    memset(lcd->shadow, ' ', sizeof(lcd->shadow));
+    memset(lcd->shown, ' ', sizeof(lcd->shown));
+    lcd->addr = 0;
+    return 0;
+}
+
+//
+// Fill the framebuffer with spaces.
+//
+void gpio_lcd_clear(gpio_lcd_t *lcd)
+{
+    memset(lcd->shadow, ' ', sizeof(lcd->shadow));
+}
+
+//
+// Put text into the framebuffer at a given position.
+// Text is clipped at the end of the row.
+//
+void gpio_lcd_print(gpio_lcd_t *lcd, int row, int col, const char *text)
+{
+    if (row < 0 || row >= lcd->rows)
+        return;
+
+    while (*text && col < lcd->cols) {
+        if (col >= 0)
+            lcd->shadow[row][col] = *text;
+        text++;
+        col++;
+    }
+}
+
+//
+// Send changed cells of the framebuffer to the display.
+// The cursor is moved only when the next changed cell
+// does not follow the previous one.
+// Return the number of cells sent.
+//
+int gpio_lcd_update(gpio_lcd_t *lcd)
+{
+    int row, col, count = 0;
+
+    for (row = 0; row < lcd->rows; row++) {
+        for (col = 0; col < lcd->cols; col++) {
+            char c = lcd->shadow[row][col];
+
+            if (c == lcd->shown[row][col])
+                continue;
+
+            unsigned addr = row_addr(lcd, row) + col;
+            if (addr != lcd->addr)
+                lcd_send(lcd, 0, CMD_DDRAM | addr, DELAY_CMD_USEC);
+
+            lcd_send(lcd, 1, (uint8_t) c, DELAY_CMD_USEC);
+            lcd->shown[row][col] = c;
+            count++;
+
+            // Address counter wraps from the end of one line to the other.
+            if (addr == 0x27)
+                lcd->addr = 0x40;
+            else if (addr == 0x67)
+                lcd->addr = 0x00;
+            else
+                lcd->addr = addr + 1;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,288 @@
+/*
+ * WS2812 addressable LED output through SPI for PIC32.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// SPI control registers.
+//
+struct spireg {
+    volatile unsigned con;          // Control
+    volatile unsigned conclr;
+    volatile unsigned conset;
+    volatile unsigned coninv;
+    volatile unsigned stat;         // Status
+    volatile unsigned statclr;
+    volatile unsigned statset;
+    volatile unsigned statinv;
+    volatile unsigned buf;          // Transmit and receive buffer
+    volatile unsigned unused[3];
+    volatile unsigned brg;          // Baud rate
+    volatile unsigned brgclr;
+    volatile unsigned brgset;
+    volatile unsigned brginv;
+    volatile unsigned con2;         // Control 2
+    volatile unsigned con2clr;
+    volatile unsigned con2set;
+    volatile unsigned con2inv;
+};
+
+#define SPI1_ADDR       0x1f821000  // SPI2...SPI6 follow with step 0x200
+#define SPI_STRIDE      0x200
+
+#define CON_ENHBUF      (1 << 16)   // Enhanced buffer enable
+#define CON_ON          (1 << 15)   // SPI enable
+#define CON_CKE         (1 << 8)    // Clock edge select
+#define CON_MSTEN       (1 << 5)    // Master mode
+#define CON_DISSDI      (1 << 4)    // SDI pin not used
+
+#define STAT_TXBUFELM   (31 << 16)  // Bytes in transmit FIFO
+#define STAT_SRMT       (1 << 7)    // Shift register empty
+#define STAT_SPIROV     (1 << 6)    // Receive overflow
+
+#define FIFO_BYTES      16          // Enhanced buffer depth, 8-bit mode
+
+//
+// Every data bit is sent as three SPI bits: 100 for 0, 110 for 1.
+// At 2.4 MHz this gives 0.42 usec pulse for 0, 0.83 usec for 1,
+// and 1.25 usec per bit, as WS2812 expects.
+//
+#define SPI_HZ          2400000
+#define BYTES_PER_PIXEL 9
+
+//
+// Reset gap: WS2812B needs at least 280 usec of low level
+// to latch the data; 90 zero bytes give 300 usec.
+//
+#define RESET_BYTES     90
+
+//
+// Encoding table: color byte to three SPI bytes.
+//
+static uint8_t encode_lut[256][3];
+
+//
+// Fill the encoding table.
+//
+static void leds_init_lut()
+{
+    int value, bit;
+
+    if (encode_lut[0][0])
+        return;
+
+    for (value = 0; value < 256; value++) {
+        uint32_t pattern = 0;
+
+        for (bit = 7; bit >= 0; bit--)
+            pattern = (pattern << 3) | ((value & (1 << bit)) ? 6 : 4);
+
+        encode_lut[value][0] = pattern >> 16;
+        encode_lut[value][1] = pattern >> 8;
+        encode_lut[value][2] = pattern;
+    }
+}
+
+//
+// Send encoded frame to SPI.  The FIFO is refilled in bursts:
+// one status read gives the free room, which is filled at once.
+// DMA would need the physical address of the frame, which
+// is not available to a user process.
+//
+static void leds_transmit(struct spireg *spi, const uint8_t *data, unsigned nbytes)
+{
+    while (nbytes > 0) {
+        unsigned room = FIFO_BYTES - ((spi->stat & STAT_TXBUFELM) >> 16);
+
+        if (room > nbytes)
+            room = nbytes;
+        nbytes -= room;
+        while (room-- > 0)
+            spi->buf = *data++;
+    }
+
+    // Wait until the last byte is shifted out.
+    while (!(spi->stat & STAT_SRMT))
+        continue;
+
+    // Received data are not used.
+    spi->statclr = STAT_SPIROV;
+}
+
+//
+// Transmit thread: sends the front buffer every time
+// a new frame is shown.
+//
+static void *leds_thread(void *arg)
+{
+    gpio_leds_t *leds = arg;
+    struct sched_param rt = { 0 }, normal = { 0 };
+
+    rt.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    pthread_mutex_lock(&leds->lock);
+    for (;;) {
+        while (!leds->pending && !leds->stop)
+            pthread_cond_wait(&leds->cond, &leds->lock);
+        if (leds->stop)
+            break;
+        pthread_mutex_unlock(&leds->lock);
+
+        // A gap longer than the reset time inside a frame would
+        // latch it early, so the frame is sent at real-time priority.
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &rt);
+        leds_transmit(leds->spi, leds->frame[leds->back ^ 1], leds->nbytes);
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &normal);
+
+        pthread_mutex_lock(&leds->lock);
+        leds->pending = 0;
+        pthread_cond_broadcast(&leds->cond);
+    }
+    pthread_mutex_unlock(&leds->lock);
+    return 0;
+}
+
+//
+// Route SPI output to a given pin and prepare a strip of LEDs.
+// Return -1 when the pin has no SDO function,
+// or the number of pixels is out of range.
+//
+int gpio_leds_open(gpio_leds_t *leds, int pin, int npixels)
+{
+    int n;
+
+    memset(leds, 0, sizeof(*leds));
+    for (n = 1; n <= 6; n++) {
+        if (gpio_has_mapping(pin, MODE_SDO1 + n - 1))
+            break;
+    }
+    if (n > 6 || npixels <= 0 || npixels > GPIO_LEDS_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    leds->sdo = n;
+
+    leds->spi = (struct spireg*) gpio_map_sfr(SPI1_ADDR + (n - 1) * SPI_STRIDE,
+                                              sizeof(struct spireg));
+    if (!leds->spi)
+        return -1;
+
+    leds->npixels = npixels;
+    leds->nbytes = npixels * BYTES_PER_PIXEL + RESET_BYTES;
+    leds->frame[0] = calloc(2, leds->nbytes);
+    if (!leds->frame[0])
+        return -1;
+    leds->frame[1] = leds->frame[0] + leds->nbytes;
+    leds_init_lut();
+    for (n = 0; n < npixels; n++)
+        gpio_leds_set(leds, n, 0);
+    memcpy(leds->frame[1], leds->frame[0], leds->nbytes);
+
+    // Master, 8-bit, transmit only, 16-byte FIFO.
+    unsigned long pbclk = gpio_pbclk(2);
+    struct spireg *spi = leds->spi;
+
+    spi->con = 0;
+    spi->brg = (pbclk + SPI_HZ) / (2 * SPI_HZ) - 1;
+    spi->con = CON_ENHBUF | CON_CKE | CON_MSTEN | CON_DISSDI;
+    spi->conset = CON_ON;
+    gpio_set_mode(pin, MODE_SDO1 + leds->sdo - 1);
+
+    pthread_mutex_init(&leds->lock, 0);
+    pthread_cond_init(&leds->cond, 0);
+    int err = pthread_create(&leds->thread, 0, leds_thread, leds);
+    if (err) {
+        // Undo the setup.  The register mapping is shared
+        // by the library and stays.
+        spi->conclr = CON_ON;
+        gpio_clear_mapping(pin);
+        pthread_cond_destroy(&leds->cond);
+        pthread_mutex_destroy(&leds->lock);
+        free(leds->frame[0]);
+        leds->frame[0] = leds->frame[1] = 0;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Set color of a pixel in the back buffer.
+// Color is 0xRRGGBB; WS2812 expects green first.
+//
+void gpio_leds_set(gpio_leds_t *leds, int index, unsigned rgb)
+{
+    if (index < 0 || index >= leds->npixels)
+        return;
+
+    uint8_t *p = leds->frame[leds->back] + index * BYTES_PER_PIXEL;
+
+    memcpy(p,     encode_lut[(rgb >> 8) & 0xff],  3);
+    memcpy(p + 3, encode_lut[(rgb >> 16) & 0xff], 3);
+    memcpy(p + 6, encode_lut[rgb & 0xff],         3);
+}
+
+//
+// Show the back buffer: wait until the previous frame is sent,
+// swap the buffers and start transmission.
+// The new back buffer starts as a copy of the shown frame.
+//
+void gpio_leds_show(gpio_leds_t *leds)
+{
+    pthread_mutex_lock(&leds->lock);
+    while (leds->pending)
+        pthread_cond_wait(&leds->cond, &leds->lock);
+
+    leds->back ^= 1;
+    memcpy(leds->frame[leds->back], leds->frame[leds->back ^ 1], leds->nbytes);
+    leds->pending = 1;
+    pthread_cond_broadcast(&leds->cond);
+    pthread_mutex_unlock(&leds->lock);
+}
+
+//
+// Wait for the last frame, stop the transmit thread and disable SPI.
+//
+void gpio_leds_close(gpio_leds_t *leds)
+{
+    pthread_mutex_lock(&leds->lock);
+    while (leds->pending)
+        pthread_cond_wait(&leds->cond, &leds->lock);
+    leds->stop = 1;
+    pthread_cond_broadcast(&leds->cond);
+    pthread_mutex_unlock(&leds->lock);
+    pthread_join(leds->thread, 0);
+
+    leds->spi->conclr = CON_ON;
+    pthread_cond_destroy(&leds->cond);
+    pthread_mutex_destroy(&leds->lock);
+    free(leds->frame[0]);
+    leds->frame[0] = leds->frame[1] = 0;
+}
@@ -32,6 +32,14 @@
 #include <strings.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include "gpio.h"
 
 const char version[] = "0.1";
@@ -275,108 +283,42 @@ int phys_to_pin(int phys)
 }
 
 //
-// Get a pin descriptor by a pic32 pin name.
+// Get a pin descriptor by name, or exit with a message.
 //
 int pin_by_name(const char *name)
 {
-    if (name[0] == 'r' || name[0] == 'R') {
-        // PIC32 pin names.
-        if      (strcasecmp(name, "RA9")  == 0) return GPIO_PIN('A', 9);
-        else if (strcasecmp(name, "RB0")  == 0) return GPIO_PIN('B', 0);
-        else if (strcasecmp(name, "RB2")  == 0) return GPIO_PIN('B', 2);
-        else if (strcasecmp(name, "RB4")  == 0) return GPIO_PIN('B', 4);
-        else if (strcasecmp(name, "RB8")  == 0) return GPIO_PIN('B', 8);
-        else if (strcasecmp(name, "RB15") == 0) return GPIO_PIN('B', 15);
-        else if (strcasecmp(name, "RC3")  == 0) return GPIO_PIN('C', 3);
-        else if (strcasecmp(name, "RD0")  == 0) return GPIO_PIN('D', 0);
-        else if (strcasecmp(name, "RD7")  == 0) return GPIO_PIN('D', 7);
-        else if (strcasecmp(name, "RD14") == 0) return GPIO_PIN('D', 14);
-        else if (strcasecmp(name, "RD15") == 0) return GPIO_PIN('D', 15);
-        else if (strcasecmp(name, "RE4")  == 0) return GPIO_PIN('E', 4);
-        else if (strcasecmp(name, "RE7")  == 0) return GPIO_PIN('E', 7);
-        else if (strcasecmp(name, "RE8")  == 0) return GPIO_PIN('E', 8);
-        else if (strcasecmp(name, "RF2")  == 0) return GPIO_PIN('F', 2);
-        else if (strcasecmp(name, "RF8")  == 0) return GPIO_PIN('F', 8);
-        else if (strcasecmp(name, "RG6")  == 0) return GPIO_PIN('G', 6);
-        else if (strcasecmp(name, "RG8")  == 0) return GPIO_PIN('G', 8);
-        else if (strcasecmp(name, "RG9")  == 0) return GPIO_PIN('G', 9);
-        else if (strcasecmp(name, "RH3")  == 0) return GPIO_PIN('H', 3);
-        else if (strcasecmp(name, "RH4")  == 0) return GPIO_PIN('H', 4);
-        else if (strcasecmp(name, "RH6")  == 0) return GPIO_PIN('H', 6);
-        else if (strcasecmp(name, "RH7")  == 0) return GPIO_PIN('H', 7);
-        else if (strcasecmp(name, "RH12") == 0) return GPIO_PIN('H', 12);
-        else if (strcasecmp(name, "RJ2")  == 0) return GPIO_PIN('J', 2);
-        else if (strcasecmp(name, "RK1")  == 0) return GPIO_PIN('K', 1);
-        else if (strcasecmp(name, "RK2")  == 0) return GPIO_PIN('K', 2);
-    } else
-    if (name[0] == 'j' || name[0] == 'J') {
-        // Physical pin indices on Extension connector.
-        if      (strcasecmp(name, "j3")  == 0) return GPIO_PIN('F', 2);
-        else if (strcasecmp(name, "j5")  == 0) return GPIO_PIN('F', 8);
-        else if (strcasecmp(name, "j7")  == 0) return GPIO_PIN('E', 4);
-        else if (strcasecmp(name, "j8")  == 0) return GPIO_PIN('C', 3);
-        else if (strcasecmp(name, "j10") == 0) return GPIO_PIN('E', 8);
-        else if (strcasecmp(name, "j11") == 0) return GPIO_PIN('E', 7);
-        else if (strcasecmp(name, "j12") == 0) return GPIO_PIN('H', 3);
-        else if (strcasecmp(name, "j13") == 0) return GPIO_PIN('B', 8);
-        else if (strcasecmp(name, "j15") == 0) return GPIO_PIN('A', 9);
-        else if (strcasecmp(name, "j16") == 0) return GPIO_PIN('B', 4);
-        else if (strcasecmp(name, "j18") == 0) return GPIO_PIN('H', 4);
-        else if (strcasecmp(name, "j19") == 0) return GPIO_PIN('G', 8);
-        else if (strcasecmp(name, "j21") == 0) return GPIO_PIN('D', 7);
-        else if (strcasecmp(name, "j22") == 0) return GPIO_PIN('H', 6);
-        else if (strcasecmp(name, "j23") == 0) return GPIO_PIN('G', 6);
-        else if (strcasecmp(name, "j24") == 0) return GPIO_PIN('D', 0);
-        else if (strcasecmp(name, "j26") == 0) return GPIO_PIN('D', 14);
-        else if (strcasecmp(name, "j27") == 0) return GPIO_PIN('B', 2);
-        else if (strcasecmp(name, "j29") == 0) return GPIO_PIN('K', 1);
-        else if (strcasecmp(name, "j31") == 0) return GPIO_PIN('K', 2);
-        else if (strcasecmp(name, "j32") == 0) return GPIO_PIN('J', 2);
-        else if (strcasecmp(name, "j33") == 0) return GPIO_PIN('G', 9);
-        else if (strcasecmp(name, "j35") == 0) return GPIO_PIN('B', 0);
-        else if (strcasecmp(name, "j36") == 0) return GPIO_PIN('B', 15);
-        else if (strcasecmp(name, "j37") == 0) return GPIO_PIN('H', 7);
-        else if (strcasecmp(name, "j38") == 0) return GPIO_PIN('H', 12);
-        else if (strcasecmp(name, "j40") == 0) return GPIO_PIN('D', 15);
-    } else
-    if (name[0] == 'p' || name[0] == 'P') {
-        // Broadcom pin names.
-        if      (strcasecmp(name, "p0")  == 0) return GPIO_PIN('B', 2);
-        else if (strcasecmp(name, "p2")  == 0) return GPIO_PIN('F', 2);
-        else if (strcasecmp(name, "p3")  == 0) return GPIO_PIN('F', 8);
-        else if (strcasecmp(name, "p4")  == 0) return GPIO_PIN('E', 4);
-        else if (strcasecmp(name, "p5")  == 0) return GPIO_PIN('K', 1);
-        else if (strcasecmp(name, "p6")  == 0) return GPIO_PIN('K', 2);
-        else if (strcasecmp(name, "p7")  == 0) return GPIO_PIN('D', 14);
-        else if (strcasecmp(name, "p8")  == 0) return GPIO_PIN('D', 0);
-        else if (strcasecmp(name, "p9")  == 0) return GPIO_PIN('D', 7);
-        else if (strcasecmp(name, "p10") == 0) return GPIO_PIN('G', 8);
-        else if (strcasecmp(name, "p11") == 0) return GPIO_PIN('G', 6);
-        else if (strcasecmp(name, "p12") == 0) return GPIO_PIN('J', 2);
-        else if (strcasecmp(name, "p13") == 0) return GPIO_PIN('G', 9);
-        else if (strcasecmp(name, "p14") == 0) return GPIO_PIN('C', 3);
-        else if (strcasecmp(name, "p15") == 0) return GPIO_PIN('E', 8);
-        else if (strcasecmp(name, "p16") == 0) return GPIO_PIN('B', 15);
-        else if (strcasecmp(name, "p17") == 0) return GPIO_PIN('E', 7);
-        else if (strcasecmp(name, "p18") == 0) return GPIO_PIN('H', 3);
-        else if (strcasecmp(name, "p19") == 0) return GPIO_PIN('B', 0);
-        else if (strcasecmp(name, "p20") == 0) return GPIO_PIN('H', 12);
-        else if (strcasecmp(name, "p21") == 0) return GPIO_PIN('D', 15);
-        else if (strcasecmp(name, "p22") == 0) return GPIO_PIN('A', 9);
-        else if (strcasecmp(name, "p23") == 0) return GPIO_PIN('B', 4);
-        else if (strcasecmp(name, "p24") == 0) return GPIO_PIN('H', 4);
-        else if (strcasecmp(name, "p25") == 0) return GPIO_PIN('H', 6);
-        else if (strcasecmp(name, "p26") == 0) return GPIO_PIN('H', 7);
-        else if (strcasecmp(name, "p27") == 0) return GPIO_PIN('B', 8);
-        else if (strcasecmp(name, "p1") == 0) {
-            fprintf(stderr, "gpio: Pin name P1 is not supported on PIC32.\n");
-            exit(-1);
-        }
+    int pin = gpio_pin_by_name(name);
+
+    if (pin >= 0)
+        return pin;
+
+    if (strcasecmp(name, "p1") == 0) {
+        fprintf(stderr, "gpio: Pin name P1 is not supported on PIC32.\n");
+        exit(-1);
     }
     fprintf(stderr, "gpio: Wrong pin name: %s\n", name);
     fprintf(stderr, "gpio: Valid names are ra9-rk2, p0-p27, j3-j40\n");
     exit(-1);
-    return 0;
+}
+
+//
+// Get a number from a command argument, in range min...max,
+// or exit with a message.
+//
+unsigned number_by_name(const char *what, const char *arg, unsigned min, unsigned max)
+{
+    unsigned long value = 0;
+    char *end = 0;
+
+    if (isdigit((unsigned char) arg[0])) {
+        errno = 0;
+        value = strtoul(arg, &end, 0);
+    }
+    if (!end || *end || errno || value < min || value > max) {
+        fprintf(stderr, "gpio: Wrong %s: %s, valid range is %u...%u\n", what, arg, min, max);
+        exit(-1);
+    }
+    return value;
 }
 
 //
@@ -391,7 +333,31 @@ void usage()
     fprintf(stderr, "    gpio write <pin> <value>\n");
     fprintf(stderr, "    gpio toggle <pin>\n");
     fprintf(stderr, "    gpio blink <pin>\n");
-    fprintf(stderr, "    gpio readall\n");
+    fprintf(stderr, "    gpio readall [--json | --binary] [--watch [--rate <hz>]]\n");
+    fprintf(stderr, "    gpio debounce [-p <usec>] <pin>[:<msec>]...\n");
+    fprintf(stderr, "    gpio encoder [-p <usec>] [-c] <pin-a> <pin-b>...\n");
+    fprintf(stderr, "    gpio onewire <pin> search|temp\n");
+    fprintf(stderr, "    gpio leds <pin> <count> <rrggbb>... | -\n");
+    fprintf(stderr, "    gpio shift <data> <clock> <latch> <nbits> write <hex> | read\n");
+    fprintf(stderr, "    gpio lcd [-8] <rows>x<cols> <rs> <rw>|- <e> <d4>...<d7> [<text>...]\n");
+    fprintf(stderr, "    gpio keypad [-p <usec>] <row>,<row>... <col>,<col>... [<keys>]\n");
+    fprintf(stderr, "    gpio stepper [-s] [-v <steps/sec>] [-a <steps/sec2>] <step> <dir> <steps>...\n");
+    fprintf(stderr, "    gpio aread <pin>|an<N>...\n");
+    fprintf(stderr, "    gpio ascan [-r <hz>] [-n <count>] <pin>|an<N>...\n");
+    fprintf(stderr, "    gpio clock <pin> <freq>[k|m] | off\n");
+    fprintf(stderr, "    gpio freq [-w <msec>] [-c] <pin>\n");
+    fprintf(stderr, "    gpio extint [-c <cpu>] [-p <usec>] [-t <sec>] <pin>[:rise|fall|both]...\n");
+    fprintf(stderr, "    gpio run [-c <cpu>] <file> | -\n");
+    fprintf(stderr, "    gpio wait [-s <usec>] <pin> rise|fall|both [<sec>]\n");
+    fprintf(stderr, "    gpio save\n");
+    fprintf(stderr, "    gpio apply <file> | -\n");
+    fprintf(stderr, "    gpio capture [-r <hz>] [-n <samples> | -t <sec>] [-c <cpu>]\n");
+    fprintf(stderr, "                 [-T <condition>]... [-b <samples>] [-a <samples>] <file> <port>|<pin>...\n");
+    fprintf(stderr, "    gpio decode [-b] <file> uart|spi|i2c|onewire:<pins>[:<param>]...\n");
+    fprintf(stderr, "    gpio rules [-c <cpu>] [-p <usec>] <file> | -\n");
+    fprintf(stderr, "    gpio stats [-s <socket>] <command> [<args>...]\n");
+    fprintf(stderr, "    gpio bench toggle [-n <count>] <pin>\n");
+    fprintf(stderr, "    gpio bench loopback [-n <count>] <out-pin> <in-pin>\n");
     fprintf(stderr, "    gpio modes\n");
     fprintf(stderr, "Pins:\n");
     fprintf(stderr, "    ra9...rk2      PIC32 pin names\n");
@@ -432,16 +398,22 @@ void do_mode(int argc, char **argv)
 
     int pin = pin_by_name(argv[1]);
     const char *mode = argv[2];
+    int status;
+
+    if      (strcasecmp(mode, "in")     == 0) status = gpio_set_mode(pin, MODE_INPUT);
+    else if (strcasecmp(mode, "input")  == 0) status = gpio_set_mode(pin, MODE_INPUT);
+    else if (strcasecmp(mode, "out")    == 0) status = gpio_set_mode(pin, MODE_OUTPUT);
+    else if (strcasecmp(mode, "output") == 0) status = gpio_set_mode(pin, MODE_OUTPUT);
+    else if (strcasecmp(mode, "up")     == 0) status = gpio_set_pull(pin, PULL_UP);
+    else if (strcasecmp(mode, "down")   == 0) status = gpio_set_pull(pin, PULL_DOWN);
+    else if (strcasecmp(mode, "tri")    == 0) status = gpio_set_pull(pin, PULL_OFF);
+    else if (strcasecmp(mode, "off")    == 0) status = gpio_set_pull(pin, PULL_OFF);
+    else                                      status = gpio_set_mode(pin, find_mode(mode));
 
-    if      (strcasecmp(mode, "in")     == 0) gpio_set_mode(pin, MODE_INPUT);
-    else if (strcasecmp(mode, "input")  == 0) gpio_set_mode(pin, MODE_INPUT);
-    else if (strcasecmp(mode, "out")    == 0) gpio_set_mode(pin, MODE_OUTPUT);
-    else if (strcasecmp(mode, "output") == 0) gpio_set_mode(pin, MODE_OUTPUT);
-    else if (strcasecmp(mode, "up")     == 0) gpio_set_pull(pin, PULL_UP);
-    else if (strcasecmp(mode, "down")   == 0) gpio_set_pull(pin, PULL_DOWN);
-    else if (strcasecmp(mode, "tri")    == 0) gpio_set_pull(pin, PULL_OFF);
-    else if (strcasecmp(mode, "off")    == 0) gpio_set_pull(pin, PULL_OFF);
-    else                                      gpio_set_mode(pin, find_mode(mode));
+    if (status < 0) {
+        fprintf(stderr, "gpio: Wrong mode for this pin!\n");
+        exit(-1);
+    }
 }
 
 //
@@ -523,186 +495,2607 @@ void do_blink(int argc, char **argv)
 }
 
 //
-// Print status of all pins on GPIO extension connector.
+// State of a pin on GPIO extension connector, as reported by readall.
+//
+struct pin_state {
+    gpio_mode_t mode;           // MODE_LAST when not a GPIO pin
+    unsigned    flags;          // Bit mask of PIN_xxx
+};
+
+#define PIN_VALUE       0x01    // Input value
+#define PIN_LAT         0x02    // Output latch
+#define PIN_ODC         0x04    // Open drain
+#define PIN_PULLUP      0x08    // Pull-up resistor enabled
+#define PIN_PULLDOWN    0x10    // Pull-down resistor enabled
+#define PIN_CNEN        0x20    // Change notification enabled
+#define PIN_CNSTAT      0x40    // Change detected
+
+//
+// Take a snapshot of all pins on GPIO extension connector.
+// Every port is read only once.
+//
+static void snapshot_header(struct pin_state state[1+40])
+{
+    gpio_port_state_t port[GPIO_NPORTS];
+    int valid[GPIO_NPORTS] = { 0 };
+    int phys;
+
+    for (phys = 1; phys <= 40; phys++) {
+        int pin = phys_to_pin(phys);
+        if (pin < 0) {
+            state[phys].mode = MODE_LAST;
+            state[phys].flags = 0;
+            continue;
+        }
+
+        int index = pin >> 24;
+        if (!valid[index]) {
+            gpio_get_port_state(GPIO_PORT(pin), &port[index]);
+            valid[index] = 1;
+        }
+
+        const gpio_port_state_t *reg = &port[index];
+        unsigned mask = GPIO_MASK(pin);
+        unsigned flags = 0;
+
+        if (reg->port & mask)   flags |= PIN_VALUE;
+        if (reg->lat & mask)    flags |= PIN_LAT;
+        if (reg->odc & mask)    flags |= PIN_ODC;
+        if (reg->cnpu & mask)   flags |= PIN_PULLUP;
+        if (reg->cnpd & mask)   flags |= PIN_PULLDOWN;
+        if (reg->cnen & mask)   flags |= PIN_CNEN;
+        if (reg->cnstat & mask) flags |= PIN_CNSTAT;
+
+        state[phys].mode = gpio_get_state_mode(pin, reg);
+        state[phys].flags = flags;
+    }
+}
+
+//
+// Output of readall is collected here and written at once.
+//
+static char out_buf[32768];
+static size_t out_len;
+
+static void out_write(const void *data, size_t nbytes)
+{
+    if (out_len + nbytes > sizeof(out_buf))
+        nbytes = sizeof(out_buf) - out_len;
+    memcpy(out_buf + out_len, data, nbytes);
+    out_len += nbytes;
+}
+
+static void out_printf(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(out_buf + out_len, sizeof(out_buf) - out_len, fmt, args);
+    va_end(args);
+    if (n > 0)
+        out_len += n;
+    if (out_len > sizeof(out_buf))
+        out_len = sizeof(out_buf);
+}
+
+static void out_flush()
+{
+    size_t done = 0;
+
+    while (done < out_len) {
+        ssize_t n = write(1, out_buf + done, out_len - done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            exit(-1);
+        }
+        done += n;
+    }
+    out_len = 0;
+}
+
+//
+// Print pin value in the readall table.
+//
+static void out_value(const struct pin_state *st)
+{
+    if (st->mode == MODE_ANALOG)
+        out_printf(" | -");
+    else
+        out_printf(" | %d", st->flags & PIN_VALUE);
+}
+
 //
-void do_readall()
+// Print status of all pins as a table.
+//
+static void print_table(const struct pin_state state[1+40])
 {
-    printf(" +-----+------+--------+---+------------+---+--------+------+-----+\n");
-    printf(" | BCM | Name | Mode   | V |  Physical  | V | Mode   | Name | BCM |\n");
-    printf(" +-----+------+--------+---+-----++-----+---+--------+------+-----+\n");
+    out_printf(" +-----+------+--------+---+------------+---+--------+------+-----+\n");
+    out_printf(" | BCM | Name | Mode   | V |  Physical  | V | Mode   | Name | BCM |\n");
+    out_printf(" +-----+------+--------+---+-----++-----+---+--------+------+-----+\n");
 
     int phys;
     for (phys = 1; phys <= 40; phys += 2) {
         int bcm = phys_to_bcm(phys);
         if (bcm < 0) {
-            printf(" |     | %-4s |        |  ", phys_name[phys]);
+            out_printf(" |     | %-4s |        |  ", phys_name[phys]);
         } else {
-            int pin = phys_to_pin(phys);
-            int mode = gpio_get_mode(pin);
-
-            printf(" | p%-2d", bcm);
-            printf(" | %-4s", phys_name[phys]);
-            printf(" | %-6s", mode_name[mode]);
-            if (mode == MODE_ANALOG)
-                printf(" | -");
-            else
-                printf(" | %d", gpio_read(pin));
+            out_printf(" | p%-2d", bcm);
+            out_printf(" | %-4s", phys_name[phys]);
+            out_printf(" | %-6s", mode_name[state[phys].mode]);
+            out_value(&state[phys]);
         }
 
         // Pin numbers
-        printf(" | j%-2d || j%-2d", phys, phys+1);
+        out_printf(" | j%-2d || j%-2d", phys, phys+1);
 
         // Same, reversed
         bcm = phys_to_bcm(phys+1);
         if (bcm < 0) {
-            printf(" |   |        | %-4s |    ", phys_name[phys+1]);
+            out_printf(" |   |        | %-4s |    ", phys_name[phys+1]);
         } else {
-            int pin = phys_to_pin(phys+1);
-            int mode = gpio_get_mode(pin);
-
-            if (mode == MODE_ANALOG)
-                printf(" | -");
-            else
-                printf(" | %d", gpio_read(pin));
-            printf(" | %-6s", mode_name[mode]);
-            printf(" | %-4s", phys_name[phys+1]);
-            printf(" | p%-2d", bcm);
+            out_value(&state[phys+1]);
+            out_printf(" | %-6s", mode_name[state[phys+1].mode]);
+            out_printf(" | %-4s", phys_name[phys+1]);
+            out_printf(" | p%-2d", bcm);
         }
-        printf(" |\n");
+        out_printf(" |\n");
     }
-    printf(" +-----+------+--------+---+-----++-----+---+--------+------+-----+\n");
-    printf(" | BCM | Name | Mode   | V |  Physical  | V | Mode   | Name | BCM |\n");
-    printf(" +-----+------+--------+---+------------+---+--------+------+-----+\n");
+    out_printf(" +-----+------+--------+---+-----++-----+---+--------+------+-----+\n");
+    out_printf(" | BCM | Name | Mode   | V |  Physical  | V | Mode   | Name | BCM |\n");
+    out_printf(" +-----+------+--------+---+------------+---+--------+------+-----+\n");
 }
 
 //
-// For every mode, show available pins.
+// Print status of one pin as a line of text, for watch mode.
 //
-void do_modes()
+static void print_line(int phys, const struct pin_state *st, const struct timeval *tv)
 {
-    printf(" Mode     Available Pins\n");
+    unsigned flags = st->flags;
 
-    gpio_mode_t mode;
-    for (mode=MODE_ANALOG+1; mode<MODE_LAST; mode++) {
-        printf(" %-8s", mode_name[mode]);
+    out_printf("%ld.%06ld p%-2d j%-2d %-4s %-8s", (long)tv->tv_sec, (long)tv->tv_usec,
+        phys_to_bcm(phys), phys, phys_name[phys], mode_name[st->mode]);
+    if (st->mode == MODE_ANALOG)
+        out_printf(" -");
+    else
+        out_printf(" %d", flags & PIN_VALUE);
+    out_printf(" lat=%d%s%s%s%s\n", (flags & PIN_LAT) != 0,
+        (flags & PIN_ODC)      ? " odc"  : "",
+        (flags & PIN_PULLUP)   ? " up"   : "",
+        (flags & PIN_PULLDOWN) ? " down" : "",
+        (flags & PIN_CNEN)     ? " cn"   : "");
+}
 
-        // Print pins, capable of this mode.
-        int phys;
-        for (phys = 1; phys <= 40; phys++) {
-            int bcm = phys_to_bcm(phys);
-            if (bcm < 0)
-                continue;
+//
+// Print status of one pin as a JSON object.
+//
+static void print_json_pin(int phys, const struct pin_state *st)
+{
+    unsigned flags = st->flags;
+    const char *pull = (flags & PIN_PULLUP) ?
+                            ((flags & PIN_PULLDOWN) ? "both" : "up") :
+                       (flags & PIN_PULLDOWN) ? "down" : "off";
 
-            int pin = phys_to_pin(phys);
-            if (gpio_has_mapping(pin, mode)) {
-                //printf(" j%d ", phys);
-                printf(" p%d", bcm);
-                //printf(" %s", phys_name[phys]);
-            }
+    out_printf("{\"phys\":%d,\"bcm\":%d,\"name\":\"%s\",\"mode\":\"%s\"",
+        phys, phys_to_bcm(phys), phys_name[phys], mode_name[st->mode]);
+    if (st->mode == MODE_ANALOG)
+        out_printf(",\"value\":null");
+    else
+        out_printf(",\"value\":%d", flags & PIN_VALUE);
+    out_printf(",\"lat\":%d,\"odc\":%d,\"pull\":\"%s\",\"cn\":%d,\"cnstat\":%d}",
+        (flags & PIN_LAT) != 0, (flags & PIN_ODC) != 0, pull,
+        (flags & PIN_CNEN) != 0, (flags & PIN_CNSTAT) != 0);
+}
+
+//
+// Print status of selected pins as one line of JSON.
+//
+static void print_json(const struct pin_state state[1+40], const int *list, int count,
+    const struct timeval *tv)
+{
+    int i;
+
+    out_printf("{\"time\":%ld.%06ld,\"pins\":[", (long)tv->tv_sec, (long)tv->tv_usec);
+    for (i = 0; i < count; i++) {
+        if (i > 0)
+            out_printf(",");
+        print_json_pin(list[i], &state[list[i]]);
+    }
+    out_printf("]}\n");
+}
+
+//
+// Print status of selected pins in binary form.
+// Header is 16 bytes: magic "GPIO", format version 1, number of records,
+// two reserved bytes, and time in microseconds as 64-bit little endian.
+// Every record is 4 bytes: physical pin index, Broadcom index,
+// mode (gpio_mode_t) and flags (PIN_VALUE, PIN_LAT etc).
+//
+static void print_binary(const struct pin_state state[1+40], const int *list, int count,
+    const struct timeval *tv)
+{
+    uint64_t usec = (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    uint8_t header[16] = { 'G', 'P', 'I', 'O', 1, count, 0, 0 };
+    int i;
+
+    for (i = 0; i < 8; i++)
+        header[8 + i] = usec >> (8 * i);
+    out_write(header, sizeof(header));
+
+    for (i = 0; i < count; i++) {
+        int phys = list[i];
+        uint8_t rec[4] = { phys, phys_to_bcm(phys), state[phys].mode, state[phys].flags };
+
+        out_write(rec, sizeof(rec));
+    }
+}
+
+//
+// Output formats of readall.
+//
+enum {
+    FORMAT_TABLE,
+    FORMAT_JSON,
+    FORMAT_BINARY,
+};
+
+//
+// Print status of the pins from the list.
+//
+static void print_state(int format, const struct pin_state state[1+40],
+    const int *list, int count, int watch)
+{
+    struct timeval tv;
+    int i;
+
+    gettimeofday(&tv, 0);
+    switch (format) {
+    case FORMAT_TABLE:
+        if (!watch) {
+            print_table(state);
+            break;
         }
-        printf("\n");
+        for (i = 0; i < count; i++)
+            print_line(list[i], &state[list[i]], &tv);
+        break;
+    case FORMAT_JSON:
+        print_json(state, list, count, &tv);
+        break;
+    case FORMAT_BINARY:
+        print_binary(state, list, count, &tv);
+        break;
     }
+    out_flush();
 }
 
 //
-// For every pin, show possible modes.
+// gpio readall [--json | --binary] [--watch [--rate <hz>]]
+// Print status of all pins on GPIO extension connector.
+// In watch mode, the state is sampled periodically,
+// and only the pins which changed are printed.
 //
-void do_pins()
+void do_readall(int argc, char **argv)
 {
-    printf(" Pin Phys Name Available Modes\n");
-    int bcm;
-    for (bcm = 0; bcm < 32; bcm++) {
-        int phys = bcm_to_phys(bcm);
-        if (phys < 0)
-            continue;
+    int format = FORMAT_TABLE;
+    int watch = 0;
+    double rate = 10;
+    int i;
 
-        // Print alternative mappings, available for this pin.
-        int pin = phys_to_pin(phys);
-        int print_this_pin = 0;
-        gpio_mode_t mode;
+    for (i = 1; i < argc; i++) {
+        if      (strcmp(argv[i], "--json")   == 0) format = FORMAT_JSON;
+        else if (strcmp(argv[i], "--binary") == 0) format = FORMAT_BINARY;
+        else if (strcmp(argv[i], "--watch")  == 0) watch = 1;
+        else if (strcmp(argv[i], "--rate")   == 0 && i+1 < argc) rate = strtod(argv[++i], 0);
+        else {
+            fprintf(stderr, "Usage: gpio readall [--json | --binary] [--watch [--rate <hz>]]\n");
+            exit(-1);
+        }
+    }
+    if (!(rate >= 0.001)) {
+        // Period of a watch must fit in 64-bit nanoseconds.
+        fprintf(stderr, "gpio: Wrong rate: %g, minimum is 0.001 Hz\n", rate);
+        exit(-1);
+    }
 
-        // First line: output modes.
-        for (mode=MODE_ANALOG+1; mode<MODE_C1RX; mode++) {
-            if (gpio_has_mapping(pin, mode)) {
-                if (print_this_pin == 0) {
-                    print_this_pin = 1;
-                    printf(" p%-2d", bcm);
-                    printf(" j%-2d ", phys);
-                    printf(" %-4s", phys_name[phys]);
-                }
-                printf(" %s", mode_name[mode]);
-            }
+    struct pin_state state[1+40], prev[1+40];
+    int list[40], count = 0, phys;
+
+    snapshot_header(state);
+    for (phys = 1; phys <= 40; phys++) {
+        if (state[phys].mode != MODE_LAST)
+            list[count++] = phys;
+    }
+    print_state(format, state, list, count, 0);
+    if (!watch)
+        return;
+
+    int64_t period = 1e9 / rate;
+    struct timespec deadline = { 0 };
+
+    for (;;) {
+        gpio_sleep_period(&deadline, period);
+
+        memcpy(prev, state, sizeof(state));
+        snapshot_header(state);
+
+        count = 0;
+        for (phys = 1; phys <= 40; phys++) {
+            if (state[phys].mode != prev[phys].mode ||
+                state[phys].flags != prev[phys].flags)
+                list[count++] = phys;
         }
-        if (print_this_pin) {
-            // Second line: input modes.
-            printf("\n              ");
-            for (mode=MODE_C1RX; mode<MODE_LAST; mode++) {
-                if (gpio_has_mapping(pin, mode)) {
-                    printf(" %s", mode_name[mode]);
-                }
-            }
-            printf("\n");
+        if (count > 0)
+            print_state(format, state, list, count, 1);
+    }
+}
+
+//
+// Names of pins, given to debounce command.
+//
+static const char *event_pin_name[40];
+static int event_pin[40];
+static int event_npins;
+
+//
+// Print an input event.
+//
+static int print_event(int pin, int value, void *arg)
+{
+    struct timeval tv;
+    int i;
+
+    gettimeofday(&tv, 0);
+    for (i = 0; i < event_npins; i++) {
+        if (event_pin[i] == pin) {
+            printf("%ld.%06ld %s %d\n", (long)tv.tv_sec, (long)tv.tv_usec,
+                event_pin_name[i], value);
+            fflush(stdout);
+            break;
         }
     }
+    return 0;
 }
 
-int main(int argc, char **argv)
+//
+// gpio debounce [-p <usec>] <pin>[:<msec>]...
+// Filter inputs and print every change of a stable state.
+// Default sampling period is 1 msec, default integration time is 5 msec.
+//
+void do_debounce(int argc, char **argv)
 {
-    const char *env_debug = getenv("GPIO_DEBUG");
+    gpio_debounce_t db[GPIO_NPORTS];
+    int ndb = 0;
+    unsigned period = 1000;
+    int i, k, opt;
 
-    for (;;) {
-        switch (getopt(argc, argv, "vhd")) {
-        case EOF:
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+p:")) != -1) {
+        switch (opt) {
+        case 'p':
+            period = number_by_name("period", optarg, 1, 1000000);
             break;
-        case 'v':
-            printf("gpio version: %s\n", version);
-            return 0;
-        case 'h':
-            usage();
-            return 0;
-        case 'd':
-            ++gpio_debug;
-            continue;
         default:
-            usage();
+            goto usage;
         }
-        break;
     }
-    argc -= optind;
-    argv += optind;
+    if (optind >= argc || argc - optind > 40) {
+usage:  fprintf(stderr, "Usage: gpio debounce [-p <usec>] <pin>[:<msec>]...\n");
+        exit(-1);
+    }
 
-    if (argc < 1) {
-        usage();
-        return -1;
+    int nsamples[40];
+    for (i = optind; i < argc; i++) {
+        char *colon = strchr(argv[i], ':');
+        unsigned msec = 5;
+
+        if (colon) {
+            *colon = 0;
+            msec = number_by_name("integration time", colon + 1, 0, 1000000);
+        }
+
+        int pin = pin_by_name(argv[i]);
+        int n = (msec * 1000 + period - 1) / period;
+        if (n < 1)
+            n = 1;
+        if (n > GPIO_DEBOUNCE_MAX) {
+            fprintf(stderr, "gpio: Integration time for %s limited to %u msec\n",
+                argv[i], GPIO_DEBOUNCE_MAX * period / 1000);
+            n = GPIO_DEBOUNCE_MAX;
+        }
+        gpio_set_mode(pin, MODE_INPUT);
+        event_pin_name[event_npins] = argv[i];
+        event_pin[event_npins] = pin;
+        nsamples[event_npins] = n;
+        event_npins++;
     }
 
-    if (!gpio_debug && env_debug)
-        gpio_debug = atoi(env_debug);
+    // Create one filter per port.
+    for (i = 0; i < event_npins; i++) {
+        int port = GPIO_PORT(event_pin[i]);
+        unsigned mask = 0;
 
-    if (strcasecmp(argv[0], "pins") == 0) {
-        do_pins();
-        return 0;
+        for (k = 0; k < ndb; k++) {
+            if (db[k].port == port)
+                break;
+        }
+        if (k < ndb)
+            continue;
+
+        for (k = i; k < event_npins; k++) {
+            if (GPIO_PORT(event_pin[k]) == port)
+                mask |= GPIO_MASK(event_pin[k]);
+        }
+        gpio_debounce_init(&db[ndb++], port, mask, GPIO_DEBOUNCE_MAX);
     }
-    if (strcasecmp(argv[0], "modes") == 0) {
-        do_modes();
-        return 0;
+
+    // Set integration time per pin.
+    for (i = 0; i < event_npins; i++) {
+        for (k = 0; k < ndb; k++) {
+            if (db[k].port == GPIO_PORT(event_pin[i]))
+                gpio_debounce_set_samples(&db[k], event_pin[i], nsamples[i]);
+        }
+    }
+    gpio_debounce_run(db, ndb, period, print_event, 0);
+}
+
+//
+// gpio encoder [-p <usec>] [-c] <pin-a> <pin-b>...
+// Decode quadrature encoders and print position, velocity
+// and error count of every encoder, when they change.
+//
+void do_encoder(int argc, char **argv)
+{
+    gpio_encoder_t enc[20];
+    gpio_encoder_group_t grp;
+    unsigned period = 100;
+    int use_change = 0;
+    int nenc, i, opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+p:c")) != -1) {
+        switch (opt) {
+        case 'p':
+            period = number_by_name("period", optarg, 0, 1000000);
+            break;
+        case 'c':
+            use_change = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    nenc = (argc - optind) / 2;
+    if (nenc < 1 || nenc > 20 || (argc - optind) % 2 != 0) {
+usage:  fprintf(stderr, "Usage: gpio encoder [-p <usec>] [-c] <pin-a> <pin-b>...\n");
+        exit(-1);
     }
 
-    if (geteuid () != 0) {
-        fprintf(stderr, "gpio: Must be root to run.\n");
-        return -1;
+    for (i = 0; i < nenc; i++)
+        gpio_encoder_init(&enc[i], pin_by_name(argv[optind + 2*i]),
+                                   pin_by_name(argv[optind + 1 + 2*i]));
+
+    gpio_encoder_group_init(&grp, enc, nenc, period, use_change);
+    if (gpio_encoder_start(&grp) < 0) {
+        fprintf(stderr, "gpio: Cannot start encoder thread: %s\n", strerror(errno));
+        exit(-1);
     }
 
-    if      (strcasecmp(argv[0], "mode")    == 0) do_mode(argc, argv);
-    else if (strcasecmp(argv[0], "read")    == 0) do_read(argc, argv);
-    else if (strcasecmp(argv[0], "write")   == 0) do_write(argc, argv);
-    else if (strcasecmp(argv[0], "toggle")  == 0) do_toggle(argc, argv);
-    else if (strcasecmp(argv[0], "blink")   == 0) do_blink(argc, argv);
-    else if (strcasecmp(argv[0], "readall") == 0) do_readall();
-    else {
-        fprintf(stderr, "gpio: Unknown command: %s.\n", argv[0]);
-        return -1;
+    int32_t last[20][3];
+    memset(last, 0xff, sizeof(last));
+    for (;;) {
+        int changed = 0;
+
+        for (i = 0; i < nenc; i++) {
+            int32_t pos = gpio_encoder_position(&enc[i]);
+            int32_t vel = gpio_encoder_velocity(&enc[i]);
+            int32_t err = gpio_encoder_errors(&enc[i]);
+
+            if (pos != last[i][0] || vel != last[i][1] || err != last[i][2])
+                changed = 1;
+            last[i][0] = pos;
+            last[i][1] = vel;
+            last[i][2] = err;
+        }
+        if (changed) {
+            for (i = 0; i < nenc; i++)
+                printf("%s%d %d/s %d err", i ? "  " : "", last[i][0], last[i][1], last[i][2]);
+            printf("\n");
+            fflush(stdout);
+        }
+        usleep(100000);
     }
+}
 
-    return 0;
+//
+// gpio onewire <pin> search|temp
+// Find devices on 1-Wire bus, or read all temperature sensors.
+//
+void do_onewire(int argc, char **argv)
+{
+    gpio_onewire_t ow;
+    uint8_t rom[64][8];
+    int temp[64];
+    int ndev, i;
+
+    if (argc != 3 || (strcasecmp(argv[2], "search") != 0 &&
+                      strcasecmp(argv[2], "temp") != 0)) {
+        fprintf(stderr, "Usage: gpio onewire <pin> search|temp\n");
+        exit(-1);
+    }
+
+    int pin = pin_by_name(argv[1]);
+
+    // Timing is critical: avoid preemption, if permitted.
+    gpio_set_realtime(-1);
+    gpio_onewire_init(&ow, pin);
+
+    ndev = gpio_onewire_search(&ow, rom, 64);
+    if (ndev == 0) {
+        fprintf(stderr, "gpio: No 1-Wire devices found.\n");
+        exit(-1);
+    }
+
+    if (strcasecmp(argv[2], "temp") == 0 &&
+        gpio_onewire_read_temps(&ow, rom, ndev, temp) < 0) {
+        fprintf(stderr, "gpio: 1-Wire bus not responding.\n");
+        exit(-1);
+    }
+
+    for (i = 0; i < ndev; i++) {
+        // Linux-style name: family code, then serial number MSB first.
+        printf("%02x-%02x%02x%02x%02x%02x%02x", rom[i][0], rom[i][6], rom[i][5],
+            rom[i][4], rom[i][3], rom[i][2], rom[i][1]);
+        if (strcasecmp(argv[2], "temp") == 0) {
+            if (temp[i] == GPIO_ONEWIRE_NOTEMP)
+                printf(" error");
+            else
+                printf(" %.4f", temp[i] / 16.0);
+        }
+        printf("\n");
+    }
+}
+
+//
+// gpio leds <pin> <count> <rrggbb>... | -
+// Show colors on a strip of WS2812 LEDs.  The list of colors is repeated
+// to fill the strip.  With "-", read frames of RGB bytes from stdin
+// and show them as they come.
+//
+void do_leds(int argc, char **argv)
+{
+    gpio_leds_t leds;
+    int i;
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: gpio leds <pin> <count> <rrggbb>... | -\n");
+        exit(-1);
+    }
+
+    int pin = pin_by_name(argv[1]);
+    int count = number_by_name("LED count", argv[2], 1, GPIO_LEDS_MAX);
+    if (gpio_leds_open(&leds, pin, count) < 0) {
+        fprintf(stderr, "gpio: Cannot drive LEDs from %s: %s\n", argv[1],
+            errno == EINVAL ? "no SDO function on this pin" : strerror(errno));
+        exit(-1);
+    }
+
+    if (strcmp(argv[3], "-") != 0) {
+        // Colors from command line.
+        int ncolors = argc - 3;
+
+        for (i = 0; i < count; i++)
+            gpio_leds_set(&leds, i, strtoul(argv[3 + i % ncolors], 0, 16));
+        gpio_leds_show(&leds);
+    } else {
+        // Stream of frames from stdin.
+        size_t nbytes = (size_t) count * 3;
+        uint8_t *frame = malloc(nbytes);
+
+        while (frame && fread(frame, 1, nbytes, stdin) == nbytes) {
+            for (i = 0; i < count; i++)
+                gpio_leds_set(&leds, i, frame[3*i] << 16 | frame[3*i+1] << 8 | frame[3*i+2]);
+            gpio_leds_show(&leds);
+        }
+        free(frame);
+    }
+    gpio_leds_close(&leds);
+}
+
+//
+// gpio shift <data> <clock> <latch> <nbits> write <hex> | read
+// Write a frame to a chain of 74HC595, or read a chain of 74HC165.
+// Bit 0 of the hex value is the first output of the nearest register.
+//
+void do_shift(int argc, char **argv)
+{
+    gpio_shift_t sh;
+    int write = (argc == 7 && strcasecmp(argv[5], "write") == 0);
+    int i;
+
+    if (!write && !(argc == 6 && strcasecmp(argv[5], "read") == 0)) {
+        fprintf(stderr, "Usage: gpio shift <data> <clock> <latch> <nbits> write <hex> | read\n");
+        exit(-1);
+    }
+
+    int nbits = strtol(argv[4], 0, 0);
+    if (gpio_shift_init(&sh, pin_by_name(argv[1]), pin_by_name(argv[2]),
+                        pin_by_name(argv[3]), nbits, !write) < 0) {
+        fprintf(stderr, "gpio: Pins must be on the same port, and length a multiple of 8 up to %d.\n",
+            GPIO_SHIFT_MAXBITS);
+        exit(-1);
+    }
+
+    if (write) {
+        // Parse hex digits from the end: the last digit gives bits 3:0.
+        const char *hex = argv[6];
+        int len = strlen(hex);
+
+        if (len > 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) {
+            hex += 2;
+            len -= 2;
+        }
+        for (i = 0; i < len && 4*i < nbits; i++) {
+            char c = hex[len - 1 - i];
+            int digit = (c >= '0' && c <= '9') ? c - '0' :
+                        (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                        (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (digit < 0) {
+                fprintf(stderr, "gpio: Wrong hex value: %s\n", argv[6]);
+                exit(-1);
+            }
+            sh.out[i / 2] |= digit << (4 * (i % 2));
+        }
+        gpio_shift_update(&sh);
+    } else {
+        gpio_shift_read(&sh);
+        for (i = nbits/8 - 1; i >= 0; i--)
+            printf("%02x", sh.in[i]);
+        printf("\n");
+    }
+}
+
+//
+// gpio lcd [-8] <rows>x<cols> <rs> <rw>|- <e> <d4>...<d7> | <d0>...<d7> [<text>...]
+// Show lines of text on HD44780 display.  With -8, the display is
+// connected by eight data lines instead of four.  Without text, read updates
+// from stdin as "<row> <text>" lines: only changed characters are sent.
+//
+void do_lcd(int argc, char **argv)
+{
+    gpio_lcd_t lcd;
+    int rows, cols, data[8], nbits = 4, i;
+    char c;
+
+    if (argc > 1 && strcmp(argv[1], "-8") == 0) {
+        nbits = 8;
+        argc--;
+        argv++;
+    }
+    if (argc < 5 + nbits || sscanf(argv[1], "%dx%d%c", &rows, &cols, &c) != 2) {
+        fprintf(stderr, "Usage: gpio lcd [-8] <rows>x<cols> <rs> <rw>|- <e> <d4>...<d7> | <d0>...<d7> [<text>...]\n");
+        exit(-1);
+    }
+    for (i = 0; i < nbits; i++)
+        data[i] = pin_by_name(argv[5 + i]);
+
+    int rw = (strcmp(argv[3], "-") == 0) ? -1 : pin_by_name(argv[3]);
+    if (gpio_lcd_init(&lcd, rows, cols, pin_by_name(argv[2]), rw,
+                      pin_by_name(argv[4]), data, nbits) < 0) {
+        fprintf(stderr, "gpio: Wrong display size, or data pins on too many ports.\n");
+        exit(-1);
+    }
+
+    if (argc > 5 + nbits) {
+        for (i = 5 + nbits; i < argc; i++)
+            gpio_lcd_print(&lcd, i - 5 - nbits, 0, argv[i]);
+        gpio_lcd_update(&lcd);
+        return;
+    }
+
+    char line[128];
+    while (fgets(line, sizeof(line), stdin)) {
+        char *text;
+        int row = strtol(line, &text, 0);
+
+        if (*text == ' ')
+            text++;
+        text[strcspn(text, "\n")] = 0;
+
+        // Pad with spaces to clear the rest of the row.
+        gpio_lcd_print(&lcd, row, 0, text);
+        for (i = strlen(text); i < cols; i++)
+            gpio_lcd_print(&lcd, row, i, " ");
+        gpio_lcd_update(&lcd);
+    }
+}
+
+//
+// Parse comma-separated list of pins.  Return the number of pins.
+//
+static int pin_list(char *arg, int *pin, int maxpins)
+{
+    char *name;
+    int n = 0;
+
+    for (name = strtok(arg, ","); name; name = strtok(0, ",")) {
+        if (n >= maxpins)
+            return -1;
+        pin[n++] = pin_by_name(name);
+    }
+    return n;
+}
+
+//
+// Key labels for keypad command.
+//
+static const char *keypad_keys;
+static int keypad_ncols;
+
+//
+// Print a key event.
+//
+static int print_key(int row, int col, int pressed, void *arg)
+{
+    struct timeval tv;
+    int key = row * keypad_ncols + col;
+
+    gettimeofday(&tv, 0);
+    if (keypad_keys && key < (int) strlen(keypad_keys))
+        printf("%ld.%06ld %c %s\n", (long)tv.tv_sec, (long)tv.tv_usec,
+            keypad_keys[key], pressed ? "down" : "up");
+    else
+        printf("%ld.%06ld %d,%d %s\n", (long)tv.tv_sec, (long)tv.tv_usec,
+            row, col, pressed ? "down" : "up");
+    fflush(stdout);
+    return 0;
+}
+
+//
+// gpio keypad [-p <usec>] <row>,<row>... <col>,<col>... [<keys>]
+// Scan matrix keypad and print every key press and release.
+// Keys are labeled by a string in row order, like "123A456B789C*0#D".
+// Default scan period is 1 msec, with 5 samples to debounce.
+//
+void do_keypad(int argc, char **argv)
+{
+    gpio_keypad_t kp;
+    int row[GPIO_KEYPAD_MAX], col[GPIO_KEYPAD_MAX], nrows, ncols;
+    unsigned period = 1000;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+p:")) != -1) {
+        switch (opt) {
+        case 'p':
+            period = number_by_name("period", optarg, 1, 1000000);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (argc - optind < 2 || argc - optind > 3) {
+usage:  fprintf(stderr, "Usage: gpio keypad [-p <usec>] <row>,<row>... <col>,<col>... [<keys>]\n");
+        exit(-1);
+    }
+    nrows = pin_list(argv[optind], row, GPIO_KEYPAD_MAX);
+    ncols = pin_list(argv[optind + 1], col, GPIO_KEYPAD_MAX);
+    if (nrows < 1 || ncols < 1)
+        goto usage;
+    if (argc - optind > 2)
+        keypad_keys = argv[optind + 2];
+    keypad_ncols = ncols;
+
+    int nsamples = (5000 + period - 1) / period;
+    if (nsamples > GPIO_DEBOUNCE_MAX)
+        nsamples = GPIO_DEBOUNCE_MAX;
+    if (gpio_keypad_init(&kp, row, nrows, col, ncols, nsamples) < 0) {
+        fprintf(stderr, "gpio: Cannot initialize keypad: %s\n", strerror(errno));
+        exit(-1);
+    }
+    gpio_keypad_run(&kp, period, print_key, 0);
+}
+
+//
+// gpio stepper [-s] [-v <steps/sec>] [-a <steps/sec2>] <step> <dir> <steps>...
+// Move one or several stepper motors together, with acceleration
+// and deceleration.  With -s, use S-curve instead of trapezoidal profile.
+// Default speed is 1000 steps/sec, acceleration 5000 steps/sec^2.
+//
+void do_stepper(int argc, char **argv)
+{
+    gpio_stepper_t axis[8];
+    gpio_profile_t profile = GPIO_PROFILE_TRAPEZOID;
+    double speed = 1000, accel = 5000;
+    int naxes = 0, opt, i;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+sv:a:")) != -1) {
+        switch (opt) {
+        case 's':
+            profile = GPIO_PROFILE_SCURVE;
+            break;
+        case 'v':
+            speed = strtod(optarg, 0);
+            break;
+        case 'a':
+            accel = strtod(optarg, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 3 || argc % 3 != 0 || argc / 3 > 8) {
+usage:  fprintf(stderr, "Usage: gpio stepper [-s] [-v <steps/sec>] [-a <steps/sec2>] <step> <dir> <steps>...\n");
+        exit(-1);
+    }
+
+    for (i = 0; i < argc; i += 3) {
+        gpio_stepper_t *st = &axis[naxes++];
+
+        gpio_stepper_init(st, pin_by_name(argv[i]), pin_by_name(argv[i+1]));
+        if (gpio_stepper_plan(st, strtol(argv[i+2], 0, 0), speed, accel, profile) < 0) {
+            fprintf(stderr, "gpio: Cannot plan move of %s: %s\n", argv[i], strerror(errno));
+            exit(-1);
+        }
+    }
+
+    gpio_set_realtime(-1);
+    uint64_t t0 = gpio_time_ns();
+    gpio_stepper_run(axis, naxes);
+    uint64_t t = gpio_time_ns() - t0;
+
+    for (i = 0; i < naxes; i++) {
+        gpio_stepper_t *st = &axis[i];
+
+        if (st->oc)
+            printf("%s: %d steps, OC%d", argv[3*i], st->position, st->oc);
+        else
+            printf("%s: %d steps, max late %u usec", argv[3*i], st->position, st->late_ns / 1000);
+        printf("\n");
+        gpio_stepper_close(st);
+    }
+    printf("Time %.3f sec\n", t / 1e9);
+}
+
+//
+// Get analog input of a pin, given by name or as an<N>,
+// and switch the pin to analog mode.
+//
+static int adc_channel_by_name(const char *name)
+{
+    int channel;
+
+    if (strncasecmp(name, "an", 2) == 0) {
+        channel = strtol(name + 2, 0, 10);
+    } else {
+        int pin = pin_by_name(name);
+
+        channel = gpio_adc_channel(pin);
+        if (channel >= 0)
+            gpio_set_mode(pin, MODE_ANALOG);
+    }
+    if (channel < 0 || channel > 63) {
+        fprintf(stderr, "gpio: No analog input at %s\n", name);
+        exit(-1);
+    }
+    return channel;
+}
+
+//
+// gpio aread <pin>...
+// Convert analog inputs and print the values.
+// Pins are given by name, or as an<N> for analog input N.
+//
+void do_aread(int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: gpio aread <pin>|an<N>...\n");
+        exit(-1);
+    }
+    for (i = 1; i < argc; i++) {
+        int channel = adc_channel_by_name(argv[i]);
+        int value = gpio_adc_read(channel);
+
+        if (value < 0) {
+            fprintf(stderr, "gpio: ADC failed: %s\n", strerror(errno));
+            exit(-1);
+        }
+        printf("%s AN%d %d %.3fV\n", argv[i], channel, value, value * 3.3 / 4095);
+    }
+}
+
+//
+// gpio ascan [-r <hz>] [-n <count>] <pin>...
+// Scan analog inputs continuously and print a line per scan:
+// time in seconds and a value for every input.
+// Default rate is 100 Hz, default count is unlimited.
+//
+void do_ascan(int argc, char **argv)
+{
+    gpio_adc_scan_t scan;
+    gpio_adc_frame_t frame;
+    int channel[GPIO_ADC_MAXSCAN];
+    unsigned rate = 100, count = 0, n = 0;
+    int nchan = 0, opt, i;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+r:n:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rate = strtoul(optarg, 0, 0);
+            break;
+        case 'n':
+            count = strtoul(optarg, 0, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind >= argc || argc - optind > GPIO_ADC_MAXSCAN || rate == 0) {
+usage:  fprintf(stderr, "Usage: gpio ascan [-r <hz>] [-n <count>] <pin>|an<N>...\n");
+        exit(-1);
+    }
+    for (i = optind; i < argc; i++)
+        channel[nchan++] = adc_channel_by_name(argv[i]);
+
+    // Buffer one second of scans.
+    if (gpio_adc_scan_start(&scan, channel, nchan, rate, rate) < 0) {
+        fprintf(stderr, "gpio: Cannot start ADC scan: %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    uint64_t t0 = gpio_time_ns();
+    while (count == 0 || n < count) {
+        if (!gpio_adc_scan_get(&scan, &frame)) {
+            fflush(stdout);
+            usleep(scan.period_usec / 2 + 1);
+            continue;
+        }
+        printf("%.6f", (int64_t) (frame.time_ns - t0) / 1e9);
+        for (i = 0; i < nchan; i++)
+            printf(" %d", frame.value[i]);
+        printf("\n");
+        n++;
+    }
+    gpio_adc_scan_stop(&scan);
+    if (scan.overruns > 0)
+        fprintf(stderr, "gpio: %u scans dropped\n", scan.overruns);
+}
+
+//
+// gpio clock <pin> <freq>[k|m] | off
+// Output reference clock on a pin, with the closest achievable frequency.
+// Source can be forced by environment variable GPIO_REFCLK_SOURCE:
+// 0 - sysclk, 1 - pbclk1, 2 - posc, 3 - frc, 4 - lprc.
+//
+void do_clock(int argc, char **argv)
+{
+    static const gpio_mode_t refclko[] = { MODE_REFCLKO1, MODE_REFCLKO3, MODE_REFCLKO4 };
+    static const int refo_num[] = { 1, 3, 4 };
+    int i;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: gpio clock <pin> <freq>[k|m] | off\n");
+        exit(-1);
+    }
+    int pin = pin_by_name(argv[1]);
+    for (i = 0; i < 3; i++) {
+        if (gpio_has_mapping(pin, refclko[i]))
+            break;
+    }
+    if (i == 3) {
+        fprintf(stderr, "gpio: No reference clock output at %s\n", argv[1]);
+        exit(-1);
+    }
+
+    if (strcasecmp(argv[2], "off") == 0) {
+        gpio_refclk_disable(refo_num[i]);
+        gpio_set_mode(pin, MODE_INPUT);
+        return;
+    }
+
+    char *end;
+    double hz = strtod(argv[2], &end);
+    if (*end == 'k' || *end == 'K')
+        hz *= 1e3;
+    else if (*end == 'm' || *end == 'M')
+        hz *= 1e6;
+
+    const char *env = getenv("GPIO_REFCLK_SOURCE");
+    double f = gpio_refclk_enable(refo_num[i], env ? atoi(env) : -1, hz);
+    if (f < 0) {
+        fprintf(stderr, "gpio: Cannot set reference clock: %s\n", strerror(errno));
+        exit(-1);
+    }
+    gpio_set_mode(pin, refclko[i]);
+    printf("REFCLKO%d: %.3f Hz, error %+.1f ppm\n", refo_num[i], f, (f - hz) / hz * 1e6);
+}
+
+//
+// Stop continuous frequency measurement on interrupt.
+//
+static volatile int freq_stop;
+
+static void freq_interrupt(int sig)
+{
+    freq_stop = 1;
+}
+
+//
+// gpio freq [-w <msec>] [-c] <pin>
+// Measure frequency of a signal on a pin, with a timer clocked by it.
+// Default gate window is 1 second.  With -c, measure continuously
+// and print a line per window, until interrupted.
+//
+void do_freq(int argc, char **argv)
+{
+    gpio_freq_t fc;
+    unsigned window = 1000;
+    int continuous = 0, opt;
+    double hz, err;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+w:c")) != -1) {
+        switch (opt) {
+        case 'w':
+            // Window in usec must fit 32 bits.
+            window = number_by_name("window", optarg, 1, 3600000);
+            break;
+        case 'c':
+            continuous = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1) {
+usage:  fprintf(stderr, "Usage: gpio freq [-w <msec>] [-c] <pin>\n");
+        exit(-1);
+    }
+    if (gpio_freq_open(&fc, pin_by_name(argv[optind])) < 0) {
+        fprintf(stderr, "gpio: No free timer input at %s\n", argv[optind]);
+        exit(-1);
+    }
+    signal(SIGINT, freq_interrupt);
+    signal(SIGTERM, freq_interrupt);
+    gpio_set_realtime(-1);
+
+    do {
+        gpio_freq_measure(&fc, window * 1000, &hz, &err);
+        printf("%.3f Hz +- %.3f Hz (timer %d)\n", hz, err, fc.timer);
+        fflush(stdout);
+    } while (continuous && !freq_stop);
+    gpio_freq_close(&fc);
+}
+
+//
+// gpio extint [-c <cpu>] [-p <usec>] [-t <sec>] <pin>[:rise|fall|both]...
+// Count edges on pins through external interrupt inputs INT1...INT4.
+// Without -t, print every event.  With -t, count for a given time
+// and print totals.  The flags are polled every 100 usec by default;
+// -p 0 polls in a tight loop.  With -c, poll at real-time priority,
+// bound to a given CPU.
+//
+void do_extint(int argc, char **argv)
+{
+    gpio_extint_t ei;
+    unsigned period = 100, seconds = 0;
+    int cpu = -1, opt, i, x;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+c:p:t:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cpu = strtol(optarg, 0, 0);
+            break;
+        case 'p':
+            period = number_by_name("period", optarg, 0, 1000000);
+            break;
+        case 't':
+            seconds = strtoul(optarg, 0, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind >= argc || argc - optind > 4) {
+usage:  fprintf(stderr, "Usage: gpio extint [-c <cpu>] [-p <usec>] [-t <sec>] <pin>[:rise|fall|both]...\n");
+        exit(-1);
+    }
+
+    memset(&ei, 0, sizeof(ei));
+    for (i = optind; i < argc; i++) {
+        char *colon = strchr(argv[i], ':');
+        gpio_edge_t edge = GPIO_EDGE_RISING;
+
+        if (colon) {
+            *colon++ = 0;
+            if (strcasecmp(colon, "fall") == 0)
+                edge = GPIO_EDGE_FALLING;
+            else if (strcasecmp(colon, "both") == 0)
+                edge = GPIO_EDGE_BOTH;
+            else if (strcasecmp(colon, "rise") != 0)
+                goto usage;
+        }
+        int pin = pin_by_name(argv[i]);
+        if (gpio_extint_add(&ei, pin, edge) < 0) {
+            fprintf(stderr, "gpio: No free external interrupt input at %s\n", argv[i]);
+            exit(-1);
+        }
+        event_pin_name[event_npins] = argv[i];
+        event_pin[event_npins] = pin;
+        event_npins++;
+    }
+    if (cpu >= 0)
+        gpio_set_realtime(cpu);
+
+    if (seconds == 0) {
+        gpio_extint_run(&ei, period, print_event, 0);
+        return;
+    }
+
+    struct timespec deadline = { 0 };
+    uint64_t t0 = gpio_time_ns();
+    uint64_t end = t0 + seconds * 1000000000ULL;
+    while (gpio_time_ns() < end) {
+        gpio_extint_poll(&ei);
+        if (period)
+            gpio_sleep_period(&deadline, period * 1000LL);
+    }
+    double t = (gpio_time_ns() - t0) / 1e9;
+
+    for (x = 0; x < 4; x++) {
+        for (i = 0; i < event_npins; i++) {
+            if (ei.pin[x] == event_pin[i])
+                printf("%s INT%d: %llu events, %.1f per sec, max latency %llu usec\n",
+                    event_pin_name[i], x+1, (unsigned long long) ei.count[x],
+                    ei.count[x] / t, (unsigned long long) ei.max_latency_ns[x] / 1000);
+        }
+    }
+}
+
+//
+// Read a whole file, or stdin for "-", or exit with a message.
+//
+static char *read_text(const char *filename)
+{
+    FILE *fd = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+    if (!fd) {
+        fprintf(stderr, "gpio: %s: %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+
+    char *text = 0;
+    size_t len = 0, size = 0, n;
+    do {
+        if (len + 4096 + 1 > size) {
+            size = 2 * size + 4096 + 1;
+            text = realloc(text, size);
+            if (!text) {
+                fprintf(stderr, "gpio: Out of memory\n");
+                exit(-1);
+            }
+        }
+        n = fread(text + len, 1, 4096, fd);
+        len += n;
+    } while (n > 0);
+    text[len] = 0;
+    if (fd != stdin)
+        fclose(fd);
+    return text;
+}
+
+//
+// gpio run [-c <cpu>] <file> | -
+// Compile a pin sequence and run it on a real-time thread,
+// optionally bound to a given CPU.  Print counter registers at exit.
+//
+void do_run(int argc, char **argv)
+{
+    gpio_seq_t seq;
+    int cpu = -1, opt, i;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+c:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cpu = strtol(optarg, 0, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1) {
+usage:  fprintf(stderr, "Usage: gpio run [-c <cpu>] <file> | -\n");
+        exit(-1);
+    }
+
+    const char *filename = argv[optind];
+    char *text = read_text(filename);
+
+    if (gpio_seq_compile(&seq, text) < 0) {
+        fprintf(stderr, "gpio: %s, line %d: %s\n", filename, seq.error_line, seq.error);
+        exit(-1);
+    }
+    free(text);
+
+    if (gpio_seq_run(&seq, cpu) < 0) {
+        fprintf(stderr, "gpio: Sequence failed\n");
+        exit(-1);
+    }
+    for (i = 0; i < 8; i++) {
+        if (seq.used & (1 << i))
+            printf("r%d = %d\n", i, seq.reg[i]);
+    }
+    gpio_seq_free(&seq);
+}
+
+//
+// gpio wait [-s <usec>] <pin> rise|fall|both [<sec>]
+// Wait for an edge on a pin and print the detection latency.
+// Spin for a given time (default 1 msec) before sleeping between polls.
+// Exit status is 1 on timeout.
+//
+void do_wait(int argc, char **argv)
+{
+    static const char *edge_name[] = { "fall", "rise", "pulse" };
+    gpio_wait_result_t result;
+    gpio_edge_t edge;
+    unsigned spin = 1000;
+    int timeout = -1, opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+s:")) != -1) {
+        switch (opt) {
+        case 's':
+            spin = strtoul(optarg, 0, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (argc - optind < 2 || argc - optind > 3) {
+usage:  fprintf(stderr, "Usage: gpio wait [-s <usec>] <pin> rise|fall|both [<sec>]\n");
+        exit(-1);
+    }
+    if (strcasecmp(argv[optind+1], "rise") == 0)
+        edge = GPIO_EDGE_RISING;
+    else if (strcasecmp(argv[optind+1], "fall") == 0)
+        edge = GPIO_EDGE_FALLING;
+    else if (strcasecmp(argv[optind+1], "both") == 0)
+        edge = GPIO_EDGE_BOTH;
+    else
+        goto usage;
+    if (argc - optind == 3)
+        timeout = strtod(argv[optind+2], 0) * 1000;
+
+    int pin = pin_by_name(argv[optind]);
+    int status = gpio_wait_edge(pin, edge, timeout, spin, &result);
+    if (status < 0) {
+        fprintf(stderr, "gpio: Cannot wait on %s: %s\n", argv[optind], strerror(errno));
+        exit(-1);
+    }
+    if (status == 0) {
+        printf("timeout\n");
+        exit(1);
+    }
+    printf("%s, level %d, latency %.3f usec (%s)\n", edge_name[result.edge],
+        result.level, result.latency_ns / 1e3, result.spinning ? "spin" : "sleep");
+}
+
+//
+// Port register names in configuration files.
+//
+static const char *config_reg_name[] = {
+    "ansel", "tris", "lat", "odc", "cnpu", "cnpd",
+};
+
+//
+// gpio save
+// Print configuration of all ports and PPS registers.
+//
+void do_save(int argc, char **argv)
+{
+    gpio_config_t cfg;
+    int i, r;
+
+    if (argc != 1) {
+        fprintf(stderr, "Usage: gpio save\n");
+        exit(-1);
+    }
+    if (gpio_config_read(&cfg) < 0) {
+        fprintf(stderr, "gpio: Cannot read configuration: %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    printf("# Pin configuration, saved by gpio save\n");
+    for (i = 0; i < GPIO_NPORTS; i++) {
+        const unsigned *reg = &cfg.port[i].ansel;
+
+        printf("port %c", "ABCDEFGHJK"[i]);
+        for (r = 0; r < 6; r++)
+            printf(" %s 0x%04x", config_reg_name[r], reg[r]);
+        printf("\n");
+    }
+    for (i = 0; i < GPIO_PPS_NREGS; i++) {
+        const char *name = gpio_pps_name(GPIO_PPS_FIRST + 4*i);
+
+        if (name)
+            printf("pps %s %d\n", name, cfg.pps[i]);
+    }
+}
+
+//
+// Apply one statement of a configuration file:
+//      port <letter> [<register> <value>]...
+//      pps <register> <value>
+//      <pin> [in|out|analog|<function>] [up|down|off] [high|low] [od|pp]
+// Return an error message, or 0.
+//
+static const char *config_statement(gpio_config_t *cfg, char *word[], int nwords)
+{
+    int i, r;
+
+    if (strcasecmp(word[0], "port") == 0) {
+        const char *p = (nwords >= 2 && strlen(word[1]) == 1) ?
+                        strchr("ABCDEFGHJK", toupper(word[1][0])) : 0;
+        if (!p || nwords % 2 != 0)
+            return "Bad port statement";
+
+        unsigned *reg = &cfg->port[p - "ABCDEFGHJK"].ansel;
+        for (i = 2; i < nwords; i += 2) {
+            for (r = 0; r < 6; r++)
+                if (strcasecmp(word[i], config_reg_name[r]) == 0)
+                    break;
+            if (r == 6)
+                return "Unknown port register";
+            reg[r] = strtoul(word[i+1], 0, 0) & 0xffff;
+        }
+        return 0;
+    }
+
+    if (strcasecmp(word[0], "pps") == 0) {
+        if (nwords != 3)
+            return "Bad pps statement";
+        for (i = 0; i < GPIO_PPS_NREGS; i++) {
+            const char *name = gpio_pps_name(GPIO_PPS_FIRST + 4*i);
+
+            if (name && strcasecmp(word[1], name) == 0) {
+                cfg->pps[i] = strtoul(word[2], 0, 0) & 0xf;
+                return 0;
+            }
+        }
+        return "Unknown PPS register";
+    }
+
+    int pin = gpio_pin_by_name(word[0]);
+    if (pin < 0 || (pin & GPIO_VIRTUAL))
+        return "Unknown statement or pin";
+
+    gpio_port_config_t *port = &cfg->port[pin >> 24];
+    unsigned mask = GPIO_MASK(pin);
+    gpio_mode_t mode;
+    int status = 0;
+
+    for (i = 1; i < nwords && status == 0; i++) {
+        const char *w = word[i];
+
+        if      (strcasecmp(w, "in")     == 0) status = gpio_config_set_mode(cfg, pin, MODE_INPUT);
+        else if (strcasecmp(w, "input")  == 0) status = gpio_config_set_mode(cfg, pin, MODE_INPUT);
+        else if (strcasecmp(w, "out")    == 0) status = gpio_config_set_mode(cfg, pin, MODE_OUTPUT);
+        else if (strcasecmp(w, "output") == 0) status = gpio_config_set_mode(cfg, pin, MODE_OUTPUT);
+        else if (strcasecmp(w, "up")     == 0) status = gpio_config_set_pull(cfg, pin, PULL_UP);
+        else if (strcasecmp(w, "down")   == 0) status = gpio_config_set_pull(cfg, pin, PULL_DOWN);
+        else if (strcasecmp(w, "tri")    == 0) status = gpio_config_set_pull(cfg, pin, PULL_OFF);
+        else if (strcasecmp(w, "off")    == 0) status = gpio_config_set_pull(cfg, pin, PULL_OFF);
+        else if (strcasecmp(w, "high")   == 0) port->lat |= mask;
+        else if (strcasecmp(w, "low")    == 0) port->lat &= ~mask;
+        else if (strcasecmp(w, "od")     == 0) port->odc |= mask;
+        else if (strcasecmp(w, "pp")     == 0) port->odc &= ~mask;
+        else {
+            for (mode = 0; mode < MODE_LAST; mode++)
+                if (mode_name[mode] && strcasecmp(w, mode_name[mode]) == 0)
+                    break;
+            if (mode == MODE_LAST)
+                return "Unknown mode";
+            status = gpio_config_set_mode(cfg, pin, mode);
+        }
+    }
+    if (status < 0)
+        return "Wrong mode for this pin";
+    return 0;
+}
+
+//
+// gpio apply <file> | -
+// Apply a configuration, saved by gpio save or written by hand.
+// The file changes the live configuration; only registers
+// which differ are written.
+//
+void do_apply(int argc, char **argv)
+{
+    gpio_config_t cfg;
+    char line[1024], *word[16];
+    int lineno = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: gpio apply <file> | -\n");
+        exit(-1);
+    }
+    const char *filename = argv[1];
+    FILE *fd = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+    if (!fd) {
+        fprintf(stderr, "gpio: %s: %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+    if (gpio_config_read(&cfg) < 0) {
+        fprintf(stderr, "gpio: Cannot read configuration: %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    while (fgets(line, sizeof(line), fd)) {
+        int nwords = 0;
+        char *p;
+
+        lineno++;
+        p = strchr(line, '#');
+        if (p)
+            *p = 0;
+        for (p = strtok(line, " \t\r\n"); p && nwords < 16; p = strtok(0, " \t\r\n"))
+            word[nwords++] = p;
+        if (nwords == 0)
+            continue;
+
+        const char *error = config_statement(&cfg, word, nwords);
+        if (error) {
+            fprintf(stderr, "gpio: %s, line %d: %s\n", filename, lineno, error);
+            exit(-1);
+        }
+    }
+    if (fd != stdin)
+        fclose(fd);
+
+    if (gpio_config_apply(&cfg) < 0) {
+        fprintf(stderr, "gpio: Cannot apply configuration: %s\n", strerror(errno));
+        exit(-1);
+    }
+}
+
+//
+// Stop capture on interrupt.
+//
+static gpio_capture_t *capture_active;
+
+static void capture_interrupt(int sig)
+{
+    capture_active->stop = 1;
+}
+
+//
+// Add a condition to a capture trigger:
+//      <pin>=0|1                   Level of a pin
+//      <pin>:rise|fall|both        Edge on a pin
+//      <port>:<mask>=<value>       Levels of port pins
+// Return -1 on error.
+//
+static int trigger_condition(gpio_trigger_t *trig, const char *spec)
+{
+    const char *p;
+    char *end;
+    int port;
+
+    // Port condition.
+    if (spec[1] == ':' && strchr("ABCDEFGHJK", toupper(spec[0]))) {
+        port = strchr("ABCDEFGHJK", toupper(spec[0])) - "ABCDEFGHJK";
+        unsigned mask = strtoul(spec + 2, &end, 0);
+        if (*end != '=' || mask > 0xffff)
+            return -1;
+        unsigned value = strtoul(end + 1, &end, 0);
+        if (*end != 0)
+            return -1;
+        trig->mask[port] |= mask;
+        trig->value[port] = (trig->value[port] & ~mask) | (value & mask);
+        return 0;
+    }
+
+    p = strpbrk(spec, "=:");
+    if (!p || p - spec >= 16)
+        return -1;
+
+    char name[16];
+    memcpy(name, spec, p - spec);
+    name[p - spec] = 0;
+    int pin = pin_by_name(name);
+    if (pin & GPIO_VIRTUAL)
+        return -1;
+    port = pin >> 24;
+
+    if (*p == '=') {
+        if (strcmp(p+1, "0") != 0 && strcmp(p+1, "1") != 0)
+            return -1;
+        trig->mask[port] |= GPIO_MASK(pin);
+        if (p[1] == '1')
+            trig->value[port] |= GPIO_MASK(pin);
+        else
+            trig->value[port] &= ~GPIO_MASK(pin);
+    } else if (strcasecmp(p+1, "rise") == 0) {
+        trig->rise[port] |= GPIO_MASK(pin);
+    } else if (strcasecmp(p+1, "fall") == 0) {
+        trig->fall[port] |= GPIO_MASK(pin);
+    } else if (strcasecmp(p+1, "both") == 0) {
+        trig->rise[port] |= GPIO_MASK(pin);
+        trig->fall[port] |= GPIO_MASK(pin);
+    } else
+        return -1;
+    return 0;
+}
+
+//
+// gpio capture [-r <hz>] [-n <samples> | -t <sec>] [-c <cpu>]
+//              [-T <condition>]... [-b <samples>] [-a <samples>] <file> <port>|<pin>...
+// Sample whole ports to a file, as fast as possible or at a given rate,
+// until a number of samples or a time is reached, or interrupted.
+// A pin stands for its port.  With trigger conditions, all of which
+// must match, only segments around the triggers are written:
+// by default 1000 samples before and 1000 after every trigger.
+//
+void do_capture(int argc, char **argv)
+{
+    gpio_capture_t cap;
+    gpio_trigger_t trig;
+    char ports[GPIO_NPORTS + 1];
+    double rate = 0, seconds = 0;
+    uint64_t nsamples = 0;
+    unsigned pre = 1000, post = 1000;
+    int cpu = -1, nports = 0, triggered = 0, opt, i;
+
+    memset(&trig, 0, sizeof(trig));
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+r:n:t:c:T:b:a:")) != -1) {
+        switch (opt) {
+        case 'T':
+            if (trigger_condition(&trig, optarg) < 0) {
+                fprintf(stderr, "gpio: Wrong trigger condition: %s\n", optarg);
+                goto usage;
+            }
+            triggered = 1;
+            break;
+        case 'b':
+            pre = strtoul(optarg, 0, 0);
+            break;
+        case 'a':
+            post = strtoul(optarg, 0, 0);
+            break;
+        case 'r':
+            rate = strtod(optarg, 0);
+            break;
+        case 'n':
+            nsamples = strtoull(optarg, 0, 0);
+            break;
+        case 't':
+            seconds = strtod(optarg, 0);
+            break;
+        case 'c':
+            cpu = strtol(optarg, 0, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (argc - optind < 2 || rate < 0 || (nsamples && seconds)) {
+usage:  fprintf(stderr, "Usage: gpio capture [-r <hz>] [-n <samples> | -t <sec>] [-c <cpu>]\n");
+        fprintf(stderr, "                    [-T <condition>]... [-b <samples>] [-a <samples>]\n");
+        fprintf(stderr, "                    <file> <port>|<pin>...\n");
+        fprintf(stderr, "Trigger conditions:\n");
+        fprintf(stderr, "    <pin>=0|1                Level of a pin\n");
+        fprintf(stderr, "    <pin>:rise|fall|both     Edge on a pin\n");
+        fprintf(stderr, "    <port>:<mask>=<value>    Levels of port pins\n");
+        exit(-1);
+    }
+    for (i = optind+1; i < argc; i++) {
+        const char *name = argv[i];
+        int port = toupper(name[0]);
+
+        if (name[1] != 0 || !strchr("ABCDEFGHJK", port))
+            port = GPIO_PORT(pin_by_name(name));
+        if (memchr(ports, port, nports))
+            continue;
+        ports[nports++] = port;
+    }
+    ports[nports] = 0;
+
+    int64_t period = 0;
+    if (rate) {
+        // Period must fit 32-bit nanoseconds in the file header.
+        period = (rate >= 0.2 && rate <= 1e9) ? 1e9 / rate : -1;
+        if (period < 1 || period > UINT32_MAX) {
+            fprintf(stderr, "gpio: Wrong rate: %g, valid range is 0.233...1e9 Hz\n", rate);
+            exit(-1);
+        }
+    }
+
+    const char *filename = argv[optind];
+    FILE *fd = fopen(filename, "w");
+    if (!fd) {
+        fprintf(stderr, "gpio: %s: %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+    if (gpio_capture_open(&cap, fileno(fd), ports, period) < 0) {
+        fprintf(stderr, "gpio: Cannot capture ports %s: %s\n", ports, strerror(errno));
+        exit(-1);
+    }
+    if (triggered && gpio_capture_trigger(&cap, &trig, pre, post) < 0) {
+        fprintf(stderr, "gpio: Cannot set trigger: %s\n", strerror(errno));
+        if (errno == EINVAL)
+            fprintf(stderr, "gpio: Are the trigger pins in the captured ports %s?\n", ports);
+        exit(-1);
+    }
+    if (seconds) {
+        if (!period) {
+            fprintf(stderr, "gpio: Time limit needs a sampling rate\n");
+            exit(-1);
+        }
+        nsamples = seconds * rate;
+    }
+    if (cpu >= 0 && gpio_set_realtime(cpu) < 0)
+        fprintf(stderr, "gpio: Cannot bind to CPU %d: %s\n", cpu, strerror(errno));
+
+    capture_active = &cap;
+    signal(SIGINT, capture_interrupt);
+    signal(SIGTERM, capture_interrupt);
+
+    int status = gpio_capture_run(&cap, nsamples);
+    if (gpio_capture_close(&cap) < 0 || status < 0) {
+        fprintf(stderr, "gpio: %s: %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+    fclose(fd);
+
+    double elapsed = (cap.end_ns - cap.hdr.start_ns) / 1e9;
+    fprintf(stderr, "%llu samples of ports %s in %.3f sec, %.0f samples/sec",
+        (unsigned long long) cap.taken, ports, elapsed,
+        elapsed > 0 ? cap.taken / elapsed : 0);
+    if (period)
+        fprintf(stderr, ", %llu late", (unsigned long long) cap.late);
+    fprintf(stderr, "\n");
+    if (triggered)
+        fprintf(stderr, "%llu triggers, %llu samples written\n",
+            (unsigned long long) cap.hdr.ntriggers,
+            (unsigned long long) cap.hdr.nsamples);
+}
+
+//
+// Parse a decoder description:
+//      uart:<rx>[:<baud>]
+//      spi:<clk>,<mosi>[,<miso>[,<cs>]][:<mode>]
+//      i2c:<sda>,<scl>
+//      onewire:<dq>
+//
+static int decoder_spec(gpio_decoder_t *d, const char *spec)
+{
+    char buf[128], *pins, *param;
+    int n;
+
+    memset(d, 0, sizeof(*d));
+    memset(d->pin, -1, sizeof(d->pin));
+    if (strlen(spec) >= sizeof(buf))
+        return -1;
+    strcpy(buf, spec);
+    pins = strchr(buf, ':');
+    if (!pins)
+        return -1;
+    *pins++ = 0;
+    param = strchr(pins, ':');
+    if (param)
+        *param++ = 0;
+
+    if (strcasecmp(buf, "uart") == 0) {
+        d->proto = GPIO_PROTO_UART;
+        d->baud = param ? strtoul(param, 0, 0) : 9600;
+        n = pin_list(pins, d->pin, 1);
+        return (n == 1 && d->baud > 0) ? 0 : -1;
+    }
+    if (strcasecmp(buf, "spi") == 0) {
+        d->proto = GPIO_PROTO_SPI;
+        d->mode = param ? strtol(param, 0, 0) : 0;
+        n = pin_list(pins, d->pin, 4);
+        return (n >= 2 && d->mode >= 0 && d->mode <= 3) ? 0 : -1;
+    }
+    if (param)
+        return -1;
+    if (strcasecmp(buf, "i2c") == 0) {
+        d->proto = GPIO_PROTO_I2C;
+        return (pin_list(pins, d->pin, 2) == 2) ? 0 : -1;
+    }
+    if (strcasecmp(buf, "onewire") == 0) {
+        d->proto = GPIO_PROTO_ONEWIRE;
+        return (pin_list(pins, d->pin, 1) == 1) ? 0 : -1;
+    }
+    return -1;
+}
+
+//
+// Print a decoded frame as text.  Frames of a triggered capture
+// have the segment number and time relative to its trigger.
+//
+static void print_frame(const gpio_frame_t *f, const gpio_decoder_t *d,
+                        const char *spec, const gpio_capfile_t *file)
+{
+    double period_ns = file->hdr->period_ns;
+
+    if (file->segment) {
+        int64_t offset = f->sample % file->segment - file->hdr->pretrigger;
+
+        printf("#%llu %+.6f %s: ", (unsigned long long) (f->sample / file->segment),
+            offset * period_ns / 1e9, spec);
+    } else
+        printf("%.6f %s: ", f->sample * period_ns / 1e9, spec);
+    switch (f->type) {
+    case GPIO_FRAME_START:    printf("start\n");    return;
+    case GPIO_FRAME_STOP:     printf("stop\n");     return;
+    case GPIO_FRAME_RESET:    printf("reset\n");    return;
+    case GPIO_FRAME_PRESENCE: printf("presence\n"); return;
+    }
+    switch (d->proto) {
+    case GPIO_PROTO_UART:
+        printf("0x%02x", f->value);
+        if (f->value >= ' ' && f->value < 0x7f)
+            printf(" '%c'", f->value);
+        if (f->flags & GPIO_FLAG_ERROR)
+            printf(" framing error");
+        break;
+    case GPIO_PROTO_SPI:
+        printf("mosi 0x%02x", f->value & 0xff);
+        if (f->flags & GPIO_FLAG_MISO)
+            printf(" miso 0x%02x", f->value >> 8);
+        break;
+    case GPIO_PROTO_I2C:
+        if (f->flags & GPIO_FLAG_ADDRESS)
+            printf("address 0x%02x %s", f->value >> 1, (f->value & 1) ? "read" : "write");
+        else
+            printf("data 0x%02x", f->value);
+        printf((f->flags & GPIO_FLAG_NAK) ? " nak" : " ack");
+        break;
+    case GPIO_PROTO_ONEWIRE:
+        printf("0x%02x", f->value);
+        break;
+    }
+    printf("\n");
+}
+
+//
+// gpio decode [-b] <file> <decoder>...
+// Decode protocols from a capture file, every decoder on its own thread.
+// Frames are printed in time order, as text, or with -b as
+// binary gpio_frame_t records.
+//
+void do_decode(int argc, char **argv)
+{
+    gpio_capfile_t file;
+    int binary = 0, ndec, opt, i;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+b")) != -1) {
+        switch (opt) {
+        case 'b':
+            binary = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    ndec = argc - optind - 1;
+    if (ndec < 1 || ndec > 256) {
+usage:  fprintf(stderr, "Usage: gpio decode [-b] <file> <decoder>...\n");
+        fprintf(stderr, "Decoders:\n");
+        fprintf(stderr, "    uart:<rx>[:<baud>]\n");
+        fprintf(stderr, "    spi:<clk>,<mosi>[,<miso>[,<cs>]][:<mode>]\n");
+        fprintf(stderr, "    i2c:<sda>,<scl>\n");
+        fprintf(stderr, "    onewire:<dq>\n");
+        exit(-1);
+    }
+
+    gpio_decoder_t dec[ndec];
+    char **spec = argv + optind + 1;
+    for (i = 0; i < ndec; i++) {
+        if (decoder_spec(&dec[i], spec[i]) < 0) {
+            fprintf(stderr, "gpio: Wrong decoder: %s\n", spec[i]);
+            goto usage;
+        }
+    }
+
+    const char *filename = argv[optind];
+    if (gpio_capfile_open(&file, filename) < 0) {
+        fprintf(stderr, "gpio: %s: %s\n", filename, strerror(errno));
+        exit(-1);
+    }
+    if (gpio_decode(&file, dec, ndec) < 0) {
+        fprintf(stderr, "gpio: Cannot decode %s: %s\n", filename, strerror(errno));
+        if (errno == EINVAL)
+            fprintf(stderr, "gpio: Are the pins in the captured ports %.*s?\n",
+                (int) file.hdr->nports, file.hdr->port);
+        exit(-1);
+    }
+
+    // Merge the frames of all decoders, by time.
+    size_t next[ndec];
+    memset(next, 0, sizeof(next));
+    for (;;) {
+        const gpio_frame_t *f = 0;
+        int k = -1;
+
+        for (i = 0; i < ndec; i++) {
+            if (next[i] < dec[i].nframes &&
+                (!f || dec[i].frame[next[i]].sample < f->sample)) {
+                f = &dec[i].frame[next[i]];
+                k = i;
+            }
+        }
+        if (!f)
+            break;
+        next[k]++;
+        if (binary)
+            fwrite(f, sizeof(*f), 1, stdout);
+        else
+            print_frame(f, &dec[k], spec[k], &file);
+    }
+
+    for (i = 0; i < ndec; i++) {
+        if (gpio_debug)
+            fprintf(stderr, "--- %s: %llu edges, %zu frames\n", spec[i],
+                (unsigned long long) dec[i].nedges, dec[i].nframes);
+        gpio_decoder_free(&dec[i]);
+    }
+    gpio_capfile_close(&file);
+}
+
+//
+// Stop the rules on interrupt.
+//
+static gpio_rules_t *rules_active;
+
+static void rules_interrupt(int sig)
+{
+    rules_active->stop = 1;
+}
+
+//
+// gpio rules [-c <cpu>] [-p <usec>] <file> | -
+// Compile rules and evaluate them on a separate thread until interrupted.
+// The ports are polled every 100 usec by default, or with a given period;
+// -p 0 reads them continuously.  With -c, the thread runs at real-time
+// priority, bound to a given CPU.
+// Print how many times every rule fired at exit.
+//
+void do_rules(int argc, char **argv)
+{
+    static gpio_rules_t rules;
+    unsigned period = 100000;
+    int cpu = -1, opt, i;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+c:p:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cpu = strtol(optarg, 0, 0);
+            break;
+        case 'p':
+            period = number_by_name("period", optarg, 0, 1000000) * 1000;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1) {
+usage:  fprintf(stderr, "Usage: gpio rules [-c <cpu>] [-p <usec>] <file> | -\n");
+        fprintf(stderr, "Rules:\n");
+        fprintf(stderr, "    when <pin> 0|1|low|high|rise|fall|change [and] ... do <action>...\n");
+        fprintf(stderr, "Actions:\n");
+        fprintf(stderr, "    set|clear|toggle <pin>...\n");
+        fprintf(stderr, "    pulse <pin> <time>[ns|us|ms|s]\n");
+        exit(-1);
+    }
+
+    const char *filename = argv[optind];
+    char *text = read_text(filename);
+
+    if (gpio_rules_compile(&rules, text) < 0) {
+        fprintf(stderr, "gpio: %s, line %d: %s\n", filename, rules.error_line, rules.error);
+        exit(-1);
+    }
+    free(text);
+
+    rules_active = &rules;
+    signal(SIGINT, rules_interrupt);
+    signal(SIGTERM, rules_interrupt);
+
+    if (gpio_rules_run(&rules, cpu, period) < 0) {
+        fprintf(stderr, "gpio: Rules failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for (i = 0; i < rules.nrules; i++)
+        printf("Line %d: fired %llu times\n", rules.rule[i].line,
+            (unsigned long long) rules.rule[i].count);
+    printf("%llu samples, longest interval %.3f usec\n",
+        (unsigned long long) rules.nsamples, rules.max_gap_ns / 1e3);
+}
+
+static int run_command(int argc, char **argv);
+
+//
+// Print statistics of library operations, at exit of gpio stats.
+//
+static void print_stats()
+{
+    gpio_stats_t st;
+    int op, port, bit;
+
+    gpio_stats_read(&st);
+    fprintf(stderr, "Operation          Calls   Accesses   Avg nsec   p50 nsec   p99 nsec\n");
+    for (op = 0; op < GPIO_NOPS; op++) {
+        uint64_t calls = st.calls[op], count = 0;
+        int b, p50 = -1, p99 = -1;
+
+        if (!calls)
+            continue;
+
+        // Upper bounds of the buckets where the percentiles fall.
+        for (b = 0; b < GPIO_STATS_NBUCKETS; b++) {
+            count += st.hist[op][b];
+            if (p50 < 0 && count * 2 >= calls)
+                p50 = b;
+            if (p99 < 0 && count * 100 >= calls * 99)
+                p99 = b;
+        }
+        fprintf(stderr, "%-14s %9llu %10llu %10.1f %10llu %10llu\n",
+            gpio_stats_op_name(op), (unsigned long long) calls,
+            (unsigned long long) st.accesses[op], (double) st.time_ns[op] / calls,
+            1ULL << p50, 1ULL << p99);
+    }
+    for (port = 0; port < GPIO_NPORTS; port++) {
+        for (bit = 0; bit < 16; bit++) {
+            if (st.pin_writes[port][bit])
+                fprintf(stderr, "Pin R%c%d: %llu writes\n", "ABCDEFGHJK"[port], bit,
+                    (unsigned long long) st.pin_writes[port][bit]);
+        }
+    }
+}
+
+//
+// Pipe from the signal handler of gpio stats to its exit thread.
+//
+static int stats_pipe[2];
+
+//
+// Interrupted: wake up the exit thread.  Only write() is safe
+// to call here, so the exit is done outside the handler.
+//
+static void stats_interrupt(int sig)
+{
+    char c = sig;
+    int saved_errno = errno;
+    ssize_t n = write(stats_pipe[1], &c, 1);
+
+    (void) n;
+    errno = saved_errno;
+}
+
+//
+// Wait for an interrupt and exit normally, to print the statistics.
+//
+static void *stats_exit_thread(void *arg)
+{
+    char c;
+
+    while (read(stats_pipe[0], &c, 1) < 0 && errno == EINTR)
+        continue;
+    exit(0);
+}
+
+//
+// gpio stats [-s <socket>] <command> [<args>...]
+// Run a command with statistics of library operations enabled,
+// and print them to stderr when it finishes.  With -s, also serve
+// them in Prometheus text format on a Unix socket while it runs.
+//
+void do_stats(int argc, char **argv)
+{
+    const char *socket_path = 0;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+s:")) != -1) {
+        switch (opt) {
+        case 's':
+            socket_path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind >= argc || strcasecmp(argv[optind], "stats") == 0) {
+usage:  fprintf(stderr, "Usage: gpio stats [-s <socket>] <command> [<args>...]\n");
+        exit(-1);
+    }
+    if (socket_path && gpio_stats_serve(socket_path) < 0) {
+        fprintf(stderr, "gpio: %s: %s\n", socket_path, strerror(errno));
+        exit(-1);
+    }
+    gpio_stats_enable(1);
+    atexit(print_stats);
+
+    pthread_t thread;
+    if (pipe(stats_pipe) < 0 ||
+        pthread_create(&thread, 0, stats_exit_thread, 0) != 0) {
+        fprintf(stderr, "gpio: Cannot watch for interrupts\n");
+        exit(-1);
+    }
+    signal(SIGINT, stats_interrupt);
+    signal(SIGTERM, stats_interrupt);
+
+    if (run_command(argc - optind, argv + optind) < 0)
+        exit(-1);
+}
+
+//
+// Print rate of a benchmark loop.
+//
+static void print_rate(const char *name, unsigned count, uint64_t ns)
+{
+    printf("%-12s %10.3f Mops/sec %8.2f nsec/op\n", name,
+        count * 1e3 / ns, (double) ns / count);
+}
+
+//
+// gpio bench toggle [-n <count>] <pin>
+// Compare toggle rate of gpio_toggle() calls with
+// the inline gpio_fast_toggle() on a given output pin.
+//
+static void bench_toggle(int argc, char **argv)
+{
+    unsigned count = 10000000, i;
+    char *end;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, &end, 0);
+            if (*end)
+                goto usage;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1 || count == 0) {
+usage:  fprintf(stderr, "Usage: gpio bench toggle [-n <count>] <pin>\n");
+        exit(-1);
+    }
+
+    int pin = pin_by_name(argv[optind]);
+    if (pin & GPIO_VIRTUAL) {
+        fprintf(stderr, "gpio: Cannot benchmark virtual pin %s\n", argv[optind]);
+        exit(-1);
+    }
+    gpio_t *h = gpio_open();
+    if (!h) {
+        fprintf(stderr, "gpio: Cannot access GPIO registers: %s\n", strerror(errno));
+        exit(-1);
+    }
+    gpio_h_set_mode(h, pin, MODE_OUTPUT);
+    gpio_set_realtime(-1);
+
+    uint64_t t0 = gpio_time_ns();
+    for (i = 0; i < count; i++)
+        gpio_toggle(pin);
+    uint64_t t1 = gpio_time_ns();
+    for (i = 0; i < count; i++)
+        gpio_fast_toggle(h, pin);
+    uint64_t t2 = gpio_time_ns();
+
+    print_rate("gpio_toggle", count, t1 - t0);
+    print_rate("inline", count, t2 - t1);
+    printf("Speedup %.2f\n", (double) (t1 - t0) / (t2 - t1));
+    gpio_close(h);
+}
+
+//
+// Histogram of durations: bucket i counts times below 2^i nsec.
+//
+typedef struct {
+    uint64_t count, sum, min, max;
+    uint64_t lost;                  // Timeouts
+    uint64_t bucket[32];
+} bench_hist_t;
+
+static void hist_add(bench_hist_t *h, uint64_t ns)
+{
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    if (b > 31)
+        b = 31;
+    h->bucket[b]++;
+    if (h->count == 0 || ns < h->min)
+        h->min = ns;
+    if (ns > h->max)
+        h->max = ns;
+    h->count++;
+    h->sum += ns;
+}
+
+static void print_hist(const char *name, const bench_hist_t *h)
+{
+    uint64_t top = 0;
+    int b;
+
+    printf("%s:", name);
+    if (h->count == 0) {
+        printf(" no samples, %llu lost\n", (unsigned long long) h->lost);
+        return;
+    }
+    printf(" min %llu, avg %.1f, max %llu nsec", (unsigned long long) h->min,
+        (double) h->sum / h->count, (unsigned long long) h->max);
+    if (h->lost)
+        printf(", %llu lost", (unsigned long long) h->lost);
+    printf("\n");
+
+    for (b = 0; b < 32; b++)
+        if (h->bucket[b] > top)
+            top = h->bucket[b];
+    for (b = 0; b < 32; b++) {
+        if (!h->bucket[b])
+            continue;
+        printf("    < %10llu nsec %8llu  %.*s\n", 1ULL << b,
+            (unsigned long long) h->bucket[b],
+            (int) ((h->bucket[b] * 50 + top - 1) / top),
+            "##################################################");
+    }
+}
+
+//
+// Time between two clock readings, less the cost of reading.
+//
+static uint64_t bench_ns(uint64_t t0, uint64_t t1, uint64_t overhead)
+{
+    return (t1 - t0 > overhead) ? t1 - t0 - overhead : 0;
+}
+
+//
+// Ways to drive the output pin in the loopback test.
+//
+enum {
+    PATH_LAT,               // Read-modify-write of LAT
+    PATH_PORT,              // Read-modify-write of PORT
+    PATH_SETCLR,            // LATSET or LATCLR
+    PATH_INV,               // LATINV
+    PATH_LIBRARY,           // gpio_write()
+    NPATHS
+};
+
+static const char *path_name[NPATHS] = {
+    "LAT", "PORT", "LATSET/CLR", "LATINV", "gpio_write",
+};
+
+static inline void loopback_write(struct gpioreg *reg, int pin, int path, int value)
+{
+    unsigned mask = GPIO_MASK(pin);
+
+    switch (path) {
+    case PATH_LAT:
+        reg->lat = value ? (reg->lat | mask) : (reg->lat & ~mask);
+        break;
+    case PATH_PORT:
+        reg->port = value ? (reg->port | mask) : (reg->port & ~mask);
+        break;
+    case PATH_SETCLR:
+        (&reg->latclr)[value & 1] = mask;
+        break;
+    case PATH_INV:
+        reg->latinv = mask;
+        break;
+    default:
+        gpio_write(pin, value);
+        break;
+    }
+}
+
+//
+// Wait until the input pin has a given value.
+// Return time of arrival, or 0 after a timeout.
+//
+#define LOOPBACK_TIMEOUT_NS 1000000
+
+static uint64_t loopback_wait(struct gpioreg *reg, unsigned mask, int value, uint64_t t0)
+{
+    unsigned n;
+
+    for (n = 1; ((reg->port & mask) != 0) != value; n++) {
+        if (n % 64 == 0 && gpio_time_ns() - t0 > LOOPBACK_TIMEOUT_NS)
+            return 0;
+    }
+    return gpio_time_ns();
+}
+
+//
+// Drive the output to a known level by LATCLR or LATSET, and wait
+// for the input to follow.  Writes by LATINV depend on the previous
+// level, so every measurement starts from here.
+//
+static void loopback_level(struct gpioreg *oreg, unsigned omask,
+                           struct gpioreg *ireg, unsigned imask, int value)
+{
+    (&oreg->latclr)[value & 1] = omask;
+    loopback_wait(ireg, imask, value, gpio_time_ns());
+}
+
+//
+// gpio bench loopback [-n <count>] <out-pin> <in-pin>
+// Measure a hardware loop from an output pin to an input pin:
+// propagation latency through every register access path, maximum
+// toggle rates, with and without waiting for the input, and cost
+// of gpio_set_mode() and PPS remapping.  Pin configuration
+// is restored at the end.
+//
+static void bench_loopback(int argc, char **argv)
+{
+    unsigned count = 10000, i;
+    char *end;
+    int opt, path;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, &end, 0);
+            if (*end)
+                goto usage;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 2 || count == 0) {
+usage:  fprintf(stderr, "Usage: gpio bench loopback [-n <count>] <out-pin> <in-pin>\n");
+        exit(-1);
+    }
+
+    int out = pin_by_name(argv[optind]);
+    int in = pin_by_name(argv[optind + 1]);
+    if ((out | in) & GPIO_VIRTUAL) {
+        fprintf(stderr, "gpio: Cannot benchmark virtual pins\n");
+        exit(-1);
+    }
+    struct gpioreg *oreg = gpio_port_reg(GPIO_PORT(out));
+    struct gpioreg *ireg = gpio_port_reg(GPIO_PORT(in));
+    unsigned imask = GPIO_MASK(in);
+    unsigned omask = GPIO_MASK(out);
+    gpio_config_t saved;
+    if (!oreg || !ireg || gpio_config_read(&saved) < 0) {
+        fprintf(stderr, "gpio: Cannot access GPIO registers: %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    gpio_set_mode(in, MODE_INPUT);
+    gpio_set_pull(in, PULL_OFF);
+    gpio_set_mode(out, MODE_OUTPUT);
+    gpio_set_realtime(-1);
+
+    // Check the connection.
+    for (i = 0; i < 4; i++) {
+        gpio_write(out, i & 1);
+        if (!loopback_wait(ireg, imask, i & 1, gpio_time_ns())) {
+            fprintf(stderr, "gpio: No loopback from %s to %s\n", argv[optind], argv[optind + 1]);
+            gpio_config_apply(&saved);
+            exit(-1);
+        }
+    }
+
+    // Cost of reading the clock, to subtract.
+    uint64_t overhead = ~0ULL;
+    for (i = 0; i < 1000; i++) {
+        uint64_t t0 = gpio_time_ns();
+        uint64_t t1 = gpio_time_ns();
+        if (t1 - t0 < overhead)
+            overhead = t1 - t0;
+    }
+    printf("Loopback %s -> %s, clock overhead %llu nsec subtracted\n\n",
+        argv[optind], argv[optind + 1], (unsigned long long) overhead);
+
+    // Propagation latency, from before the write
+    // until the input has the new value.
+    for (path = 0; path < NPATHS; path++) {
+        bench_hist_t hist;
+        char name[64];
+
+        memset(&hist, 0, sizeof(hist));
+        loopback_level(oreg, omask, ireg, imask, 0);
+        for (i = 0; i < count; i++) {
+            int value = !(i & 1);
+            uint64_t t0 = gpio_time_ns();
+
+            loopback_write(oreg, out, path, value);
+            uint64_t t1 = loopback_wait(ireg, imask, value, t0);
+            if (t1)
+                hist_add(&hist, bench_ns(t0, t1, overhead));
+            else {
+                hist.lost++;
+                gpio_write(out, value);
+                loopback_wait(ireg, imask, value, gpio_time_ns());
+            }
+        }
+        snprintf(name, sizeof(name), "Latency via %s", path_name[path]);
+        print_hist(name, &hist);
+    }
+
+    // Toggle rates: writes only, and with every
+    // change seen at the input before the next one.
+    printf("\nToggle rate          Open loop     Closed loop\n");
+    for (path = 0; path < NPATHS; path++) {
+        unsigned n = 100 * count;
+
+        loopback_level(oreg, omask, ireg, imask, 1);
+        uint64_t t0 = gpio_time_ns();
+        for (i = 0; i < n; i++)
+            loopback_write(oreg, out, path, i & 1);
+        uint64_t t1 = gpio_time_ns();
+
+        // Starting high, the first write or inversion goes low.
+        loopback_level(oreg, omask, ireg, imask, 1);
+        uint64_t t2 = gpio_time_ns();
+        for (i = 0; i < count; i++) {
+            uint64_t start = gpio_time_ns();
+
+            loopback_write(oreg, out, path, i & 1);
+            if (!loopback_wait(ireg, imask, i & 1, start))
+                break;
+        }
+        uint64_t t3 = gpio_time_ns();
+
+        // Two writes make one period.
+        printf("%-14s %10.3f MHz", path_name[path], n * 1e3 / 2 / (t1 - t0));
+        if (i == count)
+            printf(" %11.3f MHz\n", count * 1e3 / 2 / (t3 - t2));
+        else
+            printf("     timeout\n");
+    }
+    printf("\n");
+
+    // Cost of changing the mode.
+    bench_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    for (i = 0; i < count; i++) {
+        uint64_t t0 = gpio_time_ns();
+        gpio_set_mode(out, (i & 1) ? MODE_OUTPUT : MODE_INPUT);
+        hist_add(&hist, bench_ns(t0, gpio_time_ns(), overhead));
+    }
+    print_hist("gpio_set_mode", &hist);
+
+    // Cost of PPS remapping, with the first output
+    // function available on the pin.
+    gpio_mode_t mode;
+    for (mode = MODE_C1OUT; mode <= MODE_U6TX; mode++)
+        if (gpio_has_mapping(out, mode))
+            break;
+    if (mode > MODE_U6TX) {
+        printf("PPS remap: no output function on %s\n", argv[optind]);
+    } else {
+        bench_hist_t clear;
+
+        memset(&hist, 0, sizeof(hist));
+        memset(&clear, 0, sizeof(clear));
+        for (i = 0; i < count; i++) {
+            uint64_t t0 = gpio_time_ns();
+            gpio_set_mapping(out, mode);
+            uint64_t t1 = gpio_time_ns();
+            gpio_clear_mapping(out);
+            uint64_t t2 = gpio_time_ns();
+            hist_add(&hist, bench_ns(t0, t1, overhead));
+            hist_add(&clear, bench_ns(t1, t2, overhead));
+        }
+        print_hist("gpio_set_mapping", &hist);
+        print_hist("gpio_clear_mapping", &clear);
+    }
+
+    if (gpio_config_apply(&saved) < 0)
+        fprintf(stderr, "gpio: Cannot restore pin configuration: %s\n", strerror(errno));
+}
+
+//
+// gpio bench toggle|loopback [<options>] <pins>
+//
+void do_bench(int argc, char **argv)
+{
+    if (argc >= 2 && strcasecmp(argv[1], "toggle") == 0)
+        bench_toggle(argc - 1, argv + 1);
+    else if (argc >= 2 && strcasecmp(argv[1], "loopback") == 0)
+        bench_loopback(argc - 1, argv + 1);
+    else {
+        fprintf(stderr, "Usage: gpio bench toggle [-n <count>] <pin>\n");
+        fprintf(stderr, "       gpio bench loopback [-n <count>] <out-pin> <in-pin>\n");
+        exit(-1);
+    }
+}
+
+//
+// For every mode, show available pins.
+//
+void do_modes()
+{
+    printf(" Mode     Available Pins\n");
+
+    gpio_mode_t mode;
+    for (mode=MODE_ANALOG+1; mode<MODE_LAST; mode++) {
+        printf(" %-8s", mode_name[mode]);
+
+        // Print pins, capable of this mode.
+        int phys;
+        for (phys = 1; phys <= 40; phys++) {
+            int bcm = phys_to_bcm(phys);
+            if (bcm < 0)
+                continue;
+
+            int pin = phys_to_pin(phys);
+            if (gpio_has_mapping(pin, mode)) {
+                //printf(" j%d ", phys);
+                printf(" p%d", bcm);
+                //printf(" %s", phys_name[phys]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+//
+// For every pin, show possible modes.
+//
+void do_pins()
+{
+    printf(" Pin Phys Name Available Modes\n");
+    int bcm;
+    for (bcm = 0; bcm < 32; bcm++) {
+        int phys = bcm_to_phys(bcm);
+        if (phys < 0)
+            continue;
+
+        // Print alternative mappings, available for this pin.
+        int pin = phys_to_pin(phys);
+        int print_this_pin = 0;
+        gpio_mode_t mode;
+
+        // First line: output modes.
+        for (mode=MODE_ANALOG+1; mode<MODE_C1RX; mode++) {
+            if (gpio_has_mapping(pin, mode)) {
+                if (print_this_pin == 0) {
+                    print_this_pin = 1;
+                    printf(" p%-2d", bcm);
+                    printf(" j%-2d ", phys);
+                    printf(" %-4s", phys_name[phys]);
+                }
+                printf(" %s", mode_name[mode]);
+            }
+        }
+        if (print_this_pin) {
+            // Second line: input modes.
+            printf("\n              ");
+            for (mode=MODE_C1RX; mode<MODE_LAST; mode++) {
+                if (gpio_has_mapping(pin, mode)) {
+                    printf(" %s", mode_name[mode]);
+                }
+            }
+            printf("\n");
+        }
+    }
+}
+
+//
+// Run a command, which needs access to GPIO registers.
+// Return -1 for unknown commands.
+//
+static int run_command(int argc, char **argv)
+{
+    if      (strcasecmp(argv[0], "mode")     == 0) do_mode(argc, argv);
+    else if (strcasecmp(argv[0], "read")     == 0) do_read(argc, argv);
+    else if (strcasecmp(argv[0], "write")    == 0) do_write(argc, argv);
+    else if (strcasecmp(argv[0], "toggle")   == 0) do_toggle(argc, argv);
+    else if (strcasecmp(argv[0], "blink")    == 0) do_blink(argc, argv);
+    else if (strcasecmp(argv[0], "readall")  == 0) do_readall(argc, argv);
+    else if (strcasecmp(argv[0], "debounce") == 0) do_debounce(argc, argv);
+    else if (strcasecmp(argv[0], "encoder")  == 0) do_encoder(argc, argv);
+    else if (strcasecmp(argv[0], "onewire")  == 0) do_onewire(argc, argv);
+    else if (strcasecmp(argv[0], "leds")     == 0) do_leds(argc, argv);
+    else if (strcasecmp(argv[0], "shift")    == 0) do_shift(argc, argv);
+    else if (strcasecmp(argv[0], "lcd")      == 0) do_lcd(argc, argv);
+    else if (strcasecmp(argv[0], "keypad")   == 0) do_keypad(argc, argv);
+    else if (strcasecmp(argv[0], "stepper")  == 0) do_stepper(argc, argv);
+    else if (strcasecmp(argv[0], "aread")    == 0) do_aread(argc, argv);
+    else if (strcasecmp(argv[0], "ascan")    == 0) do_ascan(argc, argv);
+    else if (strcasecmp(argv[0], "clock")    == 0) do_clock(argc, argv);
+    else if (strcasecmp(argv[0], "freq")     == 0) do_freq(argc, argv);
+    else if (strcasecmp(argv[0], "extint")   == 0) do_extint(argc, argv);
+    else if (strcasecmp(argv[0], "run")      == 0) do_run(argc, argv);
+    else if (strcasecmp(argv[0], "bench")    == 0) do_bench(argc, argv);
+    else if (strcasecmp(argv[0], "wait")     == 0) do_wait(argc, argv);
+    else if (strcasecmp(argv[0], "save")     == 0) do_save(argc, argv);
+    else if (strcasecmp(argv[0], "apply")    == 0) do_apply(argc, argv);
+    else if (strcasecmp(argv[0], "stats")    == 0) do_stats(argc, argv);
+    else if (strcasecmp(argv[0], "capture")  == 0) do_capture(argc, argv);
+    else if (strcasecmp(argv[0], "decode")   == 0) do_decode(argc, argv);
+    else if (strcasecmp(argv[0], "rules")    == 0) do_rules(argc, argv);
+    else {
+        fprintf(stderr, "gpio: Unknown command: %s.\n", argv[0]);
+        return -1;
+    }
+    return 0;
+
+}
+
+int main(int argc, char **argv)
+{
+    const char *env_debug = getenv("GPIO_DEBUG");
+
+    for (;;) {
+        switch (getopt(argc, argv, "+vhd")) {
+        case EOF:
+            break;
+        case 'v':
+            printf("gpio version: %s\n", version);
+            return 0;
+        case 'h':
+            usage();
+            return 0;
+        case 'd':
+            ++gpio_debug;
+            continue;
+        default:
+            usage();
+        }
+        break;
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1) {
+        usage();
+        return -1;
+    }
+
+    if (!gpio_debug && env_debug)
+        gpio_debug = atoi(env_debug);
+
+    if (strcasecmp(argv[0], "pins") == 0) {
+        do_pins();
+        return 0;
+    }
+    if (strcasecmp(argv[0], "modes") == 0) {
+        do_modes();
+        return 0;
+    }
+
+    // Decoding works on capture files only, on any host.
+    if (strcasecmp(argv[0], "decode") == 0) {
+        do_decode(argc, argv);
+        return 0;
+    }
+
+    if (geteuid () != 0) {
+        fprintf(stderr, "gpio: Must be root to run.\n");
+        return -1;
+    }
+
+    gpio_t *gpio = gpio_open();
+    if (!gpio) {
+        fprintf(stderr, "gpio: Cannot access GPIO registers: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int status = run_command(argc, argv);
+
+    gpio_close(gpio);
+    return status;
 }
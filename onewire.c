@@ -0,0 +1,292 @@
+/*
+ * 1-Wire bus master for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "gpio.h"
+
+//
+// ROM and function commands.
+//
+#define CMD_SEARCH_ROM      0xF0
+#define CMD_MATCH_ROM       0x55
+#define CMD_SKIP_ROM        0xCC
+#define CMD_CONVERT_T       0x44
+#define CMD_READ_SCRATCHPAD 0xBE
+
+//
+// Maximum conversion time of DS18B20 at 12-bit resolution, in msec.
+//
+#define CONVERT_TIMEOUT     750
+
+//
+// Configure the pin for 1-Wire bus: open drain output, released.
+//
+int gpio_onewire_init(gpio_onewire_t *ow, int pin)
+{
+    memset(ow, 0, sizeof(*ow));
+    ow->mask = GPIO_MASK(pin);
+
+    // Calibrate the delay loop now, not during the first reset pulse.
+    gpio_udelay(0);
+
+    gpio_set_mode(pin, MODE_INPUT);
+    ow->reg = gpio_port_reg(GPIO_PORT(pin));
+    ow->reg->latset = ow->mask;
+    ow->reg->odcset = ow->mask;
+    ow->reg->trisclr = ow->mask;
+    return 0;
+}
+
+//
+// Pull the bus low, or release it.
+//
+static inline void bus_low(gpio_onewire_t *ow)
+{
+    ow->reg->latclr = ow->mask;
+}
+
+static inline void bus_release(gpio_onewire_t *ow)
+{
+    ow->reg->latset = ow->mask;
+}
+
+static inline int bus_sample(gpio_onewire_t *ow)
+{
+    return (ow->reg->port & ow->mask) != 0;
+}
+
+//
+// Send a reset pulse.  Return 1 when a presence pulse is detected.
+//
+int gpio_onewire_reset(gpio_onewire_t *ow)
+{
+    bus_low(ow);
+    gpio_udelay(480);
+    bus_release(ow);
+    gpio_udelay(70);
+    int present = !bus_sample(ow);
+    gpio_udelay(410);
+    return present;
+}
+
+//
+// Write one bit: a short low pulse for 1, a long one for 0.
+//
+void gpio_onewire_write_bit(gpio_onewire_t *ow, int bit)
+{
+    bus_low(ow);
+    if (bit) {
+        gpio_udelay(6);
+        bus_release(ow);
+        gpio_udelay(64);
+    } else {
+        gpio_udelay(60);
+        bus_release(ow);
+        gpio_udelay(10);
+    }
+}
+
+//
+// Read one bit: start a time slot and sample the bus
+// before the slave releases it.
+//
+int gpio_onewire_read_bit(gpio_onewire_t *ow)
+{
+    bus_low(ow);
+    gpio_udelay(6);
+    bus_release(ow);
+    gpio_udelay(9);
+    int bit = bus_sample(ow);
+    gpio_udelay(55);
+    return bit;
+}
+
+//
+// Write a byte, LSB first.
+//
+void gpio_onewire_write(gpio_onewire_t *ow, unsigned byte)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        gpio_onewire_write_bit(ow, (byte >> i) & 1);
+}
+
+//
+// Read a byte, LSB first.
+//
+unsigned gpio_onewire_read(gpio_onewire_t *ow)
+{
+    unsigned byte = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        byte |= gpio_onewire_read_bit(ow) << i;
+    return byte;
+}
+
+//
+// Compute Dallas/Maxim CRC8 of data (polynomial x^8 + x^5 + x^4 + 1).
+//
+unsigned gpio_onewire_crc8(const uint8_t *data, int nbytes)
+{
+    unsigned crc = 0;
+    int i;
+
+    while (nbytes-- > 0) {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    return crc;
+}
+
+//
+// Find the next device on the bus.
+// Return 1 when found, 0 when no more devices.
+// See Maxim application note 187.
+//
+static int search_next(gpio_onewire_t *ow)
+{
+    int last_zero = 0;
+    int bitnum;
+
+    if (ow->last_device)
+        return 0;
+    if (!gpio_onewire_reset(ow)) {
+        ow->last_discrepancy = 0;
+        return 0;
+    }
+    gpio_onewire_write(ow, CMD_SEARCH_ROM);
+
+    for (bitnum = 1; bitnum <= 64; bitnum++) {
+        int byte = (bitnum - 1) / 8;
+        unsigned mask = 1 << ((bitnum - 1) % 8);
+        int bit = gpio_onewire_read_bit(ow);
+        int cmp = gpio_onewire_read_bit(ow);
+        int dir;
+
+        if (bit && cmp) {
+            // No devices responded.
+            ow->last_discrepancy = 0;
+            return 0;
+        }
+        if (bit != cmp) {
+            // All devices have the same bit here.
+            dir = bit;
+        } else {
+            // Discrepancy: choose the direction.
+            if (bitnum < ow->last_discrepancy)
+                dir = (ow->rom[byte] & mask) != 0;
+            else
+                dir = (bitnum == ow->last_discrepancy);
+            if (dir == 0)
+                last_zero = bitnum;
+        }
+
+        if (dir)
+            ow->rom[byte] |= mask;
+        else
+            ow->rom[byte] &= ~mask;
+        gpio_onewire_write_bit(ow, dir);
+    }
+
+    ow->last_discrepancy = last_zero;
+    if (last_zero == 0)
+        ow->last_device = 1;
+    // Bus shorted to ground gives all zeros with a valid CRC.
+    return ow->rom[0] != 0 && gpio_onewire_crc8(ow->rom, 8) == 0;
+}
+
+//
+// Find ROM codes of all devices on the bus.
+// Return the number of devices found, up to maxdev.
+//
+int gpio_onewire_search(gpio_onewire_t *ow, uint8_t (*rom)[8], int maxdev)
+{
+    int ndev = 0;
+
+    memset(ow->rom, 0, sizeof(ow->rom));
+    ow->last_discrepancy = 0;
+    ow->last_device = 0;
+
+    while (ndev < maxdev && search_next(ow)) {
+        memcpy(rom[ndev], ow->rom, 8);
+        ndev++;
+    }
+    return ndev;
+}
+
+//
+// Start temperature conversion on all sensors at once, wait for completion,
+// then read every sensor from the list.
+// Return the number of sensors read successfully, or -1 when no bus.
+//
+int gpio_onewire_read_temps(gpio_onewire_t *ow, uint8_t (*rom)[8], int ndev, int *temp)
+{
+    int i, nread = 0;
+
+    // Convert all.
+    if (!gpio_onewire_reset(ow)) {
+        errno = ENODEV;
+        return -1;
+    }
+    gpio_onewire_write(ow, CMD_SKIP_ROM);
+    gpio_onewire_write(ow, CMD_CONVERT_T);
+
+    // Sensors hold the bus low while converting.
+    // Poll once per millisecond, instead of waiting the worst case.
+    for (i = 0; i < CONVERT_TIMEOUT; i++) {
+        if (gpio_onewire_read_bit(ow))
+            break;
+        usleep(1000);
+    }
+
+    // Read all.
+    for (i = 0; i < ndev; i++) {
+        uint8_t data[9];
+        int k;
+
+        temp[i] = GPIO_ONEWIRE_NOTEMP;
+        if (!gpio_onewire_reset(ow))
+            continue;
+        gpio_onewire_write(ow, CMD_MATCH_ROM);
+        for (k = 0; k < 8; k++)
+            gpio_onewire_write(ow, rom[i][k]);
+        gpio_onewire_write(ow, CMD_READ_SCRATCHPAD);
+        for (k = 0; k < 9; k++)
+            data[k] = gpio_onewire_read(ow);
+
+        if (gpio_onewire_crc8(data, 9) != 0)
+            continue;
+        temp[i] = (int16_t) (data[0] | data[1] << 8);
+        nread++;
+    }
+    return nread;
+}
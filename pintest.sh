@@ -113,6 +113,12 @@ errs=0
 totErrs=0
 echo ""
 
+# Save pin configuration, to restore it at the end,
+# also when the test is interrupted
+saved=`mktemp`
+gpio save > $saved
+trap 'gpio apply $saved; rm -f $saved; exit 1' INT TERM
+
 # Switch u2rx to p19 (default)
 gpio mode p19 u2rx
 
@@ -155,6 +161,11 @@ testPin 25
 testPin 26
 testPin 27
 
+# Restore pin configuration, including u2rx routing
+trap - INT TERM
+gpio apply $saved
+rm -f $saved
+
 echo ""
 if [ $totErrs != 0 ]; then
     echo ""
@@ -0,0 +1,441 @@
+/*
+ * Rules engine: input conditions fire output actions.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "gpio.h"
+
+//
+// Rules language, one rule per line, '#' starts a comment:
+//
+//      when <condition>... do <action>...
+//
+// Conditions, all of which must hold ("and" may be put between them):
+//
+//      <pin> 0|1|low|high          level of an input
+//      <pin> rise|fall|change      edge on an input
+//
+// Actions:
+//
+//      set <pin>...                drive pins high
+//      clear <pin>...              drive pins low
+//      toggle <pin>...             invert pins
+//      pulse <pin> <time>          drive high, and low after a time
+//
+// A rule with edges fires on every sample with a matching edge.
+// A rule with levels only fires when its condition becomes true.
+// Up to 64 different pins may be pulsed, so that every pulse
+// in progress has its end queued.
+//
+// Example: when rb2 rise and rb4 low do set rd7 pulse rb0 10us
+//
+
+#define MAX_PENDING     64      // Pulses in progress
+
+//
+// Get an input or output pin.  Return -1 on error.
+//
+static int rule_pin(gpio_rules_t *rules, const char *name)
+{
+    int pin = gpio_pin_by_name(name);
+
+    if (pin < 0 || (pin & GPIO_VIRTUAL)) {
+        rules->error = "wrong pin name";
+        return -1;
+    }
+    return pin;
+}
+
+//
+// Compile one rule, split into words.
+// Return 0 on success, -1 with error message on failure.
+//
+static int compile_rule(gpio_rules_t *rules, char **arg, int narg, int line)
+{
+    gpio_rule_t *r = &rules->rule[rules->nrules];
+    uint16_t *action = 0;
+    int i, pin, port, mask;
+
+    if (strcasecmp(arg[0], "when") != 0)
+        goto syntax;
+    if (rules->nrules == GPIO_MAX_RULES) {
+        rules->error = "too many rules";
+        return -1;
+    }
+    memset(r, 0, sizeof(*r));
+    r->line = line;
+
+    // Conditions.
+    for (i = 1; i < narg && strcasecmp(arg[i], "do") != 0; i += 2) {
+        const char *state;
+
+        if (strcasecmp(arg[i], "and") == 0 && i > 1)
+            i++;
+        if (i + 1 >= narg)
+            goto syntax;
+        if ((pin = rule_pin(rules, arg[i])) < 0)
+            return -1;
+        state = arg[i+1];
+        port = pin >> 24;
+        mask = GPIO_MASK(pin);
+
+        if (strcmp(state, "1") == 0 || strcasecmp(state, "high") == 0) {
+            r->cond.mask[port] |= mask;
+            r->cond.value[port] |= mask;
+        } else if (strcmp(state, "0") == 0 || strcasecmp(state, "low") == 0) {
+            r->cond.mask[port] |= mask;
+            r->cond.value[port] &= ~mask;
+        } else if (strcasecmp(state, "rise") == 0) {
+            r->cond.rise[port] |= mask;
+        } else if (strcasecmp(state, "fall") == 0) {
+            r->cond.fall[port] |= mask;
+        } else if (strcasecmp(state, "change") == 0) {
+            r->cond.rise[port] |= mask;
+            r->cond.fall[port] |= mask;
+        } else
+            goto syntax;
+
+        if (r->cond.rise[port] | r->cond.fall[port])
+            r->edges = 1;
+        rules->in[port] |= mask;
+    }
+    if (i == 1 || i >= narg - 1)
+        goto syntax;
+
+    // Actions.
+    for (i++; i < narg; i++) {
+        if (strcasecmp(arg[i], "set") == 0) {
+            action = r->set;
+            continue;
+        }
+        if (strcasecmp(arg[i], "clear") == 0) {
+            action = r->clr;
+            continue;
+        }
+        if (strcasecmp(arg[i], "toggle") == 0) {
+            action = r->inv;
+            continue;
+        }
+        if (strcasecmp(arg[i], "pulse") == 0) {
+            int64_t ns;
+
+            if (i + 2 >= narg)
+                goto syntax;
+            if (r->npulses == GPIO_MAX_PULSES) {
+                rules->error = "too many pulses";
+                return -1;
+            }
+            if ((pin = rule_pin(rules, arg[i+1])) < 0)
+                return -1;
+            ns = gpio_parse_time(arg[i+2]);
+            if (ns <= 0 || ns > 4000000000LL)
+                goto syntax;
+            if (!(rules->pulsed[pin >> 24] & GPIO_MASK(pin))) {
+                int k, npulsed = 0;
+
+                for (k = 0; k < GPIO_NPORTS; k++)
+                    npulsed += __builtin_popcount(rules->pulsed[k]);
+                if (npulsed == MAX_PENDING) {
+                    rules->error = "too many pulsed pins";
+                    return -1;
+                }
+                rules->pulsed[pin >> 24] |= GPIO_MASK(pin);
+            }
+            r->pulse[r->npulses].port = pin >> 24;
+            r->pulse[r->npulses].mask = GPIO_MASK(pin);
+            r->pulse[r->npulses].ns = ns;
+            r->npulses++;
+            rules->out[pin >> 24] |= GPIO_MASK(pin);
+            action = 0;
+            i += 2;
+            continue;
+        }
+        if (!action)
+            goto syntax;
+        if ((pin = rule_pin(rules, arg[i])) < 0)
+            return -1;
+        action[pin >> 24] |= GPIO_MASK(pin);
+        rules->out[pin >> 24] |= GPIO_MASK(pin);
+    }
+    rules->nrules++;
+    return 0;
+
+syntax:
+    rules->error = "syntax error";
+    return -1;
+}
+
+//
+// Compile rules text.
+// On error, return -1 and set error message and line number.
+//
+int gpio_rules_compile(gpio_rules_t *rules, const char *text)
+{
+    char buf[256], *arg[64];
+    int line = 0;
+
+    memset(rules, 0, sizeof(*rules));
+    while (*text) {
+        size_t len = strcspn(text, "\n");
+        int narg = 0;
+
+        line++;
+        if (len >= sizeof(buf))
+            len = sizeof(buf) - 1;
+        memcpy(buf, text, len);
+        buf[len] = 0;
+        text += strcspn(text, "\n");
+        if (*text)
+            text++;
+
+        buf[strcspn(buf, "#")] = 0;
+        for (char *p = strtok(buf, " \t\r"); p && narg < 64; p = strtok(0, " \t\r"))
+            arg[narg++] = p;
+        if (narg == 0)
+            continue;
+
+        if (compile_rule(rules, arg, narg, line) < 0) {
+            rules->error_line = line;
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//
+// Pulse waiting for its end.
+//
+struct pending {
+    uint64_t end;
+    struct gpioreg *reg;
+    uint16_t mask;
+};
+
+//
+// Execute actions of a rule which fired.
+//
+static void fire(gpio_rule_t *r, struct gpioreg **reg, const int *outport, int nout,
+                 struct pending *pend, int *npend, uint64_t now)
+{
+    int i, k;
+
+    for (i = 0; i < nout; i++) {
+        int p = outport[i];
+
+        if (r->set[p])
+            reg[p]->latset = r->set[p];
+        if (r->clr[p])
+            reg[p]->latclr = r->clr[p];
+        if (r->inv[p])
+            reg[p]->latinv = r->inv[p];
+    }
+    for (i = 0; i < r->npulses; i++) {
+        struct gpioreg *preg = reg[r->pulse[i].port];
+        uint16_t mask = r->pulse[i].mask;
+
+        // A pulse fired again is extended.  The compiler limits
+        // pulsed pins to the size of the table, but never drive
+        // a pin high without queueing its end.
+        for (k = 0; k < *npend; k++)
+            if (pend[k].reg == preg && pend[k].mask == mask)
+                break;
+        if (k == *npend) {
+            if (*npend == MAX_PENDING)
+                continue;
+            (*npend)++;
+        }
+        preg->latset = mask;
+        pend[k].reg = preg;
+        pend[k].mask = mask;
+        pend[k].end = now + r->pulse[i].ns;
+    }
+    r->count++;
+}
+
+//
+// Evaluate the rules in the calling thread until rules->stop is set.
+// Pins in conditions become inputs, pins in actions become outputs.
+// Only samples with some input change are checked against the rules.
+//
+int gpio_rules_exec(gpio_rules_t *rules, unsigned period_ns)
+{
+    struct gpioreg *reg[GPIO_NPORTS];
+    struct pending pend[MAX_PENDING];
+    uint16_t cur[GPIO_NPORTS], prev[GPIO_NPORTS], changed[GPIO_NPORTS];
+    int inport[GPIO_NPORTS], outport[GPIO_NPORTS];
+    int nin = 0, nout = 0, npend = 0, i, k;
+
+    for (i = 0; i < GPIO_NPORTS; i++) {
+        reg[i] = gpio_port_reg("ABCDEFGHJK"[i]);
+        if (!reg[i])
+            return -1;
+        if (rules->in[i]) {
+            reg[i]->anselclr = rules->in[i];
+            reg[i]->trisset = rules->in[i];
+            inport[nin++] = i;
+        }
+        if (rules->out[i]) {
+            reg[i]->anselclr = rules->out[i];
+            reg[i]->trisclr = rules->out[i];
+            outport[nout++] = i;
+        }
+        cur[i] = prev[i] = changed[i] = 0;
+    }
+    if (period_ns) {
+        for (k = 0; k < nin; k++)
+            gpio_enable_change("ABCDEFGHJK"[inport[k]], rules->in[inport[k]]);
+    }
+
+    // Initial levels: rules with levels only fire
+    // when the condition becomes true.
+    for (k = 0; k < nin; k++)
+        prev[inport[k]] = reg[inport[k]]->port;
+    for (i = 0; i < rules->nrules; i++) {
+        gpio_rule_t *r = &rules->rule[i];
+        unsigned level = 0;
+
+        for (k = 0; k < nin; k++) {
+            int p = inport[k];
+            level |= (prev[p] & r->cond.mask[p]) ^ r->cond.value[p];
+        }
+        r->matched = (level == 0);
+    }
+
+    uint64_t last = gpio_time_ns(), next = last, now;
+    while (!rules->stop) {
+        if (period_ns) {
+            struct timespec t;
+
+            next += period_ns;
+            t.tv_sec = next / 1000000000;
+            t.tv_nsec = next % 1000000000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, 0) == EINTR)
+                continue;
+        }
+
+        // Change status first: reading the port clears it.
+        unsigned any = 0;
+        for (k = 0; k < nin; k++) {
+            int p = inport[k];
+
+            if (period_ns)
+                changed[p] = reg[p]->cnstat & rules->in[p];
+            cur[p] = reg[p]->port;
+            any |= (cur[p] ^ prev[p]) | changed[p];
+        }
+        now = gpio_time_ns();
+        if (now - last > rules->max_gap_ns)
+            rules->max_gap_ns = now - last;
+        last = now;
+        rules->nsamples++;
+
+        if (any) {
+            for (i = 0; i < rules->nrules; i++) {
+                gpio_rule_t *r = &rules->rule[i];
+                unsigned level = 0, edge = 0;
+
+                for (k = 0; k < nin; k++) {
+                    int p = inport[k];
+
+                    // A change with the same level is a short pulse:
+                    // both edges.
+                    unsigned pulse = changed[p] & ~(cur[p] ^ prev[p]);
+
+                    level |= (cur[p] & r->cond.mask[p]) ^ r->cond.value[p];
+                    edge  |= ((cur[p] & ~prev[p]) | pulse) & r->cond.rise[p];
+                    edge  |= ((~cur[p] & prev[p]) | pulse) & r->cond.fall[p];
+                }
+                if (r->edges) {
+                    if (level == 0 && edge)
+                        fire(r, reg, outport, nout, pend, &npend, now);
+                } else {
+                    if (level == 0 && !r->matched)
+                        fire(r, reg, outport, nout, pend, &npend, now);
+                    r->matched = (level == 0);
+                }
+            }
+            for (k = 0; k < nin; k++)
+                prev[inport[k]] = cur[inport[k]];
+        }
+
+        // End of pulses.
+        for (k = 0; k < npend; ) {
+            if (now >= pend[k].end) {
+                pend[k].reg->latclr = pend[k].mask;
+                pend[k] = pend[--npend];
+            } else
+                k++;
+        }
+    }
+
+    // Finish pending pulses.
+    for (k = 0; k < npend; k++)
+        pend[k].reg->latclr = pend[k].mask;
+    if (period_ns) {
+        for (k = 0; k < nin; k++)
+            gpio_disable_change("ABCDEFGHJK"[inport[k]], rules->in[inport[k]]);
+    }
+    return 0;
+}
+
+//
+// Thread for gpio_rules_run().
+//
+static void *rules_thread(void *arg)
+{
+    gpio_rules_t *rules = arg;
+
+    if (rules->cpu >= 0)
+        gpio_set_realtime(rules->cpu);
+    rules->status = gpio_rules_exec(rules, rules->period_ns);
+    return 0;
+}
+
+//
+// Evaluate the rules on a separate thread, and wait for it.
+// Given a CPU, the thread is bound to it at real-time priority;
+// negative CPU leaves the thread at normal priority.
+//
+int gpio_rules_run(gpio_rules_t *rules, int cpu, unsigned period_ns)
+{
+    pthread_t thread;
+    int err;
+
+    rules->cpu = cpu;
+    rules->period_ns = period_ns;
+    err = pthread_create(&thread, 0, rules_thread, rules);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    pthread_join(thread, 0);
+    return rules->status;
+}
@@ -0,0 +1,631 @@
+/*
+ * Bytecode interpreter for GPIO pin sequences.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include "gpio.h"
+
+//
+// Sequence language, one statement per line, '#' starts a comment:
+//
+//      <label>:                    define a label
+//      set <pin>...                drive pins high
+//      clear <pin>...              drive pins low
+//      toggle <pin>...             invert pins
+//      wait <n>[ns|us|ms|s]        wait, counted from the end of previous wait
+//      test <pin> 0|1              set flag when the input has this value
+//      waitfor <pin> 0|1 [<time>]  wait for input value; flag is cleared on timeout,
+//                                  after the first 100 usec the input is polled
+//                                  with short sleeps
+//      jump <label>                jump always
+//      jumpif <label>              jump when flag is set
+//      jumpifnot <label>           jump when flag is clear
+//      loop <n> ... end            repeat n times, up to 4 levels,
+//                                  using registers r7, r6, r5, r4;
+//                                  other statements cannot use them
+//                                  inside the loop
+//      load r<N> <value>           set counter register r0...r7
+//      inc r<N>                    increment counter
+//      djnz r<N> <label>           decrement, jump when not zero
+//      halt                        stop
+//
+// Loops which run longer than 10 msec without a sleeping wait
+// give up the CPU for 20 usec on a backward jump, so a runaway
+// program cannot lock up the system from a real-time thread.
+//
+// Instructions are 32-bit words: opcode in bits 7:0, port or register
+// in bits 15:8, value in bits 23:16, followed by operand words.
+//
+enum {
+    OP_HALT,
+    OP_SET,         // port, mask
+    OP_CLR,         // port, mask
+    OP_INV,         // port, mask
+    OP_WAIT,        // nsec
+    OP_TEST,        // port/value, mask
+    OP_WAITFOR,     // port/value, mask, timeout nsec
+    OP_JMP,         // address
+    OP_JT,          // address
+    OP_JF,          // address
+    OP_LOAD,        // register, value
+    OP_INC,         // register
+    OP_DJNZ,        // register, address
+};
+
+#define MAX_LABELS      64
+#define MAX_FIXUPS      256
+#define MAX_NESTING     4
+
+#define SPIN_NS         100000      // Waitfor spins this long, then sleeps
+#define SLICE_NS        10000000    // Longest run without a sleep
+#define REST_NS         20000       // Sleep on polls and backward jumps
+
+//
+// Compiler state.
+//
+struct compiler {
+    gpio_seq_t *seq;
+    int     nlabels;
+    char    label[MAX_LABELS][32];
+    unsigned label_addr[MAX_LABELS];
+    int     nfixups;
+    unsigned fixup_addr[MAX_FIXUPS];    // Word to patch
+    int     fixup_label[MAX_FIXUPS];
+    int     fixup_line[MAX_FIXUPS];
+    int     nloops;
+    unsigned loop_start[MAX_NESTING];
+};
+
+//
+// Parse a register value: a number which fits into 32 bits,
+// signed or unsigned.  Return -1 on error.
+//
+static int parse_value(const char *str, int32_t *value)
+{
+    char *end;
+    long long n;
+
+    errno = 0;
+    n = strtoll(str, &end, 0);
+    if (end == str || *end != '\0' || errno == ERANGE ||
+        n < INT32_MIN || n > UINT32_MAX)
+        return -1;
+    *value = (int32_t) n;
+    return 0;
+}
+
+//
+// Append a word to the code.
+//
+static int emit(gpio_seq_t *seq, uint32_t word)
+{
+    if (seq->ncode == seq->maxcode) {
+        unsigned n = seq->maxcode ? 2 * seq->maxcode : 256;
+        uint32_t *code = realloc(seq->code, n * sizeof(uint32_t));
+
+        if (!code)
+            return -1;
+        seq->code = code;
+        seq->maxcode = n;
+    }
+    seq->code[seq->ncode++] = word;
+    return 0;
+}
+
+//
+// Find or create a label.  Return its index, or -1 when too many.
+//
+static int find_label(struct compiler *c, const char *name)
+{
+    int i;
+
+    for (i = 0; i < c->nlabels; i++) {
+        if (strcmp(c->label[i], name) == 0)
+            return i;
+    }
+    if (c->nlabels == MAX_LABELS || strlen(name) >= sizeof(c->label[0]))
+        return -1;
+
+    strcpy(c->label[i], name);
+    c->label_addr[i] = ~0;
+    return c->nlabels++;
+}
+
+//
+// Emit a reference to a label, to be resolved at the end.
+//
+static int emit_label(struct compiler *c, const char *name, int line)
+{
+    int i = find_label(c, name);
+
+    if (i < 0 || c->nfixups == MAX_FIXUPS)
+        return -1;
+    c->fixup_addr[c->nfixups] = c->seq->ncode;
+    c->fixup_label[c->nfixups] = i;
+    c->fixup_line[c->nfixups] = line;
+    c->nfixups++;
+    return emit(c->seq, 0);
+}
+
+//
+// Parse duration with optional unit, default is microseconds.
+// Return -1 on error.
+//
+int64_t gpio_parse_time(const char *str)
+{
+    char *end;
+    double t = strtod(str, &end);
+
+    if (end == str)
+        return -1;
+    if (*end == 0 || strcasecmp(end, "us") == 0)
+        t *= 1e3;
+    else if (strcasecmp(end, "ms") == 0)
+        t *= 1e6;
+    else if (strcasecmp(end, "s") == 0)
+        t *= 1e9;
+    else if (strcasecmp(end, "ns") != 0)
+        return -1;
+
+    // Reject NaN, infinity and values which do not fit 64 bits.
+    if (!isfinite(t) || t < 0 || t > 9e18)
+        return -1;
+    return t;
+}
+
+//
+// Parse register name r0...r7.  Return -1 on error.
+//
+static int parse_reg(const char *str)
+{
+    if ((str[0] != 'r' && str[0] != 'R') || str[1] < '0' || str[1] > '7' || str[2])
+        return -1;
+    return str[1] - '0';
+}
+
+//
+// Compile one statement, split into words.
+// Return 0 on success, -1 with error message on failure.
+//
+static int compile_statement(struct compiler *c, char **arg, int narg, int line)
+{
+    gpio_seq_t *seq = c->seq;
+    const char *op = arg[0];
+    int pin, i, r;
+
+    if (strcasecmp(op, "set") == 0 || strcasecmp(op, "clear") == 0 ||
+        strcasecmp(op, "toggle") == 0) {
+        unsigned mask[GPIO_NPORTS] = { 0 };
+        int code = (op[0] == 's' || op[0] == 'S') ? OP_SET :
+                   (op[0] == 'c' || op[0] == 'C') ? OP_CLR : OP_INV;
+
+        if (narg < 2)
+            goto syntax;
+        for (i = 1; i < narg; i++) {
+            pin = gpio_pin_by_name(arg[i]);
+            if (pin < 0 || (pin & GPIO_VIRTUAL)) {
+                seq->error = "wrong pin name";
+                return -1;
+            }
+            mask[pin >> 24] |= GPIO_MASK(pin);
+            seq->out[pin >> 24] |= GPIO_MASK(pin);
+        }
+
+        // One instruction per port.
+        for (i = 0; i < GPIO_NPORTS; i++) {
+            if (mask[i] && (emit(seq, code | i << 8) < 0 || emit(seq, mask[i]) < 0))
+                return -1;
+        }
+        return 0;
+    }
+
+    if (strcasecmp(op, "wait") == 0) {
+        int64_t ns;
+
+        if (narg != 2 || (ns = gpio_parse_time(arg[1])) < 0)
+            goto syntax;
+
+        // Long waits are split.
+        do {
+            uint32_t part = (ns > 4000000000LL) ? 4000000000U : ns;
+
+            if (emit(seq, OP_WAIT) < 0 || emit(seq, part) < 0)
+                return -1;
+            ns -= part;
+        } while (ns > 0);
+        return 0;
+    }
+
+    if (strcasecmp(op, "test") == 0 || strcasecmp(op, "waitfor") == 0) {
+        int waitfor = (op[0] == 'w' || op[0] == 'W');
+        int64_t timeout = 0;
+
+        if (narg < 3 || narg > 3 + waitfor ||
+            (strcmp(arg[2], "0") != 0 && strcmp(arg[2], "1") != 0))
+            goto syntax;
+        pin = gpio_pin_by_name(arg[1]);
+        if (pin < 0 || (pin & GPIO_VIRTUAL)) {
+            seq->error = "wrong pin name";
+            return -1;
+        }
+        if (narg == 4) {
+            timeout = gpio_parse_time(arg[3]);
+            if (timeout < 0 || timeout > 4000000000LL)
+                goto syntax;
+        }
+        seq->in[pin >> 24] |= GPIO_MASK(pin);
+        if (emit(seq, (waitfor ? OP_WAITFOR : OP_TEST) | (pin >> 24) << 8 |
+                      (arg[2][0] - '0') << 16) < 0 ||
+            emit(seq, GPIO_MASK(pin)) < 0)
+            return -1;
+        return waitfor ? emit(seq, timeout) : 0;
+    }
+
+    if (strcasecmp(op, "jump") == 0 || strcasecmp(op, "jumpif") == 0 ||
+        strcasecmp(op, "jumpifnot") == 0) {
+        int code = (strlen(op) == 4) ? OP_JMP : (strlen(op) == 6) ? OP_JT : OP_JF;
+
+        if (narg != 2)
+            goto syntax;
+        if (emit(seq, code) < 0 || emit_label(c, arg[1], line) < 0)
+            return -1;
+        return 0;
+    }
+
+    if (strcasecmp(op, "loop") == 0) {
+        int32_t n;
+
+        if (narg != 2 || c->nloops == MAX_NESTING ||
+            parse_value(arg[1], &n) < 0 || n < 1)
+            goto syntax;
+
+        // Loops use registers from r7 down.
+        r = 7 - c->nloops;
+        seq->used |= 1 << r;
+        if (emit(seq, OP_LOAD | r << 8) < 0 || emit(seq, n) < 0)
+            return -1;
+        c->loop_start[c->nloops++] = seq->ncode;
+        return 0;
+    }
+
+    if (strcasecmp(op, "end") == 0) {
+        if (narg != 1 || c->nloops == 0)
+            goto syntax;
+        c->nloops--;
+        r = 7 - c->nloops;
+        if (emit(seq, OP_DJNZ | r << 8) < 0 || emit(seq, c->loop_start[c->nloops]) < 0)
+            return -1;
+        return 0;
+    }
+
+    if (strcasecmp(op, "load") == 0 || strcasecmp(op, "inc") == 0 ||
+        strcasecmp(op, "djnz") == 0) {
+        int code = (op[0] == 'l' || op[0] == 'L') ? OP_LOAD :
+                   (op[0] == 'i' || op[0] == 'I') ? OP_INC : OP_DJNZ;
+
+        int32_t n;
+
+        if (narg != (code == OP_INC ? 2 : 3) || (r = parse_reg(arg[1])) < 0)
+            goto syntax;
+        if (r > 7 - c->nloops) {
+            seq->error = "register in use by loop";
+            return -1;
+        }
+        if (code == OP_LOAD && parse_value(arg[2], &n) < 0) {
+            seq->error = "bad value";
+            return -1;
+        }
+        seq->used |= 1 << r;
+        if (emit(seq, code | r << 8) < 0)
+            return -1;
+        if (code == OP_LOAD)
+            return emit(seq, n);
+        if (code == OP_DJNZ)
+            return emit_label(c, arg[2], line);
+        return 0;
+    }
+
+    if (strcasecmp(op, "halt") == 0) {
+        if (narg != 1)
+            goto syntax;
+        return emit(seq, OP_HALT);
+    }
+
+syntax:
+    seq->error = "syntax error";
+    return -1;
+}
+
+//
+// Compile a program text into bytecode.
+// On error, return -1 and set error message and line number.
+//
+int gpio_seq_compile(gpio_seq_t *seq, const char *text)
+{
+    struct compiler *c;
+    char buf[256], *arg[16];
+    int line = 0, i;
+
+    memset(seq, 0, sizeof(*seq));
+    c = calloc(1, sizeof(*c));
+    if (!c)
+        return -1;
+    c->seq = seq;
+
+    while (*text) {
+        size_t len = strcspn(text, "\n");
+        int narg = 0;
+
+        line++;
+        if (len >= sizeof(buf))
+            len = sizeof(buf) - 1;
+        memcpy(buf, text, len);
+        buf[len] = 0;
+        text += strcspn(text, "\n");
+        if (*text)
+            text++;
+
+        buf[strcspn(buf, "#")] = 0;
+        for (char *p = strtok(buf, " \t\r"); p && narg < 16; p = strtok(0, " \t\r"))
+            arg[narg++] = p;
+        if (narg == 0)
+            continue;
+
+        // Label definition.
+        size_t n = strlen(arg[0]);
+        if (arg[0][n-1] == ':') {
+            arg[0][n-1] = 0;
+            i = find_label(c, arg[0]);
+            if (i < 0 || c->label_addr[i] != ~0u) {
+                seq->error = "bad or duplicate label";
+                goto fail;
+            }
+            c->label_addr[i] = seq->ncode;
+            if (narg == 1)
+                continue;
+            memmove(arg, arg + 1, --narg * sizeof(arg[0]));
+        }
+
+        if (compile_statement(c, arg, narg, line) < 0) {
+            if (!seq->error)
+                seq->error = strerror(errno);
+            goto fail;
+        }
+    }
+    if (c->nloops > 0) {
+        seq->error = "loop without end";
+        goto fail;
+    }
+    if (emit(seq, OP_HALT) < 0) {
+        seq->error = strerror(errno);
+        goto fail;
+    }
+
+    // Resolve labels.
+    for (i = 0; i < c->nfixups; i++) {
+        unsigned addr = c->label_addr[c->fixup_label[i]];
+
+        if (addr == ~0u) {
+            seq->error = "undefined label";
+            line = c->fixup_line[i];
+            goto fail;
+        }
+        seq->code[c->fixup_addr[i]] = addr;
+    }
+    free(c);
+    return 0;
+
+fail:
+    seq->error_line = line;
+    free(c);
+    free(seq->code);
+    seq->code = 0;
+    seq->ncode = 0;
+    errno = EINVAL;
+    return -1;
+}
+
+//
+// Give up the CPU for a moment.
+//
+static void seq_rest()
+{
+    struct timespec t = { 0, REST_NS };
+
+    nanosleep(&t, 0);
+}
+
+//
+// Take a backward jump to a given address.  A program which has not
+// slept for a time slice rests first.  The clock is read only on
+// every 256th jump, to keep tight loops fast.
+//
+static unsigned seq_back(unsigned pc, unsigned addr, unsigned *njumps, uint64_t *rest)
+{
+    if (addr < pc && (++*njumps & 255) == 0) {
+        uint64_t now = gpio_time_ns();
+
+        if (now - *rest >= SLICE_NS) {
+            seq_rest();
+            *rest = gpio_time_ns();
+        }
+    }
+    return addr;
+}
+
+//
+// Execute the bytecode in the calling thread.
+// Pins used by set/clear/toggle become outputs,
+// pins used by test/waitfor become inputs.
+//
+int gpio_seq_exec(gpio_seq_t *seq)
+{
+    struct gpioreg *port[GPIO_NPORTS];
+    const uint32_t *code = seq->code;
+    unsigned pc = 0, njumps = 0;
+    int flag = 0, i;
+
+    for (i = 0; i < GPIO_NPORTS; i++) {
+        port[i] = gpio_port_reg("ABCDEFGHJK"[i]);
+        if (!port[i])
+            return -1;
+        if (seq->in[i]) {
+            port[i]->anselclr = seq->in[i];
+            port[i]->trisset = seq->in[i];
+        }
+        if (seq->out[i]) {
+            port[i]->anselclr = seq->out[i];
+            port[i]->trisclr = seq->out[i];
+        }
+    }
+
+    uint64_t t = gpio_time_ns();
+    uint64_t rest = t;
+    for (;;) {
+        uint32_t insn = code[pc++];
+        int a = (insn >> 8) & 0xff;
+        unsigned mask;
+
+        switch (insn & 0xff) {
+        case OP_HALT:
+            return 0;
+        case OP_SET:
+            port[a]->latset = code[pc++];
+            break;
+        case OP_CLR:
+            port[a]->latclr = code[pc++];
+            break;
+        case OP_INV:
+            port[a]->latinv = code[pc++];
+            break;
+        case OP_WAIT:
+            // Deadlines follow each other without drift.
+            t += code[pc];
+            gpio_wait_until(t);
+            if (code[pc++] > SPIN_NS)
+                rest = t;
+            break;
+        case OP_TEST:
+            mask = code[pc++];
+            flag = ((port[a]->port & mask) != 0) == ((insn >> 16) & 1);
+            break;
+        case OP_WAITFOR: {
+            uint64_t start = gpio_time_ns();
+            uint32_t timeout = code[pc + 1];
+            int value = (insn >> 16) & 1;
+
+            mask = code[pc];
+            pc += 2;
+            for (;;) {
+                flag = ((port[a]->port & mask) != 0) == value;
+                if (flag)
+                    break;
+
+                uint64_t now = gpio_time_ns();
+                if (timeout && now - start >= timeout)
+                    break;
+                if (now - start >= SPIN_NS) {
+                    seq_rest();
+                    rest = now;
+                }
+            }
+
+            // Following waits are counted from the input change.
+            t = gpio_time_ns();
+            break;
+        }
+        case OP_JMP:
+            pc = seq_back(pc, code[pc], &njumps, &rest);
+            break;
+        case OP_JT:
+            pc = flag ? seq_back(pc, code[pc], &njumps, &rest) : pc + 1;
+            break;
+        case OP_JF:
+            pc = flag ? pc + 1 : seq_back(pc, code[pc], &njumps, &rest);
+            break;
+        case OP_LOAD:
+            seq->reg[a] = code[pc++];
+            break;
+        case OP_INC:
+            seq->reg[a]++;
+            break;
+        case OP_DJNZ:
+            pc = (--seq->reg[a] != 0) ? seq_back(pc, code[pc], &njumps, &rest) : pc + 1;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+        }
+    }
+}
+
+//
+// Thread for gpio_seq_run().
+//
+static void *seq_thread(void *arg)
+{
+    gpio_seq_t *seq = arg;
+
+    gpio_set_realtime(seq->cpu);
+    seq->status = gpio_seq_exec(seq);
+    return 0;
+}
+
+//
+// Execute the bytecode on a separate real-time thread,
+// bound to a given CPU (negative for any), and wait for it.
+//
+int gpio_seq_run(gpio_seq_t *seq, int cpu)
+{
+    pthread_t thread;
+    int err;
+
+    seq->cpu = cpu;
+    err = pthread_create(&thread, 0, seq_thread, seq);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    pthread_join(thread, 0);
+    return seq->status;
+}
+
+//
+// Free the bytecode.
+//
+void gpio_seq_free(gpio_seq_t *seq)
+{
+    free(seq->code);
+    seq->code = 0;
+    seq->ncode = 0;
+}
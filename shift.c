@@ -0,0 +1,288 @@
+/*
+ * Daisy-chained shift registers (74HC595, 74HC165) for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// Registered chains, accessible as virtual pins.
+//
+#define MAX_CHAINS 16
+
+static gpio_shift_t *chain_table[MAX_CHAINS];
+
+//
+// Prepare a chain of shift registers.  All three pins must be on
+// the same port.  For an output chain (74HC595) the pins are SER,
+// SRCLK and RCLK; for an input chain (74HC165) they are QH, CLK
+// and SH/LD.  Bit 0 of the frame is the first output (QA or A)
+// of the register nearest to the processor.
+//
+int gpio_shift_init(gpio_shift_t *sh, int data_pin, int clock_pin, int latch_pin,
+                    int nbits, int input)
+{
+    if (GPIO_PORT(data_pin) != GPIO_PORT(clock_pin) ||
+        GPIO_PORT(data_pin) != GPIO_PORT(latch_pin) ||
+        nbits <= 0 || nbits > GPIO_SHIFT_MAXBITS || nbits % 8 != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(sh, 0, sizeof(*sh));
+    sh->reg = gpio_port_reg(GPIO_PORT(data_pin));
+    sh->port = GPIO_PORT(data_pin);
+    sh->data = GPIO_MASK(data_pin);
+    sh->clock = GPIO_MASK(clock_pin);
+    sh->latch = GPIO_MASK(latch_pin);
+    sh->nbits = nbits;
+    sh->input = input;
+
+    if (input) {
+        // Clock idle low, SH/LD idle high (shift mode).
+        gpio_set_mode(data_pin, MODE_INPUT);
+        sh->reg->latclr = sh->clock;
+        sh->reg->latset = sh->latch;
+    } else {
+        // Clock and latch idle low.
+        sh->reg->latclr = sh->data | sh->clock | sh->latch;
+        gpio_set_mode(data_pin, MODE_OUTPUT);
+
+        // Masks for LATxCLR and LATxSET, indexed by data bit:
+        // the clock is lowered together with data change.
+        sh->clr_mask[0] = sh->clock | sh->data;
+        sh->set_mask[0] = 0;
+        sh->clr_mask[1] = sh->clock;
+        sh->set_mask[1] = sh->data;
+    }
+    gpio_set_mode(clock_pin, MODE_OUTPUT);
+    gpio_set_mode(latch_pin, MODE_OUTPUT);
+    return 0;
+}
+
+//
+// Shift the frame out and latch it.
+// Skip the transfer when the frame is the same as the last one sent.
+// Return 1 when the frame was sent.
+//
+int gpio_shift_update(gpio_shift_t *sh)
+{
+    int nbytes = sh->nbits / 8;
+
+    if (sh->input)
+        return 0;
+    if (sh->valid && memcmp(sh->out, sh->sent, nbytes) == 0)
+        return 0;
+
+    struct gpioreg *reg = sh->reg;
+    const unsigned clock = sh->clock;
+    int i, k;
+
+    // Far register goes first, and every register gets QH first.
+    for (i = nbytes - 1; i >= 0; i--) {
+        unsigned byte = sh->out[i];
+
+        for (k = 7; k >= 0; k--) {
+            unsigned bit = (byte >> k) & 1;
+
+            reg->latclr = sh->clr_mask[bit];
+            reg->latset = sh->set_mask[bit];
+            reg->latset = clock;
+        }
+    }
+    reg->latclr = clock;
+
+    // Latch the outputs on rising edge.
+    reg->latset = sh->latch;
+    reg->latclr = sh->latch;
+
+    memcpy(sh->sent, sh->out, nbytes);
+    sh->valid = 1;
+    return 1;
+}
+
+//
+// Load the parallel inputs and shift them in.
+//
+void gpio_shift_read(gpio_shift_t *sh)
+{
+    struct gpioreg *reg = sh->reg;
+    int nbytes = sh->nbits / 8;
+    int i, k;
+
+    if (!sh->input)
+        return;
+
+    // Load on low level of SH/LD.
+    reg->latclr = sh->latch;
+    reg->latset = sh->latch;
+
+    // Near register comes first, H input first.
+    for (i = 0; i < nbytes; i++) {
+        unsigned byte = 0;
+
+        for (k = 7; k >= 0; k--) {
+            if (reg->port & sh->data)
+                byte |= 1 << k;
+            reg->latset = sh->clock;
+            reg->latclr = sh->clock;
+        }
+        sh->in[i] = byte;
+    }
+}
+
+//
+// Set a bit of the output frame, without sending it.
+//
+void gpio_shift_set(gpio_shift_t *sh, int bit, int value)
+{
+    if (bit < 0 || bit >= sh->nbits)
+        return;
+
+    if (value)
+        sh->out[bit / 8] |= 1 << (bit % 8);
+    else
+        sh->out[bit / 8] &= ~(1 << (bit % 8));
+}
+
+//
+// Get a bit of the last input frame, or of the output frame.
+//
+int gpio_shift_get(gpio_shift_t *sh, int bit)
+{
+    if (bit < 0 || bit >= sh->nbits)
+        return -1;
+
+    const uint8_t *frame = sh->input ? sh->in : sh->out;
+    return (frame[bit / 8] >> (bit % 8)) & 1;
+}
+
+//
+// Register a chain for access through virtual pins.
+// Return the chain number for GPIO_VPIN(), or -1 when the table is full.
+//
+int gpio_shift_register(gpio_shift_t *sh)
+{
+    int i;
+
+    for (i = 0; i < MAX_CHAINS; i++) {
+        if (!chain_table[i]) {
+            chain_table[i] = sh;
+            return i;
+        }
+    }
+    errno = ENOSPC;
+    return -1;
+}
+
+//
+// Remove a chain from the table of virtual pins.
+//
+void gpio_shift_unregister(gpio_shift_t *sh)
+{
+    int i;
+
+    for (i = 0; i < MAX_CHAINS; i++) {
+        if (chain_table[i] == sh)
+            chain_table[i] = 0;
+    }
+}
+
+//
+// Find a chain by virtual pin descriptor.
+//
+static gpio_shift_t *vpin_chain(int pin)
+{
+    int n = GPIO_VPIN_CHAIN(pin);
+
+    if (n >= MAX_CHAINS || !chain_table[n] ||
+        GPIO_VPIN_BIT(pin) >= chain_table[n]->nbits) {
+        errno = ENODEV;
+        return 0;
+    }
+    return chain_table[n];
+}
+
+//
+// Read a virtual pin: inputs are shifted in anew.
+// The chain is locked, as virtual pins may be used by several threads.
+//
+int gpio_vpin_read(int pin)
+{
+    gpio_shift_t *sh = vpin_chain(pin);
+    int value;
+
+    if (!sh)
+        return -1;
+    gpio_port_lock(sh->port);
+    gpio_shift_read(sh);
+    value = gpio_shift_get(sh, GPIO_VPIN_BIT(pin));
+    gpio_port_unlock(sh->port);
+    return value;
+}
+
+//
+// Write a virtual pin and send the frame.
+//
+int gpio_vpin_write(int pin, int value)
+{
+    gpio_shift_t *sh = vpin_chain(pin);
+
+    if (!sh || sh->input)
+        return -1;
+    gpio_port_lock(sh->port);
+    gpio_shift_set(sh, GPIO_VPIN_BIT(pin), value & 1);
+    gpio_shift_update(sh);
+    gpio_port_unlock(sh->port);
+    return 0;
+}
+
+//
+// Toggle a virtual pin and send the frame.
+//
+int gpio_vpin_toggle(int pin)
+{
+    gpio_shift_t *sh = vpin_chain(pin);
+    int bit = GPIO_VPIN_BIT(pin);
+
+    if (!sh || sh->input)
+        return -1;
+    gpio_port_lock(sh->port);
+    gpio_shift_set(sh, bit, !gpio_shift_get(sh, bit));
+    gpio_shift_update(sh);
+    gpio_port_unlock(sh->port);
+    return 0;
+}
+
+//
+// Get direction of a virtual pin.
+//
+gpio_mode_t gpio_vpin_mode(int pin)
+{
+    gpio_shift_t *sh = vpin_chain(pin);
+
+    return (sh && sh->input) ? MODE_INPUT : MODE_OUTPUT;
+}
@@ -0,0 +1,372 @@
+/*
+ * Statistics of PIC32 GPIO library operations.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "gpio.h"
+
+int gpio_stats_enabled;
+
+//
+// Statistics of one thread, in its own cache lines.
+// Slots of finished threads are reused, with their counts.
+// The owner makes the sequence odd while it updates the counters,
+// so readers retry instead of getting torn 64-bit values
+// on 32-bit processors.
+//
+typedef struct stats_slot {
+    gpio_stats_t stats;
+    unsigned seq;                   // Update sequence
+    struct stats_slot *next;
+    int in_use;
+} __attribute__((aligned(64))) stats_slot_t;
+
+static stats_slot_t *slot_list;
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t slot_key;
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+static __thread stats_slot_t *my_slot;
+
+static const char *op_name[GPIO_NOPS] = {
+    [GPIO_OP_READ]          = "read",
+    [GPIO_OP_WRITE]         = "write",
+    [GPIO_OP_TOGGLE]        = "toggle",
+    [GPIO_OP_SET_MODE]      = "set_mode",
+    [GPIO_OP_GET_MODE]      = "get_mode",
+    [GPIO_OP_SET_PULL]      = "set_pull",
+    [GPIO_OP_READ_PORT]     = "read_port",
+    [GPIO_OP_WRITE_PORT]    = "write_port",
+    [GPIO_OP_SET_MAPPING]   = "set_mapping",
+    [GPIO_OP_GET_MAPPING]   = "get_mapping",
+    [GPIO_OP_CLEAR_MAPPING] = "clear_mapping",
+};
+
+//
+// Get name of an operation.
+//
+const char *gpio_stats_op_name(gpio_op_t op)
+{
+    return (op >= 0 && op < GPIO_NOPS) ? op_name[op] : "unknown";
+}
+
+//
+// Release the slot when the thread exits.
+//
+static void slot_release(void *arg)
+{
+    stats_slot_t *s = arg;
+
+    pthread_mutex_lock(&slot_lock);
+    s->in_use = 0;
+    pthread_mutex_unlock(&slot_lock);
+}
+
+static void slot_key_init()
+{
+    pthread_key_create(&slot_key, slot_release);
+}
+
+//
+// Get a slot for the calling thread: a released one, or a new one.
+//
+static stats_slot_t *slot_attach()
+{
+    stats_slot_t *s;
+
+    pthread_once(&slot_once, slot_key_init);
+    pthread_mutex_lock(&slot_lock);
+    for (s = slot_list; s; s = s->next) {
+        if (!s->in_use)
+            break;
+    }
+    if (!s) {
+        void *p;
+
+        if (posix_memalign(&p, 64, sizeof(stats_slot_t)) == 0) {
+            s = p;
+            memset(s, 0, sizeof(*s));
+            s->next = slot_list;
+            slot_list = s;
+        }
+    }
+    if (s)
+        s->in_use = 1;
+    pthread_mutex_unlock(&slot_lock);
+
+    if (s)
+        pthread_setspecific(slot_key, s);
+    my_slot = s;
+    return s;
+}
+
+//
+// Enable or disable counting.
+//
+void gpio_stats_enable(int on)
+{
+    gpio_stats_enabled = on;
+}
+
+//
+// Count one operation in the slot of the calling thread.
+//
+void gpio_stats_count(gpio_op_t op, int pin, unsigned naccesses, uint64_t t0)
+{
+    stats_slot_t *s = my_slot ? my_slot : slot_attach();
+    uint64_t ns = gpio_time_ns() - t0;
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    if (!s)
+        return;
+    if (bucket >= GPIO_STATS_NBUCKETS)
+        bucket = GPIO_STATS_NBUCKETS - 1;
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->stats.calls[op]++;
+    s->stats.accesses[op] += naccesses;
+    s->stats.time_ns[op] += ns;
+    s->stats.hist[op][bucket]++;
+
+    if ((op == GPIO_OP_WRITE || op == GPIO_OP_TOGGLE) &&
+        pin >= 0 && !(pin & GPIO_VIRTUAL) && GPIO_MASK(pin))
+        s->stats.pin_writes[pin >> 24][__builtin_ctz(GPIO_MASK(pin))]++;
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+//
+// Copy the counters of a slot, consistent with one another.
+//
+static void slot_copy(const stats_slot_t *s, gpio_stats_t *copy)
+{
+    for (;;) {
+        unsigned seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+        if (!(seq & 1)) {
+            *copy = *(const volatile gpio_stats_t*) &s->stats;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+                return;
+        }
+
+        // The owner is in the middle of an update.
+        sched_yield();
+    }
+}
+
+//
+// Sum statistics of all threads.  Every slot is read consistently,
+// but the threads go on, so the sum is not an exact snapshot.
+//
+void gpio_stats_read(gpio_stats_t *total)
+{
+    const unsigned n = sizeof(gpio_stats_t) / sizeof(uint64_t);
+    uint64_t *sum = (uint64_t*) total;
+    const uint64_t *v;
+    gpio_stats_t copy;
+    stats_slot_t *s;
+    unsigned i;
+
+    memset(total, 0, sizeof(*total));
+    pthread_mutex_lock(&slot_lock);
+    for (s = slot_list; s; s = s->next) {
+        slot_copy(s, &copy);
+        v = (const uint64_t*) &copy;
+        for (i = 0; i < n; i++)
+            sum[i] += v[i];
+    }
+    pthread_mutex_unlock(&slot_lock);
+}
+
+//
+// Write statistics in Prometheus text format.
+//
+void gpio_stats_prometheus(FILE *fd)
+{
+    gpio_stats_t st;
+    int op, b, port, bit;
+
+    gpio_stats_read(&st);
+
+    fprintf(fd, "# HELP gpio_calls_total Calls of library operations.\n");
+    fprintf(fd, "# TYPE gpio_calls_total counter\n");
+    for (op = 0; op < GPIO_NOPS; op++)
+        fprintf(fd, "gpio_calls_total{op=\"%s\"} %llu\n", op_name[op],
+            (unsigned long long) st.calls[op]);
+
+    fprintf(fd, "# HELP gpio_register_accesses_total Register reads and writes by operation.\n");
+    fprintf(fd, "# TYPE gpio_register_accesses_total counter\n");
+    for (op = 0; op < GPIO_NOPS; op++)
+        fprintf(fd, "gpio_register_accesses_total{op=\"%s\"} %llu\n", op_name[op],
+            (unsigned long long) st.accesses[op]);
+
+    fprintf(fd, "# HELP gpio_operation_seconds Latency of library operations.\n");
+    fprintf(fd, "# TYPE gpio_operation_seconds histogram\n");
+    for (op = 0; op < GPIO_NOPS; op++) {
+        uint64_t count = 0;
+
+        if (!st.calls[op])
+            continue;
+        for (b = 0; b < GPIO_STATS_NBUCKETS - 1; b++) {
+            count += st.hist[op][b];
+            fprintf(fd, "gpio_operation_seconds_bucket{op=\"%s\",le=\"%g\"} %llu\n",
+                op_name[op], (double) (1ULL << b) / 1e9, (unsigned long long) count);
+        }
+        fprintf(fd, "gpio_operation_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n",
+            op_name[op], (unsigned long long) st.calls[op]);
+        fprintf(fd, "gpio_operation_seconds_sum{op=\"%s\"} %.9f\n",
+            op_name[op], st.time_ns[op] / 1e9);
+        fprintf(fd, "gpio_operation_seconds_count{op=\"%s\"} %llu\n",
+            op_name[op], (unsigned long long) st.calls[op]);
+    }
+
+    fprintf(fd, "# HELP gpio_pin_writes_total Writes and toggles of output pins.\n");
+    fprintf(fd, "# TYPE gpio_pin_writes_total counter\n");
+    for (port = 0; port < GPIO_NPORTS; port++) {
+        for (bit = 0; bit < 16; bit++) {
+            if (st.pin_writes[port][bit])
+                fprintf(fd, "gpio_pin_writes_total{pin=\"R%c%d\"} %llu\n",
+                    "ABCDEFGHJK"[port], bit,
+                    (unsigned long long) st.pin_writes[port][bit]);
+        }
+    }
+}
+
+//
+// Answer one client of the statistics socket.
+//
+static void stats_reply(int sock)
+{
+    struct pollfd p = { sock, POLLIN, 0 };
+    char request[256];
+    char *text = 0;
+    size_t len = 0;
+    int http = 0;
+
+    // Wait a little for a request; a bare connection gets the text.
+    if (poll(&p, 1, 100) > 0) {
+        ssize_t n = read(sock, request, sizeof(request));
+
+        http = (n >= 4 && memcmp(request, "GET ", 4) == 0);
+    }
+
+    FILE *fd = open_memstream(&text, &len);
+    if (!fd)
+        return;
+    if (http)
+        fprintf(fd, "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n\r\n");
+    gpio_stats_prometheus(fd);
+    fclose(fd);
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(sock, text + done, len - done);
+
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    free(text);
+}
+
+//
+// Accept clients of the statistics socket.
+//
+static void *stats_thread(void *arg)
+{
+    int listener = (intptr_t) arg;
+
+    for (;;) {
+        int sock = accept(listener, 0, 0);
+
+        if (sock < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        stats_reply(sock);
+        close(sock);
+    }
+    close(listener);
+    return 0;
+}
+
+//
+// Serve statistics on a Unix socket.  A stale socket left
+// at the path is replaced; any other file is an error.
+//
+int gpio_stats_serve(const char *path)
+{
+    struct sockaddr_un addr;
+    pthread_t thread;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            close(listener);
+            errno = EEXIST;
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(listener, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        listen(listener, 4) < 0) {
+        close(listener);
+        return -1;
+    }
+
+    int err = pthread_create(&thread, 0, stats_thread, (void*) (intptr_t) listener);
+    if (err) {
+        close(listener);
+        errno = err;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
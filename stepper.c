@@ -0,0 +1,412 @@
+/*
+ * Stepper motor motion engine for PIC32 GPIO.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gpio.h"
+
+//
+// Output compare control registers.
+//
+struct ocreg {
+    volatile unsigned con;          // Control
+    volatile unsigned conclr;
+    volatile unsigned conset;
+    volatile unsigned coninv;
+    volatile unsigned r;            // Compare value: start of pulse
+    volatile unsigned rclr;
+    volatile unsigned rset;
+    volatile unsigned rinv;
+    volatile unsigned rs;           // Secondary compare: end of pulse
+    volatile unsigned rsclr;
+    volatile unsigned rsset;
+    volatile unsigned rsinv;
+};
+
+#define OC1_ADDR        0x1f844000  // OC2...OC9 follow with step 0x200
+#define OC_STRIDE       0x200
+
+#define OCCON_ON        (1 << 15)   // Module enable
+#define OCCON_OC32      (1 << 5)    // 32-bit compare
+#define OCCON_OCM       (7 << 0)    // Mode
+#define OCCON_PULSE     (4 << 0)    // Dual compare, single output pulse
+
+//
+// Width of step pulse: drivers need 1...2 usec.
+//
+#define PULSE_USEC      2
+
+//
+// Axes which are due within this time are stepped together.
+//
+#define SLACK_NS        1000
+
+//
+// Output compare is armed this time before the step.
+//
+#define OC_LEAD_NS      50000
+
+//
+// Timer2/3, shared by all OC units, and OC units in use.
+//
+static struct tmrreg *tmr;
+static unsigned long tmr_hz;
+static unsigned oc_busy;
+
+//
+// Start Timer2/3 as a free-running 32-bit counter on PBCLK3.
+// A timer which is enabled belongs to someone else, as in freq.c:
+// fail with EBUSY rather than reprogram it.
+//
+static int stepper_timer_init()
+{
+    if (tmr)
+        return 0;
+
+    struct tmrreg *t = gpio_timer_reg(2);
+    if (!t)
+        return -1;
+    if ((t->con & GPIO_TCON_ON) || (gpio_timer_reg(3)->con & GPIO_TCON_ON)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    t->con = 0;
+    gpio_timer_reg(3)->con = 0;
+    t->tmr = 0;
+    t->pr = 0xffffffff;
+    t->con = GPIO_TCON_T32;
+    t->conset = GPIO_TCON_ON;
+    tmr_hz = gpio_pbclk(3);
+    tmr = t;
+    return 0;
+}
+
+//
+// Stop Timer2/3 when no OC unit uses it any more,
+// so that the next process finds it free.
+//
+static void stepper_timer_release()
+{
+    if (!tmr || oc_busy)
+        return;
+
+    tmr->con = 0;
+    gpio_timer_reg(3)->con = 0;
+    tmr = 0;
+}
+
+//
+// Configure step and dir pins.  Take a free OC unit,
+// when the step pin has one.
+//
+int gpio_stepper_init(gpio_stepper_t *st, int step, int dir)
+{
+    int n;
+
+    memset(st, 0, sizeof(*st));
+    st->step = step;
+    st->dir = dir;
+    st->reg = gpio_port_reg(GPIO_PORT(step));
+
+    gpio_write(dir, 0);
+    gpio_set_mode(dir, MODE_OUTPUT);
+    gpio_write(step, 0);
+    gpio_set_mode(step, MODE_OUTPUT);
+
+    for (n = 1; n <= 9; n++) {
+        if (!(oc_busy & (1 << n)) && gpio_has_mapping(step, MODE_OC1 + n - 1))
+            break;
+    }
+    if (n > 9 || stepper_timer_init() < 0)
+        return 0;
+
+    st->ocreg = (struct ocreg*) gpio_map_sfr(OC1_ADDR + (n - 1) * OC_STRIDE,
+                                             sizeof(struct ocreg));
+    if (!st->ocreg) {
+        stepper_timer_release();
+        return 0;
+    }
+
+    // 32-bit compare against Timer2/3, disabled until armed.
+    st->ocreg->con = 0;
+    st->ocreg->con = OCCON_OC32;
+    st->ocreg->conset = OCCON_ON;
+    gpio_set_mode(step, MODE_OC1 + n - 1);
+    st->oc = n;
+    oc_busy |= 1 << n;
+    return 0;
+}
+
+//
+// Time in seconds to travel a given distance from rest,
+// while accelerating up to the given speed.
+// S-curve ramp has velocity v*(3x^2 - 2x^3) for x = t/T,
+// with T = 1.5*v/a, so that the peak acceleration is a.
+//
+static double ramp_time(double dist, double speed, double accel, gpio_profile_t profile)
+{
+    if (profile == GPIO_PROFILE_TRAPEZOID)
+        return sqrt(2 * dist / accel);
+
+    // Position is v*T*(x^3 - x^4/2); solve by bisection.
+    double T = 1.5 * speed / accel;
+    double p = dist / (speed * T);
+    double lo = 0, hi = 1;
+    int i;
+
+    for (i = 0; i < 40; i++) {
+        double x = (lo + hi) / 2;
+
+        if (x*x*x - x*x*x*x / 2 < p)
+            lo = x;
+        else
+            hi = x;
+    }
+    return lo * T;
+}
+
+//
+// Plan a relative move by a given number of steps.
+// The move has ramps up and down, and a cruise phase between them.
+// When the move is too short to reach the given speed,
+// the speed is reduced.
+//
+int gpio_stepper_plan(gpio_stepper_t *st, int32_t steps, double speed,
+                      double accel, gpio_profile_t profile)
+{
+    unsigned n = (steps < 0) ? -steps : steps;
+    unsigned i;
+
+    if (speed <= 0 || accel <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    free(st->interval);
+    st->interval = 0;
+    st->nsteps = 0;
+    st->next = 0;
+    st->direction = (steps < 0) ? -1 : 1;
+    if (n == 0)
+        return 0;
+
+    // Distance of one ramp.
+    double k = (profile == GPIO_PROFILE_TRAPEZOID) ? 0.5 : 0.75;
+    double ramp = k * speed * speed / accel;
+    if (2 * ramp > n) {
+        ramp = n / 2.0;
+        speed = sqrt(ramp * accel / k);
+    }
+    double t_ramp = ramp_time(ramp, speed, accel, profile);
+    double t_total = 2 * t_ramp + (n - 2 * ramp) / speed;
+
+    st->interval = malloc(n * sizeof(uint32_t));
+    if (!st->interval)
+        return -1;
+
+    uint64_t prev = 0;
+    for (i = 1; i <= n; i++) {
+        double t;
+
+        if (i <= ramp)
+            t = ramp_time(i, speed, accel, profile);
+        else if (i <= n - ramp)
+            t = t_ramp + (i - ramp) / speed;
+        else
+            t = t_total - ramp_time(n - i, speed, accel, profile);
+
+        uint64_t ns = llround(t * 1e9);
+        if (ns - prev > UINT32_MAX) {
+            free(st->interval);
+            st->interval = 0;
+            errno = EINVAL;
+            return -1;
+        }
+        st->interval[i - 1] = ns - prev;
+        prev = ns;
+    }
+    st->nsteps = n;
+    return 0;
+}
+
+//
+// Time of the next action for an axis: the step itself,
+// or arming of the output compare in advance.
+//
+static uint64_t stepper_event(gpio_stepper_t *st)
+{
+    if (!st->oc)
+        return st->due;
+
+    // The previous pulse must be finished before rearming.
+    uint64_t prev = st->due - st->interval[st->next];
+    uint64_t t = st->due - OC_LEAD_NS;
+
+    if (st->next > 0 && t < prev + PULSE_USEC * 1000)
+        t = prev + PULSE_USEC * 1000;
+    return t;
+}
+
+//
+// Arm the output compare for a pulse at the due time.
+// Timer counts are derived from the monotonic clock
+// by the reference pair (t0, c0).  A step which is already
+// too late gets moved to the nearest possible count.
+//
+static void stepper_arm(gpio_stepper_t *st, uint64_t t0, unsigned c0)
+{
+    struct ocreg *oc = st->ocreg;
+    uint64_t dt = st->due - t0;
+
+    // Whole seconds apart, so the product does not overflow
+    // on long runs; the counter wraps modulo 2^32 anyway.
+    unsigned count = c0 + (unsigned) ((dt / 1000000000) * tmr_hz +
+                                      (dt % 1000000000) * tmr_hz / 1000000000);
+    unsigned min_ticks = tmr_hz / 1000000;
+    unsigned now = tmr->tmr;
+
+    if ((int) (count - now) < (int) min_ticks) {
+        uint64_t late = (uint64_t) (now + min_ticks - count) * 1000000000 / tmr_hz;
+
+        if (late > st->late_ns)
+            st->late_ns = late;
+        count = now + min_ticks;
+    }
+    oc->conclr = OCCON_OCM;
+    oc->r = count;
+    oc->rs = count + PULSE_USEC * min_ticks;
+    oc->conset = OCCON_PULSE;
+}
+
+//
+// Execute planned moves of several axes together.
+// Steps of different axes, which are due at the same time, are
+// emitted with one write per port.  Axes with OC units are armed
+// ahead of time and need no exact software timing.
+//
+int gpio_stepper_run(gpio_stepper_t *axis, int naxes)
+{
+    unsigned set[GPIO_NPORTS];
+    int i, p, active = 0;
+
+    for (i = 0; i < naxes; i++) {
+        gpio_stepper_t *st = &axis[i];
+
+        st->next = 0;
+        st->late_ns = 0;
+        if (st->next < st->nsteps) {
+            gpio_write(st->dir, st->direction < 0);
+            active++;
+        }
+    }
+
+    // Calibrate the delay loop before timing starts.
+    // Direction setup time is covered by the first interval.
+    gpio_udelay(0);
+    uint64_t t0 = gpio_time_ns();
+    unsigned c0 = tmr ? tmr->tmr : 0;
+
+    for (i = 0; i < naxes; i++) {
+        if (axis[i].nsteps)
+            axis[i].due = t0 + axis[i].interval[0];
+    }
+
+    while (active > 0) {
+        // Find the nearest event.
+        uint64_t t = ~0ULL;
+        for (i = 0; i < naxes; i++) {
+            if (axis[i].next < axis[i].nsteps && stepper_event(&axis[i]) < t)
+                t = stepper_event(&axis[i]);
+        }
+        gpio_wait_until(t);
+
+        // Handle all axes which are due.
+        uint64_t now = gpio_time_ns();
+        int nset = 0;
+
+        memset(set, 0, sizeof(set));
+        for (i = 0; i < naxes; i++) {
+            gpio_stepper_t *st = &axis[i];
+
+            if (st->next >= st->nsteps || stepper_event(st) > now + SLACK_NS)
+                continue;
+
+            if (st->oc) {
+                stepper_arm(st, t0, c0);
+            } else {
+                if (now > st->due && now - st->due > st->late_ns)
+                    st->late_ns = now - st->due;
+                set[st->step >> 24] |= GPIO_MASK(st->step);
+                nset++;
+            }
+
+            st->position += st->direction;
+            st->next++;
+            if (st->next < st->nsteps)
+                st->due += st->interval[st->next];
+            else
+                active--;
+        }
+
+        if (nset > 0) {
+            for (p = 0; p < GPIO_NPORTS; p++) {
+                if (set[p])
+                    gpio_port_reg("ABCDEFGHJK"[p])->latset = set[p];
+            }
+            gpio_udelay(PULSE_USEC);
+            for (p = 0; p < GPIO_NPORTS; p++) {
+                if (set[p])
+                    gpio_port_reg("ABCDEFGHJK"[p])->latclr = set[p];
+            }
+        }
+    }
+
+    // Let the last hardware pulses finish.
+    gpio_udelay(OC_LEAD_NS / 1000 + PULSE_USEC);
+    return 0;
+}
+
+//
+// Release the step table and the OC unit.
+// The last OC unit released stops the timer.
+//
+void gpio_stepper_close(gpio_stepper_t *st)
+{
+    free(st->interval);
+    st->interval = 0;
+    st->nsteps = 0;
+
+    if (st->oc) {
+        st->ocreg->con = 0;
+        gpio_set_mode(st->step, MODE_OUTPUT);
+        oc_busy &= ~(1 << st->oc);
+        st->oc = 0;
+        stepper_timer_release();
+    }
+}
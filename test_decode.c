@@ -0,0 +1,523 @@
+/*
+ * Tests of protocol decoders on synthetic captures.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gpio.h"
+
+//
+// Pins of the synthetic captures, on port B unless a test
+// spreads them over several ports.
+//
+#define RX      GPIO_PIN('B', 2)    // UART receive, I2C data
+#define CLK     GPIO_PIN('B', 0)    // SPI and I2C clock
+#define MOSI    GPIO_PIN('B', 4)
+#define MISO    GPIO_PIN('B', 8)
+#define SDA     RX
+#define SCL     CLK
+#define DQ      GPIO_PIN('B', 3)    // 1-Wire
+
+#define PERIOD_NS   1000            // One sample per microsecond
+#define MAX_VALUES  (5 << 20)       // Frames times ports
+
+//
+// Frames of a decoder's file window, as in decode.c.
+//
+#define WINDOW_FRAMES(nports)   ((4 << 20) / ((nports) * 2))
+
+static uint16_t sample[MAX_VALUES];
+static uint64_t nsamples;
+static gpio_capture_header_t layout;    // Ports and segments of the capture
+static unsigned levels[GPIO_NPORTS];
+static int nfailed;
+
+//
+// Start a new capture of given ports, like "BD", with all pins low.
+//
+static void start(const char *ports)
+{
+    memset(&layout, 0, sizeof(layout));
+    layout.nports = strlen(ports);
+    memcpy(layout.port, ports, layout.nports);
+    memset(levels, 0, sizeof(levels));
+    nsamples = 0;
+}
+
+//
+// Drive a pin of the capture.
+//
+static void drive(int pin, int value)
+{
+    char *p = memchr(layout.port, GPIO_PORT(pin), layout.nports);
+    int k = p - layout.port;
+
+    if (value)
+        levels[k] |= GPIO_MASK(pin);
+    else
+        levels[k] &= ~GPIO_MASK(pin);
+}
+
+//
+// Keep the levels for a number of samples.
+//
+static void hold(int n)
+{
+    unsigned k;
+
+    while (n-- > 0 && (nsamples + 1) * layout.nports <= MAX_VALUES) {
+        for (k = 0; k < layout.nports; k++)
+            sample[nsamples * layout.nports + k] = levels[k];
+        nsamples++;
+    }
+}
+
+//
+// Write the capture to a temporary file and run decoders on it.
+// Return -1 on error.
+//
+static int decode(gpio_decoder_t *d, int ndec)
+{
+    char path[] = "/tmp/test_decode.XXXXXX";
+    gpio_capture_header_t hdr = layout;
+    size_t nbytes = nsamples * layout.nports * 2;
+    gpio_capfile_t file;
+    int status;
+
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+
+    memcpy(hdr.magic, GPIO_CAPTURE_MAGIC, sizeof(hdr.magic));
+    hdr.version = GPIO_CAPTURE_VERSION;
+    hdr.period_ns = PERIOD_NS;
+    hdr.nsamples = nsamples;
+    status = (write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+              write(fd, sample, nbytes) == (ssize_t) nbytes) ? 0 : -1;
+    close(fd);
+
+    if (status == 0 && gpio_capfile_open(&file, path) == 0) {
+        status = gpio_decode(&file, d, ndec);
+        gpio_capfile_close(&file);
+    } else
+        status = -1;
+    unlink(path);
+    return status;
+}
+
+//
+// Compare a decoded frame with the expected one.
+//
+static void expect(const char *test, const gpio_decoder_t *d, size_t i,
+                   int type, uint32_t value, int flags)
+{
+    if (i >= d->nframes) {
+        printf("%s: frame %zu missing\n", test, i);
+        nfailed++;
+        return;
+    }
+    const gpio_frame_t *f = &d->frame[i];
+    if (f->type != type || f->value != value || f->flags != flags) {
+        printf("%s: frame %zu is type %d value 0x%x flags 0x%x, expected %d 0x%x 0x%x\n",
+            test, i, f->type, f->value, f->flags, type, value, flags);
+        nfailed++;
+    }
+}
+
+//
+// Check the number of decoded frames.
+//
+static void expect_count(const char *test, const gpio_decoder_t *d, size_t n)
+{
+    if (d->nframes != n) {
+        printf("%s: %zu frames decoded, expected %zu\n", test, d->nframes, n);
+        nfailed++;
+    }
+}
+
+//
+// Send one UART byte at 100 kbaud, 10 samples per bit,
+// with a given level of the stop bit.
+//
+static void uart_byte(int pin, unsigned value, int stop)
+{
+    int i;
+
+    drive(pin, 0);
+    hold(10);
+    for (i = 0; i < 8; i++) {
+        drive(pin, value >> i & 1);
+        hold(10);
+    }
+    drive(pin, stop);
+    hold(10);
+    drive(pin, 1);
+}
+
+//
+// UART 8N1 at 100 kbaud: two bytes,
+// the second with a missing stop bit.
+//
+static void test_uart()
+{
+    gpio_decoder_t d = { .proto = GPIO_PROTO_UART, .pin = { RX }, .baud = 100000 };
+
+    start("B");
+    drive(RX, 1);
+    hold(50);
+    uart_byte(RX, 'A', 1);
+    hold(30);
+    uart_byte(RX, 0x96, 0);
+    hold(30);
+
+    if (decode(&d, 1) < 0) {
+        printf("uart: decoding failed\n");
+        nfailed++;
+        return;
+    }
+    expect_count("uart", &d, 2);
+    expect("uart", &d, 0, GPIO_FRAME_DATA, 'A', 0);
+    expect("uart", &d, 1, GPIO_FRAME_DATA, 0x96, GPIO_FLAG_ERROR);
+    gpio_decoder_free(&d);
+}
+
+//
+// Send one SPI byte each way in mode 0, MSB first, on pins
+// CLK, MOSI and MISO or -1, with a given number of samples
+// per half clock.
+//
+static void spi_byte(const int *pin, unsigned mosi, unsigned miso, int half)
+{
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        drive(pin[1], mosi >> i & 1);
+        if (pin[2] >= 0)
+            drive(pin[2], miso >> i & 1);
+        hold(half);
+        drive(pin[0], 1);
+        hold(half);
+        drive(pin[0], 0);
+    }
+}
+
+//
+// SPI mode 0, MSB first: one byte each way.
+//
+static void test_spi()
+{
+    gpio_decoder_t d = { .proto = GPIO_PROTO_SPI, .pin = { CLK, MOSI, MISO, -1 } };
+    const unsigned mosi = 0xa5, miso = 0x3c;
+
+    start("B");
+    hold(10);
+    spi_byte(d.pin, mosi, miso, 3);
+    hold(10);
+
+    if (decode(&d, 1) < 0) {
+        printf("spi: decoding failed\n");
+        nfailed++;
+        return;
+    }
+    expect_count("spi", &d, 1);
+    expect("spi", &d, 0, GPIO_FRAME_DATA, mosi | miso << 8, GPIO_FLAG_MISO);
+    gpio_decoder_free(&d);
+}
+
+//
+// Send one I2C byte and the acknowledge bit.
+//
+static void i2c_byte(unsigned value, int nak)
+{
+    int i;
+
+    for (i = 8; i >= 0; i--) {
+        drive(SDA, i ? value >> (i - 1) & 1 : nak);
+        hold(3);
+        drive(SCL, 1);
+        hold(3);
+        drive(SCL, 0);
+    }
+}
+
+//
+// I2C: write to address 0x50, one data byte not acknowledged.
+//
+static void test_i2c()
+{
+    gpio_decoder_t d = { .proto = GPIO_PROTO_I2C, .pin = { SDA, SCL } };
+
+    start("B");
+    drive(SDA, 1);
+    drive(SCL, 1);
+    hold(10);
+    drive(SDA, 0);                  // Start
+    hold(3);
+    drive(SCL, 0);
+    i2c_byte(0x50 << 1, 0);
+    i2c_byte(0x12, 1);
+    drive(SDA, 0);
+    hold(3);
+    drive(SCL, 1);
+    hold(3);
+    drive(SDA, 1);                  // Stop
+    hold(10);
+
+    if (decode(&d, 1) < 0) {
+        printf("i2c: decoding failed\n");
+        nfailed++;
+        return;
+    }
+    expect_count("i2c", &d, 4);
+    expect("i2c", &d, 0, GPIO_FRAME_START, 0, 0);
+    expect("i2c", &d, 1, GPIO_FRAME_DATA, 0x50 << 1, GPIO_FLAG_ADDRESS);
+    expect("i2c", &d, 2, GPIO_FRAME_DATA, 0x12, GPIO_FLAG_NAK);
+    expect("i2c", &d, 3, GPIO_FRAME_STOP, 0, 0);
+    gpio_decoder_free(&d);
+}
+
+//
+// Send one 1-Wire bit: a 1 is a short low pulse,
+// a 0 holds the line low for most of the slot.
+//
+static void onewire_bit(int bit)
+{
+    drive(DQ, 0);
+    hold(bit ? 5 : 60);
+    drive(DQ, 1);
+    hold(bit ? 60 : 5);
+}
+
+//
+// 1-Wire: reset, presence and a Skip ROM command, LSB first.
+//
+static void test_onewire()
+{
+    gpio_decoder_t d = { .proto = GPIO_PROTO_ONEWIRE, .pin = { DQ } };
+    int i;
+
+    start("B");
+    drive(DQ, 1);
+    hold(20);
+    drive(DQ, 0);                   // Reset
+    hold(500);
+    drive(DQ, 1);
+    hold(30);
+    drive(DQ, 0);                   // Presence
+    hold(120);
+    drive(DQ, 1);
+    hold(350);
+    for (i = 0; i < 8; i++)
+        onewire_bit(0xcc >> i & 1);
+    hold(20);
+
+    if (decode(&d, 1) < 0) {
+        printf("onewire: decoding failed\n");
+        nfailed++;
+        return;
+    }
+    expect_count("onewire", &d, 3);
+    expect("onewire", &d, 0, GPIO_FRAME_RESET, 0, 0);
+    expect("onewire", &d, 1, GPIO_FRAME_PRESENCE, 0, 0);
+    expect("onewire", &d, 2, GPIO_FRAME_DATA, 0xcc, 0);
+    gpio_decoder_free(&d);
+}
+
+//
+// Three ports, so frames straddle the blocks of the vector scan,
+// with UART and SPI decoded together.  Pins of the SPI decoder are
+// on different ports.  A pin with the same number as the UART pin
+// toggles on another port: the blocks it marks must decode to nothing.
+//
+static void test_ports()
+{
+    const int rx = GPIO_PIN('D', 5), noise = GPIO_PIN('F', 5);
+    gpio_decoder_t d[2] = {
+        { .proto = GPIO_PROTO_UART, .pin = { rx }, .baud = 100000 },
+        { .proto = GPIO_PROTO_SPI, .pin = { GPIO_PIN('B', 0), GPIO_PIN('D', 4),
+                                            GPIO_PIN('F', 8), -1 } },
+    };
+    int i;
+
+    start("BDF");
+    drive(rx, 1);
+    hold(17);
+    for (i = 0; i < 40; i++) {
+        drive(noise, i & 1);
+        hold(7);
+    }
+    uart_byte(rx, 0x55, 1);
+    hold(13);
+    spi_byte(d[1].pin, 0x81, 0x7e, 1);
+    hold(5);
+    uart_byte(rx, 0xe7, 1);
+    spi_byte(d[1].pin, 0x42, 0x24, 2);
+    hold(11);
+
+    if (decode(d, 2) < 0) {
+        printf("ports: decoding failed\n");
+        nfailed++;
+        return;
+    }
+    expect_count("ports uart", &d[0], 2);
+    expect("ports uart", &d[0], 0, GPIO_FRAME_DATA, 0x55, 0);
+    expect("ports uart", &d[0], 1, GPIO_FRAME_DATA, 0xe7, 0);
+    expect_count("ports spi", &d[1], 2);
+    expect("ports spi", &d[1], 0, GPIO_FRAME_DATA, 0x81 | 0x7e << 8, GPIO_FLAG_MISO);
+    expect("ports spi", &d[1], 1, GPIO_FRAME_DATA, 0x42 | 0x24 << 8, GPIO_FLAG_MISO);
+    gpio_decoder_free(&d[0]);
+    gpio_decoder_free(&d[1]);
+}
+
+//
+// A capture longer than two file windows.  Right before every window
+// boundary comes a UART byte, whose stop bit is sampled only at the
+// next edge of its pin, in the next window.  Then an SPI byte runs
+// across the boundary, with an edge on every frame, so edges fall
+// on the frame shared by two windows and on the frames next to it.
+//
+static void test_window()
+{
+    const int rx = GPIO_PIN('D', 2);
+    const uint64_t window = WINDOW_FRAMES(2);
+    gpio_decoder_t d[2] = {
+        { .proto = GPIO_PROTO_UART, .pin = { rx }, .baud = 100000 },
+        { .proto = GPIO_PROTO_SPI, .pin = { CLK, MOSI, -1, -1 } },
+    };
+    uint64_t boundary;
+    int nbytes = 0;
+
+    start("BD");
+    drive(rx, 1);
+    for (boundary = window - 1; boundary < 2 * window; boundary += window - 1) {
+        hold(boundary - 8 - 100 - nsamples);
+        uart_byte(rx, 0x30 + nbytes, 1);
+        spi_byte(d[1].pin, 0xc0 + nbytes, 0, 1);
+        nbytes++;
+    }
+    hold(100);
+    if (nsamples <= 2 * window) {
+        printf("window: capture of %llu frames is too short\n", (unsigned long long) nsamples);
+        nfailed++;
+        return;
+    }
+
+    if (decode(d, 2) < 0) {
+        printf("window: decoding failed\n");
+        nfailed++;
+        return;
+    }
+    expect_count("window uart", &d[0], nbytes);
+    expect_count("window spi", &d[1], nbytes);
+    while (nbytes-- > 0) {
+        expect("window uart", &d[0], nbytes, GPIO_FRAME_DATA, 0x30 + nbytes, 0);
+        expect("window spi", &d[1], nbytes, GPIO_FRAME_DATA, 0xc0 + nbytes, 0);
+    }
+    gpio_decoder_free(&d[0]);
+    gpio_decoder_free(&d[1]);
+}
+
+//
+// Triggered capture of three segments, which the decoder must take
+// one by one.  The second segment starts in the middle of a byte
+// and ends in the middle of another: neither may produce a frame,
+// nor disturb the byte of the next segment.
+//
+static void test_segments()
+{
+    gpio_decoder_t d = { .proto = GPIO_PROTO_UART, .pin = { RX }, .baud = 100000 };
+    const int segment = 20 + 1 + 200;
+
+    start("B");
+    layout.flags = GPIO_CAPTURE_TRIGGERED;
+    layout.pretrigger = 20;
+    layout.posttrigger = 200;
+    layout.ntriggers = 3;
+
+    drive(RX, 1);
+    hold(30);
+    uart_byte(RX, 'A', 1);
+    hold(91);
+
+    drive(RX, 0);                   // Tail of a zero byte
+    hold(30);
+    drive(RX, 1);
+    hold(20);
+    uart_byte(RX, 'Z', 1);
+    hold(31);
+    uart_byte(RX, 0x05, 1);         // Cut after three bits
+    nsamples -= 60;
+
+    drive(RX, 1);
+    hold(40);
+    uart_byte(RX, 0x5a, 1);
+    hold(81);
+    if (nsamples != 3 * segment) {
+        printf("segments: capture of %llu frames, expected %d\n",
+            (unsigned long long) nsamples, 3 * segment);
+        nfailed++;
+        return;
+    }
+
+    if (decode(&d, 1) < 0) {
+        printf("segments: decoding failed\n");
+        nfailed++;
+        return;
+    }
+    expect_count("segments", &d, 3);
+    expect("segments", &d, 0, GPIO_FRAME_DATA, 'A', 0);
+    expect("segments", &d, 1, GPIO_FRAME_DATA, 'Z', 0);
+    expect("segments", &d, 2, GPIO_FRAME_DATA, 0x5a, 0);
+    if (d.nframes == 3 && (d.frame[1].sample != segment + 50 ||
+                           d.frame[2].sample != 2 * segment + 40)) {
+        printf("segments: bytes at samples %llu and %llu, expected %d and %d\n",
+            (unsigned long long) d.frame[1].sample,
+            (unsigned long long) d.frame[2].sample,
+            segment + 50, 2 * segment + 40);
+        nfailed++;
+    }
+    gpio_decoder_free(&d);
+}
+
+int main()
+{
+    test_uart();
+    test_spi();
+    test_i2c();
+    test_onewire();
+    test_ports();
+    test_window();
+    test_segments();
+
+    if (nfailed) {
+        printf("%d checks failed\n", nfailed);
+        return 1;
+    }
+    printf("All decoder tests passed.\n");
+    return 0;
+}
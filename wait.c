@@ -0,0 +1,174 @@
+/*
+ * Wait for an edge on a PIC32 GPIO pin.
+ *
+ * Copyright (C) 2019 Serge Vakulenko
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. The name of the author may not be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <time.h>
+#include "gpio.h"
+
+//
+// Limits of the sleep between polls, in usec.
+//
+#define MIN_SLEEP_USEC  20
+#define MAX_SLEEP_USEC  10000
+
+//
+// Check a new sample of the pin against the last level.
+// A change status with the same level means a pulse shorter than
+// the poll period: it has both a rising and a falling edge.
+// Return 1 when the requested edge happened.
+//
+static int edge_seen(gpio_edge_t edge, int last, int level, int changed,
+                     gpio_wait_result_t *result)
+{
+    if (level != last) {
+        result->edge = level ? GPIO_EDGE_RISING : GPIO_EDGE_FALLING;
+        return edge == GPIO_EDGE_BOTH || edge == result->edge;
+    }
+    if (changed) {
+        result->edge = GPIO_EDGE_BOTH;
+        return 1;
+    }
+    return 0;
+}
+
+//
+// Wait for an edge on a pin, or until timeout (negative for none).
+// Spin on the port register for spin_usec, then poll change
+// notification status with sleeps doubled up to MAX_SLEEP_USEC.
+// Return 1 on edge, 0 on timeout, -1 on error.
+//
+int gpio_wait_edge(int pin, gpio_edge_t edge, int timeout_msec,
+                   unsigned spin_usec, gpio_wait_result_t *result)
+{
+    if (pin & GPIO_VIRTUAL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int port = GPIO_PORT(pin);
+    unsigned mask = GPIO_MASK(pin);
+    struct gpioreg *reg = gpio_port_reg(port);
+    if (!reg)
+        return -1;
+
+    uint64_t start = gpio_time_ns();
+    uint64_t end = (timeout_msec < 0) ? ~0ULL : start + timeout_msec * 1000000ULL;
+    uint64_t spin_end = start + spin_usec * 1000ULL;
+    uint64_t last_sample = start, now;
+    int last = (reg->port & mask) != 0;
+    int level, status = 0;
+
+    // Reading the port has cleared the change status.
+    int was_enabled = reg->cnen & mask;
+    if (!was_enabled)
+        gpio_enable_change(port, mask);
+
+    // Spin phase: detection within one port read.
+    result->spinning = 1;
+    for (;;) {
+        level = (reg->port & mask) != 0;
+        now = gpio_time_ns();
+        if (edge_seen(edge, last, level, 0, result)) {
+            status = 1;
+            goto done;
+        }
+        last = level;
+        if (now >= spin_end || now >= end)
+            break;
+        last_sample = now;
+    }
+
+    // Sleep phase: the change status keeps short pulses.
+    result->spinning = 0;
+    unsigned sleep_usec = MIN_SLEEP_USEC;
+    while (now < end) {
+        uint64_t wake = now + sleep_usec * 1000ULL;
+        struct timespec t;
+
+        if (wake > end)
+            wake = end;
+        t.tv_sec = wake / 1000000000;
+        t.tv_nsec = wake % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, 0) == EINTR)
+            continue;
+
+        last_sample = now;
+        int changed = reg->cnstat & mask;
+        level = (reg->port & mask) != 0;
+        now = gpio_time_ns();
+        if (edge_seen(edge, last, level, changed, result)) {
+            status = 1;
+            goto done;
+        }
+        last = level;
+        if (sleep_usec < MAX_SLEEP_USEC)
+            sleep_usec *= 2;
+    }
+done:
+    if (!was_enabled)
+        gpio_disable_change(port, mask);
+    result->level = level;
+    result->time_ns = now;
+    result->latency_ns = now - last_sample;
+    return status;
+}
+
+//
+// Wait for change notification on any pin of a set, or until timeout.
+// Sleeps between polls of the status grow from MIN_SLEEP_USEC
+// to MAX_SLEEP_USEC, so a long wait costs little CPU.
+// Return 1 on change, 0 on timeout.
+//
+int gpio_wait_change(const char *port, const unsigned *mask, int nports, int timeout_msec)
+{
+    uint64_t now = gpio_time_ns();
+    uint64_t end = (timeout_msec < 0) ? ~0ULL : now + timeout_msec * 1000000ULL;
+    unsigned sleep_usec = MIN_SLEEP_USEC;
+    int k;
+
+    for (;;) {
+        for (k = 0; k < nports; k++) {
+            if (gpio_read_change(port[k]) & mask[k])
+                return 1;
+        }
+        if (now >= end)
+            return 0;
+
+        uint64_t wake = now + sleep_usec * 1000ULL;
+        struct timespec t;
+
+        if (wake > end)
+            wake = end;
+        t.tv_sec = wake / 1000000000;
+        t.tv_nsec = wake % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, 0) == EINTR)
+            continue;
+
+        now = gpio_time_ns();
+        if (sleep_usec < MAX_SLEEP_USEC)
+            sleep_usec *= 2;
+    }
+}